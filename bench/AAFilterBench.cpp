@@ -0,0 +1,127 @@
+// Cost of the TwinPeaks anti-aliasing filters of ripples/aafilter.hpp (elliptic
+// SOS cascades) and ripples/polyphase.hpp (polyphase FIR), in ns per sample on
+// float_4, for three upsamplers and one downsampler as in RipplesPolyEngine.
+// Also gives the gain of the oversampling round trip at the passband corner of
+// the quality, 20 kHz for Standard and High and 16 kHz for Eco.
+//
+// Then both filters at High quality per sample rate and channel count, one set
+// of filters per group of four channels.
+
+#include <cmath>
+#include <cstdio>
+
+#include "BenchTimer.hpp"
+#include "filter/aafilter.hpp"
+#include "filter/polyphase.hpp"
+#include "rack.hpp"
+
+using rack::simd::float_4;
+
+static const int SAMPLES = 1 << 14;
+static const int REPEAT = 10;
+
+// Keeps the results alive so the filters are not optimized away
+static volatile float sink;
+
+// Upsamples one input sample and downsamples it back
+template <typename Filter>
+static float_4 step(Filter* filters, float_4 in) {
+    int factor = filters[0].GetOversamplingFactor();
+    float_4 output = 0.f;
+    for (int i = 0; i < factor; i++) {
+        float_4 up[3];
+        for (int j = 0; j < 3; j++) {
+            up[j] = filters[j].ProcessUp(i == 0 ? in * (float)factor : 0.f);
+        }
+        output = filters[0].ProcessDown(up[0] + 1e-3f * (up[1] + up[2]));
+    }
+    return output;
+}
+
+// Runs the filters over in, one input sample per step, and returns the output
+template <typename Filter>
+static void run(Filter* filters, const float_4* in, float_4* out, int samples) {
+    for (int n = 0; n < samples; n++) {
+        out[n] = step(filters, in[n]);
+    }
+}
+
+template <template <typename> class Filter>
+static void benchChannels(const char* name, const float_4* in) {
+    std::printf("\n%s, High quality\n", name);
+    printTimingHeader();
+    for (float sampleRate : BENCH_SAMPLE_RATES) {
+        for (int channels : BENCH_CHANNELS) {
+            Filter<float_4> filters[4][3];
+            for (int g = 0; g < 4; g++) {
+                for (Filter<float_4>& filter : filters[g]) filter.Init(sampleRate, ripples::kQualityHigh);
+            }
+            FrameTiming timing = timeFrames(sampleRate, channels, SAMPLES, REPEAT, [&](int n) {
+                float_4 sum = 0.f;
+                for (int g = 0; g < (channels + 3) / 4; g++) sum += step(filters[g], in[n]);
+                sink = sum[0];
+            });
+            printTiming(sampleRate, channels, timing);
+        }
+    }
+}
+
+template <template <typename> class Filter>
+static double nsPerSample(float sampleRate, ripples::Quality quality, const float_4* in, float_4* out) {
+    Filter<float_4> filters[3];
+    for (Filter<float_4>& filter : filters) filter.Init(sampleRate, quality);
+    double seconds = fastestRun(REPEAT, [&] {
+        run(filters, in, out, SAMPLES);
+        sink = out[SAMPLES - 1][0];
+    });
+    return seconds * 1e9 / SAMPLES;
+}
+
+// Gain in dB of upsampling and downsampling a sine at frequency
+template <template <typename> class Filter>
+static double gainAt(float sampleRate, ripples::Quality quality, float frequency) {
+    Filter<float_4> filters[3];
+    for (Filter<float_4>& filter : filters) filter.Init(sampleRate, quality);
+    static float_4 in[SAMPLES], out[SAMPLES];
+    for (int n = 0; n < SAMPLES; n++) in[n] = std::sin(2. * M_PI * frequency * n / sampleRate);
+    run(filters, in, out, SAMPLES);
+    // Past the filters' settling
+    double inPower = 0., outPower = 0.;
+    for (int n = SAMPLES / 2; n < SAMPLES; n++) {
+        inPower += in[n][0] * in[n][0];
+        outPower += out[n][0] * out[n][0];
+    }
+    return 10. * std::log10(outPower / inPower);
+}
+
+int main() {
+    static float_4 in[SAMPLES], out[SAMPLES];
+    for (int n = 0; n < SAMPLES; n++) {
+        // Different signals per lane, as for four voices
+        for (int l = 0; l < 4; l++) in[n][l] = std::sin(0.01f * (l + 1) * n);
+    }
+
+    const float sampleRates[] = {44100.f, 48000.f, 96000.f};
+    const char* qualityNames[] = {"Eco", "Standard", "High"};
+
+    std::printf("anti-aliasing filters, ns/sample on float_4 and dB at the passband corner\n\n");
+    std::printf("%-7s %-9s %6s %9s %9s %9s %9s\n", "rate", "quality", "factor", "SOS ns", "FIR ns", "SOS dB",
+                "FIR dB");
+    for (float sampleRate : sampleRates) {
+        for (int q = ripples::kQualityEco; q <= ripples::kQualityHigh; q++) {
+            ripples::Quality quality = (ripples::Quality)q;
+            float corner = (quality == ripples::kQualityEco) ? 16000.f : 20000.f;
+            ripples::AAFilter<float_4> probe;
+            probe.Init(sampleRate, quality);
+            std::printf("%-7.0f %-9s %6d %9.1f %9.1f %9.2f %9.2f\n", sampleRate, qualityNames[q],
+                        probe.GetOversamplingFactor(), nsPerSample<ripples::AAFilter>(sampleRate, quality, in, out),
+                        nsPerSample<ripples::PolyphaseAAFilter>(sampleRate, quality, in, out),
+                        gainAt<ripples::AAFilter>(sampleRate, quality, corner),
+                        gainAt<ripples::PolyphaseAAFilter>(sampleRate, quality, corner));
+        }
+    }
+
+    benchChannels<ripples::AAFilter>("elliptic SOS filters", in);
+    benchChannels<ripples::PolyphaseAAFilter>("polyphase FIR filters", in);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Runs f() repeat times and returns the duration of the fastest run in
+// seconds, the one least disturbed by the rest of the system.
+template <typename F>
+double fastestRun(int repeat, F f) {
+    typedef std::chrono::steady_clock Clock;
+    double best = 1e30;
+    for (int i = 0; i < repeat; i++) {
+        Clock::time_point start = Clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+    return best;
+}
+
+// Sample rates and channel counts the DSP cores are timed at, those Rack offers
+static const float BENCH_SAMPLE_RATES[] = {44100.f, 48000.f, 96000.f, 192000.f, 384000.f, 768000.f};
+static const int BENCH_CHANNELS[] = {1, 4, 8, 16};
+
+struct FrameTiming {
+    // Million samples per second over all channels, from the fastest run
+    double msamples;
+    // Share of the time of a frame at the sample rate, in percent
+    double load;
+    // Time to process one frame of all channels, in ns
+    double p50, p99, max;
+};
+
+// Times a DSP core that processes frame n of all channels in frame(n). The
+// throughput is from the fastest of repeat runs of frames frames. The latency
+// percentiles are from one more run timing each frame on its own, less the
+// cost of reading the clock, so they are the cost of a frame as Rack's engine
+// sees it, one process() call per frame.
+template <typename F>
+FrameTiming timeFrames(float sampleRate, int channels, int frames, int repeat, F frame) {
+    typedef std::chrono::steady_clock Clock;
+    FrameTiming timing;
+    double seconds = fastestRun(repeat, [&] {
+        for (int n = 0; n < frames; n++) frame(n);
+    });
+    timing.msamples = (double)frames * channels / seconds * 1e-6;
+    timing.load = seconds * sampleRate / frames * 100.;
+
+    // Cheapest of many clock reads
+    double clockCost = 1e30;
+    for (int i = 0; i < 1000; i++) {
+        Clock::time_point start = Clock::now();
+        clockCost = std::min(clockCost, std::chrono::duration<double>(Clock::now() - start).count());
+    }
+
+    std::vector<double> latencies(frames);
+    for (int n = 0; n < frames; n++) {
+        Clock::time_point start = Clock::now();
+        frame(n);
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count() - clockCost;
+        latencies[n] = std::max(elapsed, 0.) * 1e9;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    timing.p50 = latencies[frames / 2];
+    timing.p99 = latencies[frames * 99 / 100];
+    timing.max = latencies[frames - 1];
+    return timing;
+}
+
+inline void printTimingHeader() {
+    std::printf("%-7s %3s %10s %7s %9s %9s %9s\n", "rate", "ch", "Msample/s", "load %", "p50 ns", "p99 ns",
+                "max ns");
+}
+
+inline void printTiming(float sampleRate, int channels, const FrameTiming& timing) {
+    std::printf("%-7.0f %3d %10.1f %7.2f %9.0f %9.0f %9.0f\n", sampleRate, channels, timing.msamples, timing.load,
+                timing.p50, timing.p99, timing.max);
+}
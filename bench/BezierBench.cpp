@@ -0,0 +1,41 @@
+// Cost of BezierGenerator, the random voltages of Bezier, per sample rate and
+// channel count. The voices step at about 32 Hz from staggered phases and
+// glide along a curved CURVE setting, the costly case, with seeded uniform
+// random values and the output limited as by the Clip position of LIMIT.
+
+#include <cstdio>
+
+#include "BenchTimer.hpp"
+#include "BezierGenerator.hpp"
+
+using rack::simd::float_4;
+
+static const int FRAMES = 1 << 14;
+static const int REPEAT = 5;
+
+// Keeps the results alive so the generator is not optimized away
+static volatile float sink;
+
+int main() {
+    std::printf("bezier generator, CURVE at 0.5\n");
+    printTimingHeader();
+    for (float sampleRate : BENCH_SAMPLE_RATES) {
+        for (int channels : BENCH_CHANNELS) {
+            BezierGenerator generator;
+            generator.rng.seed(1);
+            for (int c = 0; c < channels; c++) generator.startVoice(c, (float)c / channels, 0.f, 0.f);
+            float sampleTime = 1.f / sampleRate;
+            FrameTiming timing = timeFrames(sampleRate, channels, FRAMES, REPEAT, [&](int n) {
+                generator.beginFrame(0.5f, sampleTime);
+                float_4 sum = 0.f, pulse;
+                for (int g = 0; g < (channels + 3) / 4; g++) {
+                    float_4 out = generator.process(g, sampleTime, 5.f, 0.f, 0.f, 1.f, false, 0.f, pulse);
+                    sum += BezierGenerator::limit(out, 1);
+                }
+                sink = sum[0];
+            });
+            printTiming(sampleRate, channels, timing);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,163 @@
+// Throughput of the bytebeat engine tiers, in ns per evaluation, for the
+// classic formulas of BytebeatCorpus.hpp and for random expressions of growing
+// size. a/b/c are held, as with the knobs of Byte standing still, so every tier
+// only runs the t dependent part for most evaluations.
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "BenchTimer.hpp"
+#include "ByteBeatParser.hpp"
+#include "BytebeatCorpus.hpp"
+#include "BytebeatJit.hpp"
+#include "BytebeatReference.hpp"
+
+static const int LANES = BytebeatProgram::LANES;
+static const int TIERS = 8;
+static const char* tierNames[TIERS] = {"tree", "bytecode", "optimized", "block", "lanes", "jit", "jit block", "jit lanes"};
+
+// Keeps the results alive so the evaluations are not optimized away
+static volatile int32_t sink;
+
+// ns per evaluation of evaluateBlock(), consecutive t as for a mono voice
+static double timeBlock(BytebeatProgram& program, int evaluations, int repeat, int a, int b, int c) {
+    return fastestRun(repeat, [&] {
+        int32_t sum = 0, out[LANES];
+        for (int t = 0; t < evaluations; t += LANES) {
+            program.evaluateBlock(t, a, b, c, out);
+            for (int l = 0; l < LANES; l++) sum += out[l];
+        }
+        sink = sum;
+    }) * 1e9 / evaluations;
+}
+
+// ns per evaluation of evaluateLanes(), independent t per lane as for
+// polyphonic voices
+static double timeLanes(BytebeatProgram& program, int evaluations, int repeat, const int32_t* a, const int32_t* b,
+                        const int32_t* c) {
+    return fastestRun(repeat, [&] {
+        int32_t sum = 0, out[LANES];
+        uint32_t ts[LANES];
+        for (int t = 0; t < evaluations; t += LANES) {
+            for (int l = 0; l < LANES; l++) ts[l] = (uint32_t)t * 7 + (uint32_t)l * 1031;
+            program.evaluateLanes(ts, a, b, c, out);
+            for (int l = 0; l < LANES; l++) sum += out[l];
+        }
+        sink = sum;
+    }) * 1e9 / evaluations;
+}
+
+// ns per evaluation of each tier for one expression
+static void measure(const std::string& text, int evaluations, int repeat, double* ns) {
+    BytebeatParser tree(text);
+    BytebeatProgram bytecode, optimized, jit;
+    BytebeatCompiler(text).compile(bytecode, false);
+    BytebeatCompiler(text).compile(optimized);
+    BytebeatCompiler(text).compile(jit);
+    bool native = BytebeatJit::compile(jit);
+    const int a = 3, b = 5, c = 7;
+
+    // The tree walker parses on every evaluation, it gets fewer of them
+    int treeEvaluations = evaluations / 256;
+    ns[0] = fastestRun(repeat, [&] {
+        int32_t sum = 0;
+        for (int t = 0; t < treeEvaluations; t++) sum += tree.parseAndEvaluate(t, a, b, c);
+        sink = sum;
+    }) * 1e9 / treeEvaluations;
+    ns[1] = fastestRun(repeat, [&] {
+        int32_t sum = 0;
+        for (int t = 0; t < evaluations; t++) sum += bytecode.evaluate(t, a, b, c);
+        sink = sum;
+    }) * 1e9 / evaluations;
+    ns[2] = fastestRun(repeat, [&] {
+        int32_t sum = 0;
+        for (int t = 0; t < evaluations; t++) sum += optimized.evaluate(t, a, b, c);
+        sink = sum;
+    }) * 1e9 / evaluations;
+    ns[3] = timeBlock(optimized, evaluations, repeat, a, b, c);
+    int32_t as[LANES], bs[LANES], cs[LANES];
+    std::fill(as, as + LANES, a);
+    std::fill(bs, bs + LANES, b);
+    std::fill(cs, cs + LANES, c);
+    ns[4] = timeLanes(optimized, evaluations, repeat, as, bs, cs);
+    ns[5] = !native ? 0. : fastestRun(repeat, [&] {
+        int32_t sum = 0;
+        for (int t = 0; t < evaluations; t++) sum += jit.evaluate(t, a, b, c);
+        sink = sum;
+    }) * 1e9 / evaluations;
+    ns[6] = !native ? 0. : timeBlock(jit, evaluations, repeat, a, b, c);
+    ns[7] = !native ? 0. : timeLanes(jit, evaluations, repeat, as, bs, cs);
+}
+
+static void printHeader(const char* title) {
+    std::printf("%-40s", title);
+    for (int k = 0; k < TIERS; k++) std::printf(" %9s", tierNames[k]);
+    std::printf("\n");
+}
+
+static void printRow(const std::string& name, const double* ns) {
+    std::printf("%-40s", name.c_str());
+    for (int k = 0; k < TIERS; k++) {
+        if (ns[k] > 0.)
+            std::printf(" %9.2f", ns[k]);
+        else
+            std::printf(" %9s", "-");
+    }
+    std::printf("\n");
+}
+
+int main(int argc, char** argv) {
+    int evaluations = argc > 1 ? std::atoi(argv[1]) : 1 << 18;
+    const int repeat = 5;
+    const int EXPRESSIONS = 20;
+
+    std::printf("bytebeat ns/evaluation, %s\n\n", BytebeatJit::supported() ? "native code" : "no native code");
+    printHeader("classic formulas");
+    double logSum[TIERS] = {};
+    for (const Case& c : classicCorpus) {
+        double ns[TIERS];
+        measure(c.text, evaluations, repeat, ns);
+        std::string name = c.text.size() > 38 ? c.text.substr(0, 35) + "..." : c.text;
+        printRow(name, ns);
+        for (int k = 0; k < TIERS; k++) logSum[k] += std::log(ns[k] > 0. ? ns[k] : 1.);
+    }
+    double mean[TIERS];
+    for (int k = 0; k < TIERS; k++) mean[k] = std::exp(logSum[k] / classicCorpus.size());
+    printRow("geometric mean", mean);
+    std::printf("%-40s", "speedup over tree");
+    for (int k = 0; k < TIERS; k++) std::printf(" %8.0fx", mean[0] / mean[k]);
+    std::printf("\n\n");
+
+    // The figures of the first compiled programs were for this formula, in
+    // million evaluations per second over 2M consecutive t
+    double modem[TIERS];
+    measure(modemCase.text, 1 << 21, repeat, modem);
+    std::printf("%-40s", "MODEM, M evaluations/s");
+    for (int k = 0; k < TIERS; k++) {
+        if (modem[k] > 0.)
+            std::printf(" %9.2f", 1e3 / modem[k]);
+        else
+            std::printf(" %9s", "-");
+    }
+    std::printf("\n%-40s %9s %8.1fx\n\n", "bytecode over tree", "", modem[0] / modem[1]);
+
+    printHeader("random expressions, mean of 20");
+    std::mt19937 rng(1);
+    for (int depth = 2; depth <= 10; depth += 2) {
+        double sum[TIERS] = {};
+        size_t length = 0;
+        for (int n = 0; n < EXPRESSIONS; n++) {
+            std::string text = randomCase(rng, depth).text;
+            length += text.size();
+            double ns[TIERS];
+            measure(text, evaluations, repeat, ns);
+            for (int k = 0; k < TIERS; k++) sum[k] += ns[k] / EXPRESSIONS;
+        }
+        printRow("depth " + std::to_string(depth) + ", " + std::to_string(length / EXPRESSIONS) + " characters", sum);
+    }
+    return 0;
+}
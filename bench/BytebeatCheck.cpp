@@ -0,0 +1,250 @@
+// Conformance suite for the bytebeat engine tiers of ByteBeatParser.hpp and
+// BytebeatJit.hpp: every tier is checked against a reference with the C
+// semantics documented on BytebeatOp, for a corpus of expressions and for
+// randomly generated ones, over t ranges that cross the signed and unsigned
+// wraparound points. Exits with a non-zero status on the first failing
+// expressions.
+
+#include <cinttypes>
+#include <cstdlib>
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "ByteBeatParser.hpp"
+#include "BytebeatCorpus.hpp"
+#include "BytebeatJit.hpp"
+#include "BytebeatReference.hpp"
+
+// Precedence, associativity and the pinned-down undefined cases
+static const std::vector<Case> corpus = {
+    CASE(t),
+    CASE(a),
+    CASE(42),
+    CASE(t * 5 & t >> 7 | t * 3 & t * 4 >> 10),
+    CASE(t + t & t ^ t >> 6),
+    CASE(t - a - b - c),
+    CASE(t / a / b),
+    CASE(t % a % b),
+    CASE(t << 1 + a),
+    CASE(t >> a << b),
+    CASE(t < a == b >= c),
+    CASE(t <= b | t >= c ^ t < c),
+    CASE(t != 3 ? 1 : 2),
+    CASE(t ? t ? 1 : 2 : 3),
+    CASE(t & 1 ? a : t & 2 ? b : c),
+    CASE((t & 4096 ? 6 : 16) + (1 & t >> 14)),
+    CASE(-t * ~t),
+    CASE(~-~-t),
+    CASE(- -t - -a),
+    CASE(t * t * t),
+    CASE(3 * 4 + t),
+    CASE(t / 2 + t % 8 + t * 16),
+    CASE(t / (t >> 10 & t)),
+    CASE(t % (t >> 10 & t)),
+    CASE(t / (a - 64)),
+    CASE(t % (b - 64)),
+    CASE(t / 0 + t % 0),
+    CASE((t - t - 2147483647 - 1) / (a - a - 1)),
+    CASE((t - t - 2147483647 - 1) % (b - b - 1)),
+    CASE(t << 31 >> 31),
+    CASE(t << 32 | t >> 33),
+    CASE(t << a >> b),
+    CASE(1 << t),
+    CASE(-1 >> t),
+    CASE(t * 1024 / 8),
+    CASE(t * 1024 % 8),
+    CASE((t - 100000) / 8 + (t - 100000) % 8),
+    CASE((t - 1000) / 1024 % 16 - (t - 7) % 2),
+    CASE(t * 0 + a * 1 + (b ^ b) + (c | 0)),
+    CASE((t >> 8) * (t >> 8) + (t >> 8)),
+    CASE(t * 2147483647),
+    CASE(t + 2147483647),
+    CASE(a * b >> c),
+};
+
+// Expressions both front ends must reject, with the position of the error
+struct Invalid {
+    const char* text;
+    size_t position;
+};
+
+static const std::vector<Invalid> invalid = {
+    {"", 0},
+    {"t+", 2},
+    {"(t", 2},
+    {"t?1", 3},
+    {"t)", 1},
+    {"x", 0},
+    {"t**2", 2},
+};
+
+static const int LANES = BytebeatProgram::LANES;
+
+// Groups of LANES evaluations. Even groups are runs of consecutive t with the
+// same a/b/c, as Byte computes them with evaluateBlock(); odd groups have
+// independent inputs per lane, as polyphonic voices pass them to evaluateLanes().
+struct Inputs {
+    std::vector<uint32_t> t;
+    std::vector<int32_t> a, b, c;
+
+    size_t groups() const {
+        return t.size() / LANES;
+    }
+
+    bool isRun(size_t group) const {
+        return group % 2 == 0;
+    }
+};
+
+static Inputs makeInputs(std::mt19937& rng) {
+    // Both wraparound points of t, plus a/b/c in the 0..128 range of the knobs
+    // and the extreme values the semantics must still define
+    const uint32_t starts[] = {0, 1000, 65536 - 8, 0x7fffffffu - 8, 0xffffffffu - 8};
+    const int32_t extremes[] = {0, 1, -1, 31, 32, 33, 64, 128, INT32_MIN, INT32_MAX};
+    Inputs in;
+    auto pick = [&](int group) -> int32_t {
+        if (group % 4 >= 2)
+            return extremes[rng() % 10];
+        return (int32_t)(rng() % 129);
+    };
+    for (int group = 0; group < 24; group++) {
+        uint32_t start = group < 10 ? starts[group / 2] : rng();
+        int32_t a = pick(group), b = pick(group), c = pick(group);
+        for (int l = 0; l < LANES; l++) {
+            bool run = group % 2 == 0;
+            in.t.push_back(run ? start + (uint32_t)l : rng());
+            in.a.push_back(run ? a : pick(group));
+            in.b.push_back(run ? b : pick(group));
+            in.c.push_back(run ? c : pick(group));
+        }
+    }
+    return in;
+}
+
+static int failures = 0;
+
+static void fail(const std::string& text, const char* tier, const Inputs& in, size_t i, int32_t got, int32_t want) {
+    if (failures++ < 20) {
+        std::printf("FAIL %-9s %s\n     t=%" PRIu32 " a=%" PRId32 " b=%" PRId32 " c=%" PRId32 ": %" PRId32
+                    ", expected %" PRId32 "\n",
+                    tier, text.c_str(), in.t[i], in.a[i], in.b[i], in.c[i], got, want);
+    }
+}
+
+static void check(const std::string& text, const Reference& reference, const Inputs& in) {
+    std::vector<int32_t> want(in.t.size());
+    for (size_t i = 0; i < in.t.size(); i++) {
+        want[i] = reference(Int((int32_t)in.t[i]), in.a[i], in.b[i], in.c[i]).v;
+    }
+
+    BytebeatParser tree(text);
+    BytebeatProgram bytecode, optimized, jit;
+    BytebeatDiagnostic diagnostic = BytebeatCompiler(text).compile(bytecode, false);
+    BytebeatCompiler(text).compile(optimized);
+    BytebeatCompiler(text).compile(jit);
+    if (!diagnostic.ok()) {
+        std::printf("FAIL %s does not compile: %s at %zu\n", text.c_str(), diagnostic.message(), diagnostic.position);
+        failures++;
+        return;
+    }
+    bool native = BytebeatJit::compile(jit);
+    if (BytebeatJit::supported() && !native) {
+        std::printf("FAIL %s does not compile to native code\n", text.c_str());
+        failures++;
+    }
+
+    // Scalar tiers, each evaluation in order so a/b/c changes invalidate the uniform section
+    struct Scalar {
+        const char* name;
+        std::function<int32_t(uint32_t, int32_t, int32_t, int32_t)> evaluate;
+    };
+    Scalar scalars[] = {
+        {"tree", [&](uint32_t t, int32_t a, int32_t b, int32_t c) { return tree.parseAndEvaluate(t, a, b, c); }},
+        {"bytecode", [&](uint32_t t, int32_t a, int32_t b, int32_t c) { return bytecode.evaluate(t, a, b, c); }},
+        {"optimized", [&](uint32_t t, int32_t a, int32_t b, int32_t c) { return optimized.evaluate(t, a, b, c); }},
+        {"jit", [&](uint32_t t, int32_t a, int32_t b, int32_t c) { return jit.evaluate(t, a, b, c); }},
+    };
+    for (const Scalar& scalar : scalars) {
+        for (size_t i = 0; i < in.t.size(); i++) {
+            int32_t got = scalar.evaluate(in.t[i], in.a[i], in.b[i], in.c[i]);
+            if (got != want[i]) {
+                fail(text, scalar.name, in, i, got, want[i]);
+                break;
+            }
+        }
+    }
+
+    // Block and lane tiers, of the bytecode, the optimized and the native program
+    // as the uniform section of a block runs natively
+    struct Vector {
+        const char* name;
+        BytebeatProgram* program;
+        bool block;
+    };
+    Vector vectors[] = {
+        {"block", &bytecode, true},  {"block", &optimized, true}, {"jit block", &jit, true},
+        {"lanes", &bytecode, false}, {"lanes", &optimized, false}, {"jit lanes", &jit, false},
+    };
+    for (const Vector& vector : vectors) {
+        for (size_t group = 0; group < in.groups(); group++) {
+            size_t i = group * LANES;
+            int32_t out[LANES];
+            if (vector.block) {
+                if (!in.isRun(group))
+                    continue;
+                vector.program->evaluateBlock(in.t[i], in.a[i], in.b[i], in.c[i], out);
+            } else {
+                vector.program->evaluateLanes(&in.t[i], &in.a[i], &in.b[i], &in.c[i], out);
+            }
+            int l = 0;
+            while (l < LANES && out[l] == want[i + l])
+                l++;
+            if (l < LANES) {
+                fail(text, vector.name, in, i + l, out[l], want[i + l]);
+                break;
+            }
+        }
+    }
+}
+
+static void checkInvalid(const Invalid& invalid) {
+    BytebeatParser tree(invalid.text);
+    BytebeatProgram program;
+    int32_t result = tree.parseAndEvaluate(1, 2, 3, 4);
+    BytebeatDiagnostic diagnostic = BytebeatCompiler(invalid.text).compile(program);
+    if (tree.diagnostic().ok() || diagnostic.ok() || result != 0 || !program.empty() ||
+        tree.diagnostic().position != invalid.position || diagnostic.position != invalid.position) {
+        std::printf("FAIL \"%s\" should be rejected at %zu: tree at %zu (%s), compiler at %zu (%s)\n", invalid.text,
+                    invalid.position, tree.diagnostic().position, tree.diagnostic().message(), diagnostic.position,
+                    diagnostic.message());
+        failures++;
+    }
+}
+
+int main(int argc, char** argv) {
+    int count = argc > 1 ? std::atoi(argv[1]) : 5000;
+    std::mt19937 rng(1);
+    Inputs in = makeInputs(rng);
+
+    for (const Case& c : corpus) {
+        check(c.text, c.reference, in);
+    }
+    for (const Case& c : classicCorpus) {
+        check(c.text, c.reference, in);
+    }
+    for (const Invalid& i : invalid) {
+        checkInvalid(i);
+    }
+    for (int n = 0; n < count; n++) {
+        Case c = randomCase(rng, 1 + n % 7);
+        check(c.text, c.reference, in);
+    }
+
+    std::printf("bytebeat: %zu corpus, %zu classic, %zu invalid and %d random expressions, %s, %d failures\n",
+                corpus.size(), classicCorpus.size(), invalid.size(), count,
+                BytebeatJit::supported() ? "native code" : "no native code", failures);
+    return failures ? 1 : 0;
+}
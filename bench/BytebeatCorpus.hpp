@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+
+#include "BytebeatReference.hpp"
+
+// The MODEM expression, the formula of the first figures for compiled Byte
+// programs, kept on its own so the bench can report it against them
+static const Case modemCase = CASE(100 * ((t << 2 | t >> 5 | t ^ 63) & (t << 10 | t >> 11)));
+
+// Classic bytebeat formulas, from the 2011 threads where the form was found and
+// the collections that followed, with hexadecimal constants written in decimal.
+// The last ones use a, b and c as Byte patches do.
+static const std::vector<Case> classicCorpus = {
+    modemCase,
+    CASE(t * (42 & t >> 10)),
+    CASE(t * ((t >> 12 | t >> 8) & 63 & t >> 4)),
+    CASE((t * (t >> 5 | t >> 8)) >> (t >> 16)),
+    CASE(t * 5 & t >> 7 | t * 3 & t >> 10),
+    CASE(t * (t >> 11 & t >> 8 & 123 & t >> 3)),
+    CASE((t >> 6 | t | t >> (t >> 16)) * 10 + (t >> 11 & 7)),
+    CASE((t | t >> 9 | t >> 7) * t & (t >> 11 | t >> 9)),
+    CASE(t * 5 & t >> 7 | t * 3 & t * 4 >> 10),
+    CASE((t >> 7 | t | t >> 6) * 10 + 4 * (t & t >> 13 | t >> 6)),
+    CASE(t & 4096 ? (t * (t ^ t % 255) | t >> 4) >> 1 : t >> 3 | (t & 8192 ? t << 2 : t)),
+    CASE((t * (t >> 8 | t >> 9) & 46 & t >> 8) ^ (t & t >> 13 | t >> 6)),
+    CASE(t * ((t >> 9 ^ (t >> 9) - 1 ^ 1) % 13)),
+    CASE(t * (51864 >> (t >> 9 & 14) & 15) | t >> 8),
+    CASE((~t >> 2) * ((127 & t * (7 & t >> 10)) < (245 & t * (2 + (5 & t >> 14))))),
+    CASE(t * (t >> 8 * (t >> 15 | t >> 8) & (20 | (t >> 19) * 5 >> t | t >> 3))),
+    CASE((t * 9 & t >> 4 | t * 5 & t >> 7 | t * 3 & t / 1024) - 1),
+    CASE(t >> 4 | t & (t >> 5) / (t >> 7 - (t >> 15) & -t >> 7 - (t >> 15))),
+    CASE(t * ((t & 4096 ? 6 : 16) + (1 & t >> 14)) >> (3 & t >> 8) | t >> (t & 4096 ? 3 : 4)),
+    CASE(t * (t >> a | t >> b) & c),
+    CASE(t * a & t >> b | t * c & t >> 10),
+    CASE((t >> a) * (t >> b) % (c + 1) + t * (42 & t >> 10)),
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <random>
+#include <string>
+
+// 32-bit integer with the semantics of the bytebeat language, computed
+// independently of bytebeatApply(): operations are done on 64 bits and
+// truncated. The corpus below is also parsed by the C++ compiler, so C provides
+// the reference for precedence and associativity.
+struct Int {
+    int32_t v;
+
+    Int(int32_t v) : v(v) {}
+
+    explicit operator bool() const {
+        return v != 0;
+    }
+};
+
+inline Int wrap(int64_t x) {
+    return Int((int32_t)(uint32_t)(uint64_t)x);
+}
+
+inline Int operator-(Int x) { return wrap(-(int64_t)x.v); }
+inline Int operator~(Int x) { return wrap(-(int64_t)x.v - 1); }
+inline Int operator*(Int x, Int y) { return wrap((int64_t)x.v * y.v); }
+inline Int operator/(Int x, Int y) { return y.v == 0 ? Int(0) : wrap((int64_t)x.v / y.v); }
+inline Int operator%(Int x, Int y) { return y.v == 0 ? Int(0) : wrap((int64_t)x.v % y.v); }
+inline Int operator+(Int x, Int y) { return wrap((int64_t)x.v + y.v); }
+inline Int operator-(Int x, Int y) { return wrap((int64_t)x.v - y.v); }
+inline Int operator<<(Int x, Int y) { return wrap((int64_t)((uint64_t)(int64_t)x.v << (y.v & 31))); }
+// Rounds toward minus infinity, like the arithmetic shift of the CPU
+inline Int operator>>(Int x, Int y) {
+    int64_t d = (int64_t)1 << (y.v & 31);
+    return wrap(x.v >= 0 ? x.v / d : -((-(int64_t)x.v + d - 1) / d));
+}
+inline Int operator<(Int x, Int y) { return Int(x.v < y.v); }
+inline Int operator<=(Int x, Int y) { return Int(x.v <= y.v); }
+inline Int operator>(Int x, Int y) { return Int(x.v > y.v); }
+inline Int operator>=(Int x, Int y) { return Int(x.v >= y.v); }
+inline Int operator==(Int x, Int y) { return Int(x.v == y.v); }
+inline Int operator!=(Int x, Int y) { return Int(x.v != y.v); }
+inline Int operator&(Int x, Int y) { return wrap((int64_t)x.v & y.v); }
+inline Int operator^(Int x, Int y) { return wrap((int64_t)x.v ^ y.v); }
+inline Int operator|(Int x, Int y) { return wrap((int64_t)x.v | y.v); }
+
+typedef std::function<Int(Int t, Int a, Int b, Int c)> Reference;
+
+struct Case {
+    std::string text;
+    Reference reference;
+};
+
+// Expression whose text is compiled both by the tier under test and by the C++
+// compiler as the reference. Corpora of cases rely on precedence on purpose.
+#pragma GCC diagnostic ignored "-Wparentheses"
+#define CASE(expr) {#expr, [](Int t, Int a, Int b, Int c) -> Int { (void)t, (void)a, (void)b, (void)c; return expr; }}
+
+// Random fully parenthesized expression over all operators, with its reference
+inline Case randomCase(std::mt19937& rng, int depth) {
+    std::uniform_int_distribution<int> d(0, 99);
+    int r = d(rng);
+    if (depth <= 0 || r < 20) {
+        switch (d(rng) % 8) {
+            case 0: return {"t", [](Int t, Int, Int, Int) { return t; }};
+            case 1: return {"a", [](Int, Int a, Int, Int) { return a; }};
+            case 2: return {"b", [](Int, Int, Int b, Int) { return b; }};
+            case 3: return {"c", [](Int, Int, Int, Int c) { return c; }};
+            default: {
+                uint32_t values[] = {1u << (d(rng) % 32), (uint32_t)(d(rng) % 4), (uint32_t)(rng() % 100000), (uint32_t)rng()};
+                uint32_t value = values[d(rng) % 4];
+                // Decimal literals wrap to 32 bits like the constants of the parser
+                Int v((int32_t)value);
+                return {std::to_string(value), [v](Int, Int, Int, Int) { return v; }};
+            }
+        }
+    }
+    if (r < 28) {
+        Case x = randomCase(rng, depth - 1);
+        Reference fx = x.reference;
+        if (d(rng) % 2)
+            return {"-(" + x.text + ")", [fx](Int t, Int a, Int b, Int c) { return -fx(t, a, b, c); }};
+        return {"~(" + x.text + ")", [fx](Int t, Int a, Int b, Int c) { return ~fx(t, a, b, c); }};
+    }
+    if (r < 36) {
+        Case x = randomCase(rng, depth - 1), y = randomCase(rng, depth - 1), z = randomCase(rng, depth - 1);
+        Reference fx = x.reference, fy = y.reference, fz = z.reference;
+        return {"(" + x.text + "?" + y.text + ":" + z.text + ")", [fx, fy, fz](Int t, Int a, Int b, Int c) {
+                    return fx(t, a, b, c) ? fy(t, a, b, c) : fz(t, a, b, c);
+                }};
+    }
+    Case x = randomCase(rng, depth - 1);
+    // Repeated operands exercise common subexpression elimination and x^x, x-x, ...
+    Case y = d(rng) < 30 ? x : randomCase(rng, depth - 1);
+    Reference fx = x.reference, fy = y.reference;
+    typedef Int (*Binary)(Int, Int);
+    static const struct {
+        const char* text;
+        Binary op;
+    } ops[] = {
+        {"|", [](Int x, Int y) { return x | y; }},   {"^", [](Int x, Int y) { return x ^ y; }},
+        {"&", [](Int x, Int y) { return x & y; }},   {"==", [](Int x, Int y) { return x == y; }},
+        {"!=", [](Int x, Int y) { return x != y; }}, {"<", [](Int x, Int y) { return x < y; }},
+        {">", [](Int x, Int y) { return x > y; }},   {"<=", [](Int x, Int y) { return x <= y; }},
+        {">=", [](Int x, Int y) { return x >= y; }}, {"<<", [](Int x, Int y) { return x << y; }},
+        {">>", [](Int x, Int y) { return x >> y; }}, {"+", [](Int x, Int y) { return x + y; }},
+        {"-", [](Int x, Int y) { return x - y; }},   {"*", [](Int x, Int y) { return x * y; }},
+        {"/", [](Int x, Int y) { return x / y; }},   {"%", [](Int x, Int y) { return x % y; }},
+    };
+    int k = d(rng) % 16;
+    Binary op = ops[k].op;
+    return {"(" + x.text + ops[k].text + y.text + ")",
+            [fx, fy, op](Int t, Int a, Int b, Int c) { return op(fx(t, a, b, c), fy(t, a, b, c)); }};
+}
@@ -0,0 +1,81 @@
+// Throughput of the FastMath.hpp kernels against libm, in ns per value, for
+// the float version, the float_4 version and the libm function on floats.
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "BenchTimer.hpp"
+#include "FastMath.hpp"
+
+using rack::simd::float_4;
+
+static const int VALUES = 4096;
+static const int REPEAT = 20;
+static const int PASSES = 64;
+
+// Keeps the results alive so the calls are not optimized away
+static volatile float sink;
+
+template <typename F, typename V, typename L>
+static void measure(const char* name, const std::vector<float>& x, const std::vector<float>& y, F f, V v, L libm) {
+    double scalar = fastestRun(REPEAT, [&] {
+        float sum = 0.f;
+        for (int pass = 0; pass < PASSES; pass++) {
+            for (int i = 0; i < VALUES; i++) sum += f(x[i], y[i]);
+        }
+        sink = sum;
+    });
+    double vector = fastestRun(REPEAT, [&] {
+        float_4 sum = 0.f;
+        for (int pass = 0; pass < PASSES; pass++) {
+            for (int i = 0; i < VALUES; i += 4) sum += v(float_4::load(&x[i]), float_4::load(&y[i]));
+        }
+        sink = sum[0] + sum[1] + sum[2] + sum[3];
+    });
+    double reference = fastestRun(REPEAT, [&] {
+        float sum = 0.f;
+        for (int pass = 0; pass < PASSES; pass++) {
+            for (int i = 0; i < VALUES; i++) sum += libm(x[i], y[i]);
+        }
+        sink = sum;
+    });
+    double scale = 1e9 / ((double)VALUES * PASSES);
+    std::printf("%-10s %9.2f %9.2f %9.2f\n", name, scalar * scale, vector * scale, reference * scale);
+}
+
+int main() {
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(-1.f, 1.f);
+    std::vector<float> octave(VALUES), positive(VALUES), exponent(VALUES), drive(VALUES), sine(VALUES), cosine(VALUES);
+    for (int i = 0; i < VALUES; i++) {
+        // Pitch in octaves around C4, levels and exponents of envelope curves,
+        // drive of a saturator and a point on the unit circle
+        octave[i] = 5.f * unit(rng);
+        positive[i] = 0.5f * unit(rng) + 0.5f + 1e-3f;
+        exponent[i] = 4.f * unit(rng);
+        drive[i] = 3.f * unit(rng);
+        float angle = 3.14159265f * unit(rng);
+        sine[i] = std::sin(angle);
+        cosine[i] = std::cos(angle);
+    }
+
+    std::printf("fastmath ns/value\n\n%-10s %9s %9s %9s\n", "", "float", "float_4", "libm");
+    measure(
+        "exp2", octave, octave, [](float x, float) { return fastmath::exp2(x); },
+        [](float_4 x, float_4) { return fastmath::exp2(x); }, [](float x, float) { return std::exp2(x); });
+    measure(
+        "log2", positive, positive, [](float x, float) { return fastmath::log2(x); },
+        [](float_4 x, float_4) { return fastmath::log2(x); }, [](float x, float) { return std::log2(x); });
+    measure(
+        "pow", positive, exponent, [](float x, float y) { return fastmath::pow(x, y); },
+        [](float_4 x, float_4 y) { return fastmath::pow(x, y); }, [](float x, float y) { return std::pow(x, y); });
+    measure(
+        "tanhPade", drive, drive, [](float x, float) { return fastmath::tanhPade(x); },
+        [](float_4 x, float_4) { return fastmath::tanhPade(x); }, [](float x, float) { return std::tanh(x); });
+    measure(
+        "atan2", sine, cosine, [](float y, float x) { return fastmath::atan2(y, x); },
+        [](float_4 y, float_4 x) { return fastmath::atan2(y, x); }, [](float y, float x) { return std::atan2(y, x); });
+    return 0;
+}
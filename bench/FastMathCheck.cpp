@@ -0,0 +1,230 @@
+// Accuracy of the FastMath.hpp kernels against libm, computed in double, over
+// the domains of the bounds documented in the header. Also checks that the
+// float and simd::float_4 versions give the same results. Exits with a
+// non-zero status if a bound does not hold.
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+#include "FastMath.hpp"
+
+using rack::simd::float_4;
+
+static int failures = 0;
+
+// Largest ratio of error to bound over a sweep, and the arguments it was found at
+struct Worst {
+    const char* name;
+    double ratio = 0.;
+    double error = 0.;
+    float a = 0.f, b = 0.f;
+    long mismatches = 0;
+
+    explicit Worst(const char* name) : name(name) {}
+
+    void add(double error, double bound, float a, float b = 0.f) {
+        if (error / bound > ratio) {
+            ratio = error / bound;
+            this->error = error;
+            this->a = a;
+            this->b = b;
+        }
+    }
+
+    void report() {
+        bool ok = ratio < 1. && mismatches == 0;
+        std::printf("%-8s %-5s worst error %.3g at (%.9g, %.9g), %.0f%% of the bound, %ld float_4 mismatches\n",
+                    name, ok ? "ok" : "FAIL", error, a, b, ratio * 100., mismatches);
+        if (!ok)
+            failures++;
+    }
+};
+
+static float fromBits(uint32_t bits) {
+    float x;
+    std::memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+// The kernels, for both float and float_4
+struct Exp2 {
+    template <typename T>
+    T operator()(T x, T) const {
+        return fastmath::exp2(x);
+    }
+};
+
+struct Log2 {
+    template <typename T>
+    T operator()(T x, T) const {
+        return fastmath::log2(x);
+    }
+};
+
+struct Pow {
+    template <typename T>
+    T operator()(T x, T y) const {
+        return fastmath::pow(x, y);
+    }
+};
+
+struct TanhPade {
+    template <typename T>
+    T operator()(T x, T) const {
+        return fastmath::tanhPade(x);
+    }
+};
+
+struct Atan2 {
+    template <typename T>
+    T operator()(T y, T x) const {
+        return fastmath::atan2(y, x);
+    }
+};
+
+// Feeds inputs 4 at a time to the float_4 version of a kernel and one at a time
+// to the float version, counts the results that differ and passes those of the
+// float version to error(worst, x, y, result)
+template <typename Kernel, typename Error>
+struct Sweep {
+    Worst& worst;
+    Kernel kernel;
+    Error error;
+    float x[4], y[4];
+    int n = 0;
+
+    Sweep(Worst& worst, Error error) : worst(worst), error(error) {}
+
+    void add(float a, float b = 0.f) {
+        x[n] = a;
+        y[n] = b;
+        if (++n < 4)
+            return;
+        n = 0;
+        float_4 v = kernel(float_4::load(x), float_4::load(y));
+        for (int k = 0; k < 4; k++) {
+            float result = kernel(x[k], y[k]);
+            if (std::memcmp(&result, &v.s[k], sizeof(float)) != 0)
+                worst.mismatches++;
+            error(worst, x[k], y[k], result);
+        }
+    }
+};
+
+template <typename Kernel, typename Error>
+Sweep<Kernel, Error> makeSweep(Worst& worst, Error error) {
+    return Sweep<Kernel, Error>(worst, error);
+}
+
+static void checkExp2() {
+    Worst worst("exp2");
+    auto sweep = makeSweep<Exp2>(worst, [](Worst& worst, float x, float, float result) {
+        double ref = std::exp2((double)x);
+        worst.add(std::fabs(result - ref) / ref, 2e-7, x);
+    });
+    // Every third float of (-1, 1) down to 2^-32, where the fraction is, then a
+    // grid over the domain
+    for (uint32_t bits = 0x3f7fffffu; bits > 0x2f800000u; bits -= 3) {
+        sweep.add(fromBits(bits));
+        sweep.add(-fromBits(bits));
+    }
+    const int N = 1 << 24;
+    for (int n = 1; n < N; n++) {
+        sweep.add(-126.f + 252.f * n / (N - 1));
+    }
+    worst.report();
+}
+
+static void checkLog2() {
+    Worst worst("log2");
+    auto sweep = makeSweep<Log2>(worst, [](Worst& worst, float x, float, float result) {
+        double ref = std::log2((double)x);
+        worst.add(std::fabs(result - ref), 1.2e-7 * std::max(1., std::fabs(ref)), x);
+    });
+    // Every normal float of [1/4, 4), every 7th one elsewhere
+    for (uint32_t bits = 0x00800000u; bits < 0x7f800000u;) {
+        sweep.add(fromBits(bits));
+        bits += (bits >= 0x3e800000u && bits < 0x40800000u) ? 1 : 7;
+    }
+    worst.report();
+}
+
+static void checkPow() {
+    Worst worst("pow");
+    auto sweep = makeSweep<Pow>(worst, [](Worst& worst, float x, float y, float result) {
+        if (x <= 0.f) {
+            worst.add(result == 0.f ? 0. : 1., 0.5, x, y);
+            return;
+        }
+        double l = (double)y * std::log2((double)x);
+        if (x < 1.17549435e-38f || std::fabs(l) >= 126.)
+            return;
+        double ref = std::pow((double)x, (double)y);
+        double bound = 2e-7 + 1.4e-7 * std::fabs(y) * std::max(1., std::fabs(std::log2((double)x)));
+        worst.add(std::fabs(result - ref) / ref, bound, x, y);
+    });
+    // Log-uniform normal x, and y keeping |y * log2(x)| in the domain
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> exponent(-126.f, 127.f), unit(-1.f, 1.f);
+    const int N = 1 << 24;
+    for (int n = 0; n < N; n++) {
+        float x = std::exp2(exponent(rng));
+        sweep.add(x, unit(rng) * 125.f / std::max(std::fabs(std::log2(x)), 1e-3f));
+    }
+    // x <= 0 gives 0
+    const float zeros[] = {0.f, -0.f, -1.f, -1e30f};
+    for (float x : zeros) sweep.add(x, 2.f);
+    worst.report();
+}
+
+static void checkTanhPade() {
+    Worst worst("tanhPade");
+    const float limit = 2.f * std::sqrt(3.f);
+    const float saturated = fastmath::tanhPade(limit);
+    auto sweep = makeSweep<TanhPade>(worst, [=](Worst& worst, float x, float, float result) {
+        worst.add(std::fabs(result - std::tanh((double)x)), 1.1e-2, x);
+        // Constant from the limit on
+        if (std::fabs(x) >= limit && std::fabs(result) != saturated)
+            worst.add(1., 0.5, x);
+    });
+    const int N = 1 << 24;
+    for (int n = 0; n < N; n++) {
+        sweep.add(-20.f + 40.f * n / (N - 1));
+    }
+    worst.add(fastmath::tanhPade(0.f) == 0.f ? 0. : 1., 0.5, 0.f);
+    worst.report();
+    std::printf("%-8s       value from |x| = 2 * sqrt(3) on: %.9g\n", "", saturated);
+}
+
+static void checkAtan2() {
+    Worst worst("atan2");
+    auto sweep = makeSweep<Atan2>(worst, [](Worst& worst, float y, float x, float result) {
+        worst.add(std::fabs(result - std::atan2((double)y, (double)x)), 2e-6, y, x);
+    });
+    // Every direction around the circle, at magnitudes from 2^-125 to 2^125
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<double> exponent(-125., 125.);
+    const int N = 1 << 24;
+    for (int n = 0; n < N; n++) {
+        double angle = 2. * M_PI * n / N - M_PI;
+        double r = std::exp2(exponent(rng));
+        sweep.add((float)(r * std::sin(angle)), (float)(r * std::cos(angle)));
+    }
+    // The axes
+    sweep.add(0.f, 1.f);
+    sweep.add(1.f, 0.f);
+    sweep.add(0.f, -1.f);
+    sweep.add(-1.f, 0.f);
+    worst.report();
+}
+
+int main() {
+    checkExp2();
+    checkLog2();
+    checkPow();
+    checkTanhPade();
+    checkAtan2();
+    std::printf("fastmath: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
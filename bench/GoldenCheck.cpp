@@ -0,0 +1,272 @@
+// Regression check of the DSP cores against committed renders. Each render
+// runs a core over seeded, fixed inputs and settings, and is compared with
+// golden/<name>.f32, the same render as 32-bit little-endian floats, frame by
+// frame and lane by lane. A render passes if no sample is off by more than
+// TOLERANCE, in volts like the outputs of the modules.
+//
+// TOLERANCE, 1e-4 V or 100 dB below 10 V, is the level Resonators and
+// TwinPeaks already treat as silence. Renders with the same compiler and flags
+// are bit-exact. Other flags round differently: built with -O2 -march=native
+// or with FMA, the renders were at most 4e-5 V off, the resonators the most.
+// The renders are short and the resonances stay below self-oscillation, so
+// rounding differences do not build up. Anything beyond the tolerance is a
+// change of the DSP.
+//
+// Usage: GoldenCheck [--write] [directory], directory defaulting to golden.
+// --write renders the golden files anew, see `make golden`, for changes that
+// are meant to change the output. Exits with a non-zero status on a mismatch
+// or a missing file.
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "BezierGenerator.hpp"
+#include "ResonatorsBank.hpp"
+#include "RichEnvelope.hpp"
+#include "SimdRandom.hpp"
+#include "filter/ripples.hpp"
+
+using rack::simd::float_4;
+
+static const double TOLERANCE = 1e-4;
+static const int FRAMES = 1024;
+
+static void append(std::vector<float>& out, float_4 x) {
+    for (int i = 0; i < 4; i++) out.push_back(x[i]);
+}
+
+// Seeded noise in [-5, 5] V, different per lane
+static std::vector<float_4> noise(uint64_t seed) {
+    SimdRandom rng;
+    rng.seed(seed);
+    std::vector<float_4> x(FRAMES);
+    for (float_4& value : x) value = 10.f * rng.uniform() - 5.f;
+    return x;
+}
+
+// One RipplesPolyEngine filtering noise, its cutoff swept by the FM CV
+template <template <typename> class Filter>
+static std::vector<float> renderRipples(float sampleRate, ripples::Quality quality, int mode) {
+    ripples::RipplesPolyEngine<Filter> engine;
+    engine.setSampleRate(sampleRate, quality);
+    engine.seedNoise(1);
+    std::vector<float_4> input = noise(2);
+    ripples::RipplesPolyFrame frame = {};
+    frame.res_knob = 0.5f;
+    frame.freq_knob = 0.6f;
+    frame.fm_knob = 0.5f;
+    frame.fm_global_knob = 1.f;
+    frame.track_knob = 0.1f;
+    frame.mode = mode;
+    std::vector<float> out;
+    for (int n = 0; n < FRAMES; n++) {
+        frame.input = input[n];
+        frame.fm_cv = float_4(-2.f, -1.f, 0.f, 1.f) + 2.f * n / FRAMES;
+        engine.process(frame);
+        append(out, frame.output);
+    }
+    return out;
+}
+
+// The oversampling round trip of TwinPeaks, three upsamplers and one downsampler
+template <template <typename> class Filter>
+static std::vector<float> renderAntiAliasing(float sampleRate, ripples::Quality quality) {
+    Filter<float_4> filters[3];
+    for (Filter<float_4>& filter : filters) filter.Init(sampleRate, quality);
+    int factor = filters[0].GetOversamplingFactor();
+    std::vector<float_4> input = noise(3);
+    std::vector<float> out;
+    for (int n = 0; n < FRAMES; n++) {
+        float_4 output = 0.f;
+        for (int i = 0; i < factor; i++) {
+            float_4 up[3];
+            for (int j = 0; j < 3; j++) {
+                up[j] = filters[j].ProcessUp(i == 0 ? input[n] * (float)factor : 0.f);
+            }
+            output = filters[0].ProcessDown(up[0] + 1e-3f * (up[1] + up[2]));
+        }
+        append(out, output);
+    }
+    return out;
+}
+
+// One bank struck by a burst of noise, gliding up a fifth, with controls
+// read every 16 samples
+static std::vector<float> renderResonators(int interpolation) {
+    const float sampleRate = 48000.f;
+    const int frames = 1024;
+    std::vector<float> lines(4 * frames, 0.f);
+    ResonatorsBank bank;
+    bank.delayBuffer = lines.data();
+    bank.bufferMask = frames - 1;
+    float maxDelaySamples = (float)(frames - ResonatorsBank::DELAY_MARGIN);
+    std::vector<float_4> input = noise(4);
+    std::vector<float> out;
+    for (int n = 0; n < FRAMES; n++) {
+        if (n % 16 == 0) {
+            float_4 pitch = float_4(-1.f, 0.f, 7.f / 12.f, 1.f) + (7.f / 12.f) * n / FRAMES;
+            bank.setControls(pitch, float_4(0.5f, 0.7f, 0.9f, 1.f), float_4(0.2f, 0.4f, 0.6f, 0.8f), 0.5f,
+                             sampleRate, maxDelaySamples, 16);
+        }
+        append(out, bank.process(n < 128 ? input[n][0] : 0.f, interpolation));
+    }
+    return out;
+}
+
+// Four voices triggered at different rates, so they retrigger while attacking
+// and decaying, with every other trigger accented. Envelope and accent of each
+// frame.
+static std::vector<float> renderRich(bool exponentialAttack, int exponentType, bool retriggerStrategy, float steps,
+                                     bool invert) {
+    const float sampleRate = 48000.f;
+    RichEnvelope envelope;
+    envelope.exponentialAttack = exponentialAttack;
+    envelope.exponentType = exponentType;
+    envelope.retriggerStrategy = retriggerStrategy;
+    const int periods[4] = {97, 211, 389, 1000};
+    float_4 attack(0.05f, 0.1f, 0.15f, 0.2f);
+    float_4 decay(0.2f, 0.25f, 0.3f, 0.35f);
+    std::vector<float> out;
+    for (int n = 0; n < FRAMES; n++) {
+        for (int c = 0; c < 4; c++) {
+            if (n % periods[c] == 0 && !envelope.attacking(c))
+                envelope.trigger(c, (n / periods[c]) % 2 ? 5.f + c : 0.f, 0.6f, 0.8f, steps, 0.7f, invert);
+        }
+        float_4 accent;
+        append(out, envelope.process(0, 1.f / sampleRate, attack, decay, 0.6f, 0.8f, steps, 0.7f, accent));
+        append(out, 10.f * accent);
+    }
+    return out;
+}
+
+// Four voices at different rates, under frequency modulation. CURVE output,
+// offset by 1 V and limited, and TRIG output of each frame.
+static std::vector<float> renderBezier(float curve, bool normal, bool assymetric, bool continuous, int limitSwitch) {
+    const float sampleTime = 1.f / 4800.f;
+    BezierGenerator generator;
+    generator.rng.seed(5);
+    generator.distributionType = normal;
+    generator.assymetricCurve = assymetric;
+    generator.contFreqModulation = continuous;
+    generator.contLevelModulation = continuous;
+    for (int c = 0; c < 4; c++) generator.startVoice(c, 0.25f * c, 0.f, 0.5f);
+    std::vector<float> out;
+    for (int n = 0; n < FRAMES; n++) {
+        generator.beginFrame(curve, sampleTime);
+        float_4 fm = float_4(0.f, 1.f, 2.f, 3.f) * std::sin(0.01f * n);
+        float_4 level = float_4(0.5f, 1.f, 1.5f, 2.f);
+        float_4 pulse;
+        float_4 value = generator.process(0, sampleTime, 5.f, 0.5f, fm, level, false, 0.f, pulse);
+        append(out, BezierGenerator::limit(1.f + value, limitSwitch));
+        append(out, rack::simd::ifelse(pulse, 10.f, 0.f));
+    }
+    return out;
+}
+
+struct Render {
+    const char* name;
+    std::vector<float> (*render)();
+};
+
+static const Render RENDERS[] = {
+    {"ripples_elliptic_lp4_48k", [] { return renderRipples<ripples::AAFilter>(48000.f, ripples::kQualityHigh, 3); }},
+    {"ripples_elliptic_bp2_96k", [] { return renderRipples<ripples::AAFilter>(96000.f, ripples::kQualityEco, 0); }},
+    {"ripples_linear_lp2_44k", [] { return renderRipples<ripples::PolyphaseAAFilter>(44100.f, ripples::kQualityHigh, 1); }},
+    {"aafilter_sos_standard_44k", [] { return renderAntiAliasing<ripples::AAFilter>(44100.f, ripples::kQualityStandard); }},
+    {"aafilter_fir_eco_48k", [] { return renderAntiAliasing<ripples::PolyphaseAAFilter>(48000.f, ripples::kQualityEco); }},
+    {"resonators_linear", [] { return renderResonators(ResonatorsBank::LINEAR); }},
+    {"resonators_lagrange", [] { return renderResonators(ResonatorsBank::LAGRANGE); }},
+    {"resonators_allpass", [] { return renderResonators(ResonatorsBank::ALLPASS); }},
+    {"resonators_sinc", [] { return renderResonators(ResonatorsBank::SINC); }},
+    {"rich_log_quadratic_i", [] { return renderRich(false, 0, false, 3.f, false); }},
+    {"rich_exp_cubic_ii", [] { return renderRich(true, 1, true, 4.f, false); }},
+    {"rich_log_quartic_i_descending", [] { return renderRich(false, 2, false, -3.f, true); }},
+    {"rich_exp_quadratic_ii_inverted", [] { return renderRich(true, 0, true, 5.f, true); }},
+    {"bezier_uniform_clip", [] { return renderBezier(0.5f, false, false, false, 1); }},
+    {"bezier_normal_fold", [] { return renderBezier(-0.7f, true, true, true, 0); }},
+    {"bezier_uniform_wrap", [] { return renderBezier(0.f, false, false, false, -1); }},
+};
+
+static bool readFile(const std::string& path, std::vector<float>& data) {
+    FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+        return false;
+    std::fseek(file, 0, SEEK_END);
+    long size = std::ftell(file);
+    std::fseek(file, 0, SEEK_SET);
+    data.resize(size / sizeof(float));
+    bool ok = std::fread(data.data(), sizeof(float), data.size(), file) == data.size();
+    std::fclose(file);
+    return ok;
+}
+
+static bool writeFile(const std::string& path, const std::vector<float>& data) {
+    FILE* file = std::fopen(path.c_str(), "wb");
+    if (!file)
+        return false;
+    bool ok = std::fwrite(data.data(), sizeof(float), data.size(), file) == data.size();
+    std::fclose(file);
+    return ok;
+}
+
+int main(int argc, char** argv) {
+    bool write = false;
+    std::string directory = "golden";
+    for (int i = 1; i < argc; i++) {
+        if (std::strcmp(argv[i], "--write") == 0)
+            write = true;
+        else
+            directory = argv[i];
+    }
+
+    int failures = 0;
+    for (const Render& render : RENDERS) {
+        std::vector<float> output = render.render();
+        std::string path = directory + "/" + render.name + ".f32";
+        if (write) {
+            if (!writeFile(path, output)) {
+                std::printf("%-31s cannot write %s\n", render.name, path.c_str());
+                failures++;
+            }
+            continue;
+        }
+
+        std::vector<float> golden;
+        if (!readFile(path, golden)) {
+            std::printf("%-31s FAIL  cannot read %s\n", render.name, path.c_str());
+            failures++;
+            continue;
+        }
+        if (golden.size() != output.size()) {
+            std::printf("%-31s FAIL  %zu samples, %zu in %s\n", render.name, output.size(), golden.size(),
+                        path.c_str());
+            failures++;
+            continue;
+        }
+        double worst = 0.;
+        size_t worstIndex = 0;
+        for (size_t k = 0; k < output.size(); k++) {
+            double error = std::fabs((double)output[k] - golden[k]);
+            // NaN on either side counts as a mismatch
+            if (std::isnan(error))
+                error = INFINITY;
+            if (error > worst) {
+                worst = error;
+                worstIndex = k;
+            }
+        }
+        bool ok = worst <= TOLERANCE;
+        failures += !ok;
+        std::printf("%-31s %-5s worst error %.3g at sample %zu\n", render.name, ok ? "ok" : "FAIL", worst,
+                    worstIndex);
+    }
+    if (write)
+        std::printf("golden: wrote %d renders to %s, %d failures\n", (int)(sizeof(RENDERS) / sizeof(RENDERS[0])),
+                    directory.c_str(), failures);
+    else
+        std::printf("golden: %d failures, tolerance %g V\n", failures, TOLERANCE);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,91 @@
+// Cost of the delay lines and feedback filters of Resonators, one
+// ResonatorsBank per channel as the module runs them, with controls read
+// every 16 samples, the module's default. The banks ring at four pitches
+// around C4 with lines sized as the module sizes them, and never sleep. The
+// default linear interpolation is timed at every rate, the others at 48 kHz.
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+#include "BenchTimer.hpp"
+#include "ResonatorsBank.hpp"
+#include "SimdRandom.hpp"
+
+using rack::simd::float_4;
+
+static const int FRAMES = 1 << 13;
+static const int REPEAT = 3;
+static const int CONTROL_DIVISION = 16;
+
+// Keeps the results alive so the banks are not optimized away
+static volatile float sink;
+
+// Banks for 16 channels with their lines
+struct Banks {
+    ResonatorsBank banks[16];
+    std::vector<float> lines;
+    float sampleRate;
+    float maxDelaySamples;
+
+    explicit Banks(float sampleRate) : sampleRate(sampleRate) {
+        // An octave below the lowest pitch, as Resonators::getRequiredFrames() for
+        // pitches set by the knobs alone
+        float delaySamples = sampleRate / (rack::dsp::FREQ_C4 * std::pow(2.f, -2.f));
+        int frames = 1;
+        while (frames < (int)delaySamples + ResonatorsBank::DELAY_MARGIN) frames *= 2;
+        maxDelaySamples = (float)(frames - ResonatorsBank::DELAY_MARGIN);
+        lines.assign(16 * 4 * frames, 0.f);
+        for (int c = 0; c < 16; c++) {
+            banks[c].delayBuffer = &lines[c * 4 * frames];
+            banks[c].bufferMask = frames - 1;
+        }
+    }
+
+    void setControls(int c) {
+        float_4 pitch(-1.f, 0.f, 7.f / 12.f, 1.f);
+        banks[c].setControls(pitch + 0.01f * c, 0.9f, 0.5f, 0.5f, sampleRate, maxDelaySamples, CONTROL_DIVISION);
+    }
+};
+
+static FrameTiming timeBanks(float sampleRate, int channels, int interpolation, const std::vector<float>& input) {
+    Banks banks(sampleRate);
+    return timeFrames(sampleRate, channels, FRAMES, REPEAT, [&](int n) {
+        float sum = 0.f;
+        for (int c = 0; c < channels; c++) {
+            if (n % CONTROL_DIVISION == 0)
+                banks.setControls(c);
+            float_4 out = banks.banks[c].process(input[n], interpolation);
+            sum += out[0] + out[1] + out[2] + out[3];
+        }
+        sink = sum;
+    });
+}
+
+int main() {
+    // Seeded noise bursts, so the lines hold signal
+    std::vector<float> input(FRAMES);
+    SimdRandom rng;
+    rng.seed(1);
+    for (int n = 0; n < FRAMES; n++) {
+        input[n] = (n % 2048 < 256) ? 10.f * rng.uniform()[0] - 5.f : 0.f;
+    }
+
+    std::printf("resonators banks, linear interpolation\n");
+    printTimingHeader();
+    for (float sampleRate : BENCH_SAMPLE_RATES) {
+        for (int channels : BENCH_CHANNELS) {
+            printTiming(sampleRate, channels, timeBanks(sampleRate, channels, ResonatorsBank::LINEAR, input));
+        }
+    }
+
+    const char* names[] = {"linear", "lagrange", "allpass", "sinc"};
+    for (int interpolation = ResonatorsBank::LAGRANGE; interpolation <= ResonatorsBank::SINC; interpolation++) {
+        std::printf("\nresonators banks, %s interpolation\n", names[interpolation]);
+        printTimingHeader();
+        for (int channels : BENCH_CHANNELS) {
+            printTiming(48000.f, channels, timeBanks(48000.f, channels, interpolation, input));
+        }
+    }
+    return 0;
+}
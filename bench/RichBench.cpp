@@ -0,0 +1,89 @@
+// Cost of findAttackPhase() of RichEnvelope.hpp, the retrigger search of Rich,
+// in ns per call over the (shape, level) grid of RichReference.hpp for every
+// exponent and both attack curves. The mean is over the grid, the worst is the
+// slowest shape, averaged over its levels. The bisection to 1e-3 that Rich used
+// before is timed for comparison.
+//
+// Then the cost of RichEnvelope, the envelopes of the module, per sample rate
+// and channel count. Voices are retriggered every 50 ms or so, half of them
+// with an accent, with a 2.5 ms attack and a 16 ms decay.
+
+#include <algorithm>
+#include <cstdio>
+#include <vector>
+
+#include "BenchTimer.hpp"
+#include "RichEnvelope.hpp"
+#include "RichReference.hpp"
+
+static const int REPEAT = 5;
+static const int FRAMES = 1 << 14;
+
+// Keeps the results alive so the calls are not optimized away
+static volatile float sink;
+
+// Mean and worst ns per call of search(level, shape)
+template <typename F>
+static void measure(F search, double* mean, double* worst) {
+    double total = 0.;
+    *worst = 0.;
+    for (int i = 0; i < SHAPES; i++) {
+        float shape = gridShape(i);
+        double seconds = fastestRun(REPEAT, [&] {
+            float sum = 0.f;
+            for (int j = 0; j < LEVELS; j++) sum += search(gridLevel(j), shape);
+            sink = sum;
+        });
+        total += seconds;
+        *worst = std::max(*worst, seconds * 1e9 / LEVELS);
+    }
+    *mean = total * 1e9 / ((double)SHAPES * LEVELS);
+}
+
+static void benchEnvelopes() {
+    std::printf("\nrich envelopes, logarithmic quadratic attack\n");
+    printTimingHeader();
+    for (float sampleRate : BENCH_SAMPLE_RATES) {
+        for (int channels : BENCH_CHANNELS) {
+            RichEnvelope envelope;
+            // Frame at which each voice is triggered, in a cycle of period frames
+            int period = (int)(0.05f * sampleRate);
+            std::vector<int> triggerFrame(channels);
+            for (int c = 0; c < channels; c++) triggerFrame[c] = period * c / channels + c;
+            rack::simd::float_4 attack = 0.1f, decay = 0.3f;
+            FrameTiming timing = timeFrames(sampleRate, channels, FRAMES, REPEAT, [&](int n) {
+                for (int c = 0; c < channels; c++) {
+                    if (n % period == triggerFrame[c] && !envelope.attacking(c))
+                        envelope.trigger(c, (n / period + c) % 2 ? 10.f : 0.f, 0.75f, 1.f, 3.f, 1.f, false);
+                }
+                rack::simd::float_4 sum = 0.f, accent;
+                for (int g = 0; g < (channels + 3) / 4; g++) {
+                    sum += envelope.process(g, 1.f / sampleRate, attack, decay, 0.75f, 1.f, 3.f, 1.f, accent);
+                }
+                sink = sum[0];
+            });
+            printTiming(sampleRate, channels, timing);
+        }
+    }
+}
+
+int main() {
+    std::printf("rich attack phase search, ns/call\n\n%-11s %8s %9s %9s %9s %9s\n", "curve", "exponent",
+                "mean", "worst", "bisection", "worst");
+    for (int exponentialAttack = 0; exponentialAttack < 2; exponentialAttack++) {
+        for (int exponent = 2; exponent <= 4; exponent++) {
+            double newtonMean, newtonWorst, bisectionMean, bisectionWorst;
+            measure([&](float level, float shape) { return findAttackPhase(level, shape, exponent, exponentialAttack); },
+                    &newtonMean, &newtonWorst);
+            measure(
+                [&](float level, float shape) {
+                    return (float)bisectAttackPhase(level, shape, exponent, exponentialAttack, 1e-3);
+                },
+                &bisectionMean, &bisectionWorst);
+            std::printf("%-11s %8d %9.1f %9.1f %9.1f %9.1f\n", exponentialAttack ? "exponential" : "logarithmic",
+                        exponent, newtonMean, newtonWorst, bisectionMean, bisectionWorst);
+        }
+    }
+    benchEnvelopes();
+    return 0;
+}
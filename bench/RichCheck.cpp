@@ -0,0 +1,50 @@
+// Accuracy of findAttackPhase() of RichEnvelope.hpp: over the (shape, level)
+// grid of RichReference.hpp, for every exponent and both attack curves, the
+// attack curve computed in double at the phase found must be within BOUND of
+// the level, and the phase within [0, 1]. Bisection in double gives the
+// reference phase. Exits with a non-zero status if a bound does not hold.
+
+#include <cmath>
+#include <cstdio>
+
+#include "RichEnvelope.hpp"
+#include "RichReference.hpp"
+
+static const double BOUND = 2.2e-7;
+
+int main() {
+    int failures = 0;
+    for (int exponentialAttack = 0; exponentialAttack < 2; exponentialAttack++) {
+        for (int exponent = 2; exponent <= 4; exponent++) {
+            double worst = 0., worstPhase = 0.;
+            float worstShape = 0.f, worstLevel = 0.f;
+            long outside = 0;
+            for (int i = 0; i < SHAPES; i++) {
+                for (int j = 0; j < LEVELS; j++) {
+                    float shape = gridShape(i), level = gridLevel(j);
+                    float phase = findAttackPhase(level, shape, exponent, exponentialAttack);
+                    if (!(phase >= 0.f && phase <= 1.f)) {
+                        outside++;
+                        continue;
+                    }
+                    double error = std::fabs(attackCurve(phase, shape, exponent, exponentialAttack) - level);
+                    if (error > worst) {
+                        worst = error;
+                        worstShape = shape;
+                        worstLevel = level;
+                        worstPhase = std::fabs(phase - bisectAttackPhase(level, shape, exponent, exponentialAttack, 0.));
+                    }
+                }
+            }
+            bool ok = worst < BOUND && outside == 0;
+            std::printf("%-11s exponent %d %-5s worst error %.3g at (shape %.4f, level %.4f), "
+                        "%.3g from bisection, %ld phases outside [0, 1]\n",
+                        exponentialAttack ? "exponential" : "logarithmic", exponent, ok ? "ok" : "FAIL", worst,
+                        worstShape, worstLevel, worstPhase, outside);
+            if (!ok)
+                failures++;
+        }
+    }
+    std::printf("rich attack phase: %d failures\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cmath>
+
+// The attack curve of Rich in double, see findAttackPhase() in RichEnvelope.hpp
+inline double attackCurve(double phase, double shape, int exponent, bool exponentialAttack) {
+    double power = exponentialAttack ? std::pow(phase, exponent) : std::pow(phase, 1.0 / exponent);
+    return (1.0 - shape) * phase + shape * power;
+}
+
+// The phase at which the attack curve reaches value, by bisection until the
+// curve is within epsilon of value. With epsilon = 1e-3 this is the search Rich
+// used before findAttackPhase().
+inline double bisectAttackPhase(double value, double shape, int exponent, bool exponentialAttack, double epsilon) {
+    double low = 0.0, high = 1.0;
+    double phase = 0.5;
+    for (int i = 0; i < 64; i++) {
+        phase = 0.5 * (low + high);
+        double curve = attackCurve(phase, shape, exponent, exponentialAttack);
+        if (std::fabs(curve - value) < epsilon)
+            break;
+        if (curve < value)
+            low = phase;
+        else
+            high = phase;
+    }
+    return phase;
+}
+
+// The (shape, level) grid the checks and benchmarks run findAttackPhase() over,
+// levels strictly between 0 and 1 as on a retrigger
+static const int SHAPES = 400;
+static const int LEVELS = 1000;
+
+inline float gridShape(int i) {
+    return (float)i / (SHAPES - 1);
+}
+
+inline float gridLevel(int j) {
+    return (j + 0.5f) / LEVELS;
+}
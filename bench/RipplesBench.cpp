@@ -0,0 +1,68 @@
+// Cost of RipplesPolyEngine as TwinPeaks runs it, filter B then filter A for
+// each group of four voices, with the elliptic anti-aliasing filters of High
+// quality and with the linear-phase ones. Voices filter seeded noise in LP4
+// mode, with the resonance below self-oscillation.
+
+#include <cstdio>
+#include <vector>
+
+#include "BenchTimer.hpp"
+#include "SimdRandom.hpp"
+#include "filter/ripples.hpp"
+
+using rack::simd::float_4;
+
+static const int FRAMES = 1 << 13;
+static const int REPEAT = 3;
+
+// Keeps the results alive so the engines are not optimized away
+static volatile float sink;
+
+template <template <typename> class Filter>
+static void benchEngines(const char* name) {
+    std::printf("\nripples engines, %s\n", name);
+    printTimingHeader();
+
+    std::vector<float_4> input(FRAMES);
+    SimdRandom rng;
+    rng.seed(1);
+    for (float_4& x : input) x = 10.f * rng.uniform() - 5.f;
+
+    for (float sampleRate : BENCH_SAMPLE_RATES) {
+        ripples::RipplesPolyEngine<Filter> enginesA[4], enginesB[4];
+        for (int g = 0; g < 4; g++) {
+            enginesA[g].setSampleRate(sampleRate);
+            enginesB[g].setSampleRate(sampleRate);
+            enginesA[g].seedNoise(2 * g);
+            enginesB[g].seedNoise(2 * g + 1);
+        }
+
+        ripples::RipplesPolyFrame frameA = {}, frameB = {};
+        frameA.res_knob = frameB.res_knob = 0.5f;
+        frameA.freq_knob = 0.6f;
+        frameB.freq_knob = 0.7f;
+        frameA.fm_global_knob = frameB.fm_global_knob = 1.f;
+        frameA.xfm_knob = 0.2f;
+        frameA.mode = frameB.mode = 3;
+
+        for (int channels : BENCH_CHANNELS) {
+            FrameTiming timing = timeFrames(sampleRate, channels, FRAMES, REPEAT, [&](int n) {
+                for (int g = 0; g < (channels + 3) / 4; g++) {
+                    frameB.input = input[n];
+                    enginesB[g].process(frameB);
+                    frameA.input = input[n];
+                    frameA.b_output = frameB.output;
+                    enginesA[g].process(frameA);
+                }
+                sink = frameA.output[0];
+            });
+            printTiming(sampleRate, channels, timing);
+        }
+    }
+}
+
+int main() {
+    benchEngines<ripples::AAFilter>("elliptic anti-aliasing filters, High quality");
+    benchEngines<ripples::PolyphaseAAFilter>("linear-phase anti-aliasing filters");
+    return 0;
+}
@@ -0,0 +1,272 @@
+#pragma once
+
+// The part of the Rack SDK the benchmarks need, so they build without Rack.
+// Functions keep the semantics of the SDK they stand for, SSE included, so the
+// DSP code computes what it computes in the plugin.
+
+#include <pmmintrin.h>
+#include <smmintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+namespace rack {
+
+static const int PORT_MAX_CHANNELS = 16;
+
+namespace math {
+
+inline int clamp(int x, int a, int b) {
+    return std::max(std::min(x, b), a);
+}
+
+inline float clamp(float x, float a = 0.f, float b = 1.f) {
+    return std::fmax(std::fmin(x, b), a);
+}
+
+}  // namespace math
+
+using namespace math;
+
+namespace simd {
+
+template <typename T, int N>
+struct Vector;
+
+template <>
+struct Vector<int32_t, 4>;
+
+template <>
+struct Vector<float, 4> {
+    using type = float;
+    constexpr static int size = 4;
+
+    union {
+        __m128 v;
+        float s[4];
+    };
+
+    Vector() = default;
+    Vector(__m128 v) : v(v) {}
+    Vector(float x) : v(_mm_set1_ps(x)) {}
+    Vector(float x1, float x2, float x3, float x4) : v(_mm_setr_ps(x1, x2, x3, x4)) {}
+    // Converts the integers to floats
+    Vector(Vector<int32_t, 4> a);
+
+    static Vector zero() {
+        return Vector(_mm_setzero_ps());
+    }
+    static Vector mask() {
+        return Vector(_mm_castsi128_ps(_mm_set1_epi32(-1)));
+    }
+    static Vector load(const float* x) {
+        return Vector(_mm_loadu_ps(x));
+    }
+    void store(float* x) {
+        _mm_storeu_ps(x, v);
+    }
+    // Reinterprets the bits
+    static Vector cast(Vector<int32_t, 4> a);
+
+    float& operator[](int i) {
+        return s[i];
+    }
+    const float& operator[](int i) const {
+        return s[i];
+    }
+};
+
+template <>
+struct Vector<int32_t, 4> {
+    using type = int32_t;
+    constexpr static int size = 4;
+
+    union {
+        __m128i v;
+        int32_t s[4];
+    };
+
+    Vector() = default;
+    Vector(__m128i v) : v(v) {}
+    Vector(int32_t x) : v(_mm_set1_epi32(x)) {}
+    Vector(int32_t x1, int32_t x2, int32_t x3, int32_t x4) : v(_mm_setr_epi32(x1, x2, x3, x4)) {}
+    // Converts the floats to integers, rounding toward zero
+    Vector(Vector<float, 4> a) : v(_mm_cvttps_epi32(a.v)) {}
+
+    static Vector zero() {
+        return Vector(_mm_setzero_si128());
+    }
+    static Vector mask() {
+        return Vector(_mm_set1_epi32(-1));
+    }
+    static Vector load(const int32_t* x) {
+        return Vector(_mm_loadu_si128((const __m128i*)x));
+    }
+    void store(int32_t* x) {
+        _mm_storeu_si128((__m128i*)x, v);
+    }
+    // Reinterprets the bits
+    static Vector cast(Vector<float, 4> a) {
+        return Vector(_mm_castps_si128(a.v));
+    }
+
+    int32_t& operator[](int i) {
+        return s[i];
+    }
+    const int32_t& operator[](int i) const {
+        return s[i];
+    }
+};
+
+inline Vector<float, 4>::Vector(Vector<int32_t, 4> a) : v(_mm_cvtepi32_ps(a.v)) {}
+
+inline Vector<float, 4> Vector<float, 4>::cast(Vector<int32_t, 4> a) {
+    return Vector(_mm_castsi128_ps(a.v));
+}
+
+typedef Vector<float, 4> float_4;
+typedef Vector<int32_t, 4> int32_4;
+
+inline float_4 operator+(float_4 a, float_4 b) { return _mm_add_ps(a.v, b.v); }
+inline float_4 operator-(float_4 a, float_4 b) { return _mm_sub_ps(a.v, b.v); }
+inline float_4 operator*(float_4 a, float_4 b) { return _mm_mul_ps(a.v, b.v); }
+inline float_4 operator/(float_4 a, float_4 b) { return _mm_div_ps(a.v, b.v); }
+inline float_4 operator&(float_4 a, float_4 b) { return _mm_and_ps(a.v, b.v); }
+inline float_4 operator|(float_4 a, float_4 b) { return _mm_or_ps(a.v, b.v); }
+inline float_4 operator^(float_4 a, float_4 b) { return _mm_xor_ps(a.v, b.v); }
+inline float_4 operator==(float_4 a, float_4 b) { return _mm_cmpeq_ps(a.v, b.v); }
+inline float_4 operator!=(float_4 a, float_4 b) { return _mm_cmpneq_ps(a.v, b.v); }
+inline float_4 operator<(float_4 a, float_4 b) { return _mm_cmplt_ps(a.v, b.v); }
+inline float_4 operator>(float_4 a, float_4 b) { return _mm_cmpgt_ps(a.v, b.v); }
+inline float_4 operator<=(float_4 a, float_4 b) { return _mm_cmple_ps(a.v, b.v); }
+inline float_4 operator>=(float_4 a, float_4 b) { return _mm_cmpge_ps(a.v, b.v); }
+inline float_4 operator+(float_4 a) { return a; }
+inline float_4 operator-(float_4 a) { return 0.f - a; }
+inline float_4 operator~(float_4 a) { return a ^ float_4::mask(); }
+inline float_4& operator+=(float_4& a, float_4 b) { return a = a + b; }
+inline float_4& operator-=(float_4& a, float_4 b) { return a = a - b; }
+inline float_4& operator*=(float_4& a, float_4 b) { return a = a * b; }
+inline float_4& operator/=(float_4& a, float_4 b) { return a = a / b; }
+inline float_4& operator&=(float_4& a, float_4 b) { return a = a & b; }
+inline float_4& operator|=(float_4& a, float_4 b) { return a = a | b; }
+inline float_4& operator^=(float_4& a, float_4 b) { return a = a ^ b; }
+
+inline int32_4 operator+(int32_4 a, int32_4 b) { return _mm_add_epi32(a.v, b.v); }
+inline int32_4 operator-(int32_4 a, int32_4 b) { return _mm_sub_epi32(a.v, b.v); }
+inline int32_4 operator*(int32_4 a, int32_4 b) { return _mm_mullo_epi32(a.v, b.v); }
+inline int32_4 operator&(int32_4 a, int32_4 b) { return _mm_and_si128(a.v, b.v); }
+inline int32_4 operator|(int32_4 a, int32_4 b) { return _mm_or_si128(a.v, b.v); }
+inline int32_4 operator^(int32_4 a, int32_4 b) { return _mm_xor_si128(a.v, b.v); }
+inline int32_4 operator==(int32_4 a, int32_4 b) { return _mm_cmpeq_epi32(a.v, b.v); }
+inline int32_4 operator<(int32_4 a, int32_4 b) { return _mm_cmplt_epi32(a.v, b.v); }
+inline int32_4 operator>(int32_4 a, int32_4 b) { return _mm_cmpgt_epi32(a.v, b.v); }
+inline int32_4 operator<<(int32_4 a, int b) { return _mm_sll_epi32(a.v, _mm_cvtsi32_si128(b)); }
+// Logical shift, like the SDK
+inline int32_4 operator>>(int32_4 a, int b) { return _mm_srl_epi32(a.v, _mm_cvtsi32_si128(b)); }
+inline int32_4 operator-(int32_4 a) { return 0 - a; }
+inline int32_4 operator~(int32_4 a) { return a ^ int32_4::mask(); }
+inline int32_4& operator+=(int32_4& a, int32_4 b) { return a = a + b; }
+inline int32_4& operator-=(int32_4& a, int32_4 b) { return a = a - b; }
+inline int32_4& operator&=(int32_4& a, int32_4 b) { return a = a & b; }
+inline int32_4& operator|=(int32_4& a, int32_4 b) { return a = a | b; }
+inline int32_4& operator^=(int32_4& a, int32_4 b) { return a = a ^ b; }
+
+inline float_4 fmax(float_4 a, float_4 b) { return _mm_max_ps(a.v, b.v); }
+inline float_4 fmin(float_4 a, float_4 b) { return _mm_min_ps(a.v, b.v); }
+inline float_4 clamp(float_4 x, float_4 a = 0.f, float_4 b = 1.f) { return fmin(fmax(x, a), b); }
+inline float_4 abs(float_4 x) { return _mm_andnot_ps(_mm_set1_ps(-0.f), x.v); }
+inline float_4 sqrt(float_4 x) { return _mm_sqrt_ps(x.v); }
+inline float_4 floor(float_4 x) { return _mm_floor_ps(x.v); }
+inline float_4 trunc(float_4 x) { return _mm_round_ps(x.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+inline float_4 round(float_4 x) { return _mm_round_ps(x.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+inline float_4 fmod(float_4 a, float_4 b) { return a - trunc(a / b) * b; }
+inline float_4 crossfade(float_4 a, float_4 b, float_4 p) { return a + (b - a) * p; }
+// Per lane with libm, where the SDK uses the SSE approximations of
+// sse_mathfun, which are within a few ulp of it
+inline float_4 log(float_4 x) {
+    return float_4(std::log(x[0]), std::log(x[1]), std::log(x[2]), std::log(x[3]));
+}
+inline float_4 cos(float_4 x) {
+    return float_4(std::cos(x[0]), std::cos(x[1]), std::cos(x[2]), std::cos(x[3]));
+}
+inline float_4 rescale(float_4 x, float_4 xMin, float_4 xMax, float_4 yMin, float_4 yMax) {
+    return yMin + (x - xMin) / (xMax - xMin) * (yMax - yMin);
+}
+inline int movemask(float_4 a) { return _mm_movemask_ps(a.v); }
+inline int movemask(int32_4 a) { return _mm_movemask_ps(_mm_castsi128_ps(a.v)); }
+
+// Masks are all ones or all zeros per lane
+inline float_4 ifelse(float_4 mask, float_4 a, float_4 b) { return (mask & a) | _mm_andnot_ps(mask.v, b.v); }
+inline int32_4 ifelse(int32_4 mask, int32_4 a, int32_4 b) { return (mask & a) | _mm_andnot_si128(mask.v, b.v); }
+
+}  // namespace simd
+
+namespace dsp {
+
+static const float FREQ_C4 = 261.6256f;
+
+// First-order RC filter, lowpass and highpass from one state
+template <typename T = float>
+struct TRCFilter {
+    T c = 0.f;
+    T xstate[1];
+    T ystate[1];
+
+    TRCFilter() {
+        reset();
+    }
+    void reset() {
+        xstate[0] = 0.f;
+        ystate[0] = 0.f;
+    }
+    // Cutoff angular frequency in radians per sample
+    void setCutoff(T r) {
+        c = 2.f / r;
+    }
+    // Cutoff frequency relative to the sample rate
+    void setCutoffFreq(T f) {
+        setCutoff(2.f * (float)M_PI * f);
+    }
+    void process(T x) {
+        T y = (x + xstate[0] - ystate[0] * (1 - c)) / (1 + c);
+        xstate[0] = x;
+        ystate[0] = y;
+    }
+    T lowpass() {
+        return ystate[0];
+    }
+    T highpass() {
+        return xstate[0] - ystate[0];
+    }
+};
+
+}  // namespace dsp
+
+// The SDK's generator is seeded from the clock, this one starts from the same
+// state every run, so benchmarks and renders repeat
+namespace random {
+
+inline uint64_t u64() {
+    // xoroshiro128+
+    static uint64_t s[2] = {0x9e3779b97f4a7c15ull, 0xbf58476d1ce4e5b9ull};
+    uint64_t s0 = s[0], s1 = s[1];
+    uint64_t result = s0 + s1;
+    s1 ^= s0;
+    s[0] = ((s0 << 55) | (s0 >> 9)) ^ s1 ^ (s1 << 14);
+    s[1] = (s1 << 36) | (s1 >> 28);
+    return result;
+}
+
+inline float uniform() {
+    return (u64() >> (64 - 24)) / 16777216.f;
+}
+
+}  // namespace random
+
+// Only named by the declarations of Profiler.hpp
+namespace ui {
+struct Menu;
+}
+
+}  // namespace rack
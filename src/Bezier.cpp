@@ -1,3 +1,4 @@
+#include "BezierGenerator.hpp"
 #include "components.hpp"
 #include "plugin.hpp"
 
@@ -32,22 +33,15 @@ struct Bezier : Module {
         LIGHTS_LEN
     };
 
-    dsp::PulseGenerator pulseGenerator;
     dsp::ClockDivider lightDivider;
-    std::mt19937 rand;
-    std::normal_distribution<float> normalDistribution{0.0f, 1.6f};  // gives approximate -5..5
-
-    float phase = 0.f;
-    float currentValue = 0.f;
-    float targetValue = 0.f;
-    float fmParam = 0;
-    float fm = 0;
-
-    bool contLevelModulation = false;
-    bool contFreqModulation = false;
-    bool assymetricCurve = false;
-    int distributionType = 0;
+
+    // Voice state and the generator menu settings
+    BezierGenerator generator;
+    int channels = 0;
+
     int levelClipType = 0;
+    // Voices when no polyphonic input sets more, minus one
+    int polyphonyIndex = 0;
     float levels[4][2] = {
         {0.f, 1.f},
         {0.f, 2.f},
@@ -74,180 +68,97 @@ struct Bezier : Module {
         configOutput(GATE_OUTPUT, "Gate");
 
         lightDivider.setDivision(16);
-    }
-
-    float fold(float x, float a, float b) {
-        float result = x;
-        if (x > b) {
-            result = 2 * b - x;
-        } else if (x < a) {
-            result = 2 * a - x;
-        }
-        if (result < a || result > b) return fold(result, a, b);
-        return result;
-    }
-
-    float wrap(float x, float a, float b) {
-        float result = x;
-        if (x > b) {
-            result = a + (x - b);
-        } else if (x < a) {
-            result = b + (x - a);
-        }
-        if (result < a || result > b) return wrap(result, a, b);
-        return result;
-    }
-
-    double getPoint(double aX, double mX1, double mY1, double mX2, double mY2) const {
-        if (mX1 == mY1 && mX2 == mY2)
-            return aX;  // linear
-        return calculateBezier(getTForX(aX, mX1, mX2), mY1, mY2);
-    }
-
-    double A(double aA1, double aA2) const { return 1.0 - 3.0 * aA2 + 3.0 * aA1; }
-    double B(double aA1, double aA2) const { return 3.0 * aA2 - 6.0 * aA1; }
-    double C(double aA1) const { return 3.0 * aA1; }
-
-    double calculateBezier(double aT, double aA1, double aA2) const {
-        return ((A(aA1, aA2) * aT + B(aA1, aA2)) * aT + C(aA1)) * aT;
-    }
-
-    double getSlope(double aT, double aA1, double aA2) const {
-        return 3.0 * A(aA1, aA2) * aT * aT + 2.0 * B(aA1, aA2) * aT + C(aA1);
-    }
-
-    double getTForX(double aX, double mX1, double mX2) const {
-        // Newton raphson iteration
-        double aGuessT = aX;
-        for (int i = 0; i < 5; ++i) {
-            double currentSlope = getSlope(aGuessT, mX1, mX2);
-            if (currentSlope == 0.0)
-                return aGuessT;
-            double currentX = calculateBezier(aGuessT, mX1, mX2) - aX;
-            aGuessT -= currentX / currentSlope;
-        }
-        return aGuessT;
+        generator.rng.seed(random::u64());
     }
 
     void process(const ProcessArgs &args) override {
-        float level = params[LEVEL_PARAM].getValue();
-        float cv = clamp(inputs[LEVEL_MOD_INPUT].getVoltage() / 5.f, -2.f, 2.f);
+        float levelParam = params[LEVEL_PARAM].getValue();
         float levelModParam = params[LEVEL_MOD_PARAM].getValue();
-        cv *= levelModParam;
-        level += cv;
-        level = clamp(level, levels[levelClipType][0], levels[levelClipType][1]);
+        float levelMin = levels[levelClipType][0];
+        float levelMax = levels[levelClipType][1];
+        float freqParam = params[FREQ_PARAM].getValue();
+        float fmKnob = 1.5 * params[FM_PARAM].getValue();
+        bool sampling = inputs[SIGNAL_INPUT].isConnected();
 
-        if (contFreqModulation == true) {
-            fm = inputs[FM_INPUT].getVoltage();
-            fmParam = 1.5 * params[FM_PARAM].getValue();
-        }
-        float pitch = params[FREQ_PARAM].getValue() + fm * fmParam;
-        // Calculate the phase
-        phase += args.sampleTime * std::pow(2.f, pitch);
-        // more expensive
-        // phase += args.sampleTime * dsp::exp2_taylor5(pitch);
-        if (phase >= 1.f) {
-            phase -= 1.f;
-            currentValue = targetValue;
-            if (inputs[SIGNAL_INPUT].isConnected()) {
-                targetValue = inputs[SIGNAL_INPUT].getVoltage();
-            } else {
-                if (distributionType == 0)
-                    targetValue = 5.f * (2.f * random::uniform() - 1.f);  // Bipolar random value
-                else
-                    targetValue = clamp(normalDistribution(rand), -5.f, 5.f);  // Bipolar random value
-            }
-
-            if (contLevelModulation == false) targetValue *= level;
-            if (contFreqModulation == false) {
-                fm = inputs[FM_INPUT].getVoltage();
-                fmParam = 1.5 * params[FM_PARAM].getValue();
-            }
+        float offset = params[OFFSET_PARAM].getValue();
+        int limitSwitch = (int)params[LIMIT_SWITCH].getValue();
 
-            // SEND GATE
-            pulseGenerator.trigger(1e-3f);
+        // One voice per channel of the widest input, at least the menu setting
+        int newChannels = std::max(polyphonyIndex + 1, inputs[SIGNAL_INPUT].getChannels());
+        newChannels = std::max(newChannels, inputs[FM_INPUT].getChannels());
+        newChannels = std::max(newChannels, inputs[LEVEL_MOD_INPUT].getChannels());
+        for (int c = channels; c < newChannels; c++) {
+            // Added voices start at random phases so they do not step together
+            generator.startVoice(c, (c == 0) ? 0.f : random::uniform(), inputs[FM_INPUT].getPolyVoltage(c), fmKnob);
         }
-
-        // CALCULATIONS
-        float curvePoint = clamp(params[CURVE_PARAM].getValue(), -0.99f, 0.99f);
-        float bezierValue = phase;
-        if (curvePoint >= 0.f) {
-            if (assymetricCurve == false) {
-                bezierValue = getPoint(phase, curvePoint, 0.0f, (1.f - curvePoint), 1.0f);
-            } else {
-                bezierValue = getPoint(phase, curvePoint, 0.0f, 1.0f, (1.f - curvePoint));
-            }
-        } else {
-            curvePoint *= -1;
-            if (assymetricCurve == false) {
-                bezierValue = getPoint(phase, 0.0f, curvePoint, 1.0f, (1.f - curvePoint));
-            } else {
-                bezierValue = getPoint(phase, 0.0f, curvePoint, (1.f - curvePoint), 1.0f);
+        channels = newChannels;
+
+        generator.beginFrame(clamp(params[CURVE_PARAM].getValue(), -0.99f, 0.99f), args.sampleTime);
+
+        for (int c = 0; c < channels; c += 4) {
+            simd::float_4 cv = simd::clamp(inputs[LEVEL_MOD_INPUT].getPolyVoltageSimd<simd::float_4>(c) / 5.f, -2.f, 2.f);
+            simd::float_4 level = simd::clamp(levelParam + cv * levelModParam, levelMin, levelMax);
+            simd::float_4 fmInput = inputs[FM_INPUT].getPolyVoltageSimd<simd::float_4>(c);
+            simd::float_4 signal = inputs[SIGNAL_INPUT].getPolyVoltageSimd<simd::float_4>(c);
+            simd::float_4 pulse;
+            simd::float_4 outputValue =
+                generator.process(c / 4, args.sampleTime, freqParam, fmKnob, fmInput, level, sampling, signal, pulse);
+
+            // OUTPUT
+            outputs[CURVE_OUTPUT].setVoltageSimd(BezierGenerator::limit(offset + outputValue, limitSwitch), c);
+            outputs[ICURVE_OUTPUT].setVoltageSimd(BezierGenerator::limit(offset - outputValue, limitSwitch), c);
+
+            // TRIGGER
+            outputs[TRIG_OUTPUT].setVoltageSimd(simd::ifelse(pulse, 10.f, 0.f), c);
+
+            // GATE
+            outputs[GATE_OUTPUT].setVoltageSimd(simd::ifelse(outputValue > 0.f, 10.f, 0.f), c);
+
+            // LIGHT, follows the first voice
+            if (c == 0 && lightDivider.process()) {
+                float lightTime = args.sampleTime * lightDivider.getDivision();
+                lights[GATE_LIGHT].setBrightnessSmooth(outputValue[0] > 0.f, lightTime);
+                lights[CURVE_POS_LIGHT].setBrightnessSmooth(fmaxf(0.0f, outputValue[0] / 5.f), lightTime);
+                lights[CURVE_NEG_LIGHT].setBrightnessSmooth(fmaxf(0.0f, -outputValue[0] / 5.f), lightTime);
             }
         }
 
-        // Interpolate the current value using Bézier curve
-        float outputValue = currentValue + bezierValue * (targetValue - currentValue);
-        if (contLevelModulation == true) outputValue *= level;
-
-        // OUTPUT
-        float offset = params[OFFSET_PARAM].getValue();
-        int limitSwitch = (int)params[LIMIT_SWITCH].getValue();
-        switch (limitSwitch) {
-            case 1:
-                outputs[CURVE_OUTPUT].setVoltage(clamp(offset + outputValue, -5.f, 5.f));
-                outputs[ICURVE_OUTPUT].setVoltage(clamp(offset - outputValue, -5.f, 5.f));
-                break;
-            case 0:
-                outputs[CURVE_OUTPUT].setVoltage(fold(offset + outputValue, -5.f, 5.f));
-                outputs[ICURVE_OUTPUT].setVoltage(fold(offset - outputValue, -5.f, 5.f));
-                break;
-            default:
-                outputs[CURVE_OUTPUT].setVoltage(wrap(offset + outputValue, -5.f, 5.f));
-                outputs[ICURVE_OUTPUT].setVoltage(wrap(offset - outputValue, -5.f, 5.f));
-        }
-
-        // TRIGGER
-        outputs[TRIG_OUTPUT].setVoltage(pulseGenerator.process(args.sampleTime) ? 10.f : 0.f);
-
-        // GATE
-        outputs[GATE_OUTPUT].setVoltage(outputValue > 0.0 ? 10.f : 0.f);
-
-        // LIGHT
-        if (lightDivider.process()) {
-            float lightTime = args.sampleTime * lightDivider.getDivision();
-            lights[GATE_LIGHT].setBrightnessSmooth(outputValue > 0.0, lightTime);
-            lights[CURVE_POS_LIGHT].setBrightnessSmooth(fmaxf(0.0f, outputValue / 5.f), lightTime);
-            lights[CURVE_NEG_LIGHT].setBrightnessSmooth(fmaxf(0.0f, -outputValue / 5.f), lightTime);
-        }
+        outputs[CURVE_OUTPUT].setChannels(channels);
+        outputs[ICURVE_OUTPUT].setChannels(channels);
+        outputs[TRIG_OUTPUT].setChannels(channels);
+        outputs[GATE_OUTPUT].setChannels(channels);
     }
 
     json_t *dataToJson() override {
         json_t *rootJ = json_object();
-        json_object_set_new(rootJ, "continuousFrequency", json_boolean(contFreqModulation));
-        json_object_set_new(rootJ, "continuousLevel", json_boolean(contLevelModulation));
-        json_object_set_new(rootJ, "assymetricCurve", json_boolean(assymetricCurve));
-        json_object_set_new(rootJ, "distributionType", json_integer(distributionType));
+        json_object_set_new(rootJ, "continuousFrequency", json_boolean(generator.contFreqModulation));
+        json_object_set_new(rootJ, "continuousLevel", json_boolean(generator.contLevelModulation));
+        json_object_set_new(rootJ, "assymetricCurve", json_boolean(generator.assymetricCurve));
+        json_object_set_new(rootJ, "distributionType", json_integer(generator.distributionType));
         json_object_set_new(rootJ, "levelClipType", json_integer(levelClipType));
+        json_object_set_new(rootJ, "polyphony", json_integer(polyphonyIndex + 1));
         return rootJ;
     }
 
     void dataFromJson(json_t *rootJ) override {
         json_t *contLevelJ = json_object_get(rootJ, "continuousLevel");
         if (contLevelJ)
-            contLevelModulation = json_boolean_value(contLevelJ);
+            generator.contLevelModulation = json_boolean_value(contLevelJ);
         json_t *contFrequencyJ = json_object_get(rootJ, "continuousFrequency");
         if (contFrequencyJ)
-            contFreqModulation = json_boolean_value(contFrequencyJ);
+            generator.contFreqModulation = json_boolean_value(contFrequencyJ);
         json_t *assymJ = json_object_get(rootJ, "assymetricCurve");
         if (assymJ)
-            assymetricCurve = json_boolean_value(assymJ);
+            generator.assymetricCurve = json_boolean_value(assymJ);
         json_t *distributionJ = json_object_get(rootJ, "distributionType");
         if (distributionJ)
-            distributionType = json_integer_value(distributionJ);
+            generator.distributionType = json_integer_value(distributionJ);
         json_t *levelClipTypeJ = json_object_get(rootJ, "levelClipType");
         if (levelClipTypeJ)
             levelClipType = json_integer_value(levelClipTypeJ);
+        json_t *polyphonyJ = json_object_get(rootJ, "polyphony");
+        if (polyphonyJ)
+            polyphonyIndex = clamp((int)json_integer_value(polyphonyJ), 1, PORT_MAX_CHANNELS) - 1;
     }
 };
 
@@ -288,15 +199,20 @@ struct BezierWidget : ModuleWidget {
         Bezier *module = dynamic_cast<Bezier *>(this->module);
         assert(module);
         menu->addChild(new MenuSeparator);
-        menu->addChild(createBoolPtrMenuItem("Continuous Frequency Modulation", "", &module->contFreqModulation));
-        menu->addChild(createBoolPtrMenuItem("Continuous Level Modulation", "", &module->contLevelModulation));
-        menu->addChild(createBoolPtrMenuItem("Assymetric Curve", "", &module->assymetricCurve));
+        menu->addChild(createBoolPtrMenuItem("Continuous Frequency Modulation", "", &module->generator.contFreqModulation));
+        menu->addChild(createBoolPtrMenuItem("Continuous Level Modulation", "", &module->generator.contLevelModulation));
+        menu->addChild(createBoolPtrMenuItem("Assymetric Curve", "", &module->generator.assymetricCurve));
         menu->addChild(createIndexPtrSubmenuItem("Distribution",
                                                  {"Uniform", "Normal"},
-                                                 &module->distributionType));
+                                                 &module->generator.distributionType));
         menu->addChild(createIndexPtrSubmenuItem("Post-Modulation Level Clip",
                                                  {"0..100%", "0..200%", "-100..100%", "-200..200%"},
                                                  &module->levelClipType));
+        std::vector<std::string> polyphonyLabels;
+        for (int c = 1; c <= PORT_MAX_CHANNELS; c++) {
+            polyphonyLabels.push_back(std::to_string(c));
+        }
+        menu->addChild(createIndexPtrSubmenuItem("Polyphony", polyphonyLabels, &module->polyphonyIndex));
     }
 };
 
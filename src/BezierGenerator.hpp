@@ -0,0 +1,232 @@
+#pragma once
+
+#include <cmath>
+
+#include <rack.hpp>
+
+#include "FastMath.hpp"
+#include "SimdRandom.hpp"
+
+// The random voltage generator of Bezier, up to 16 voices in groups of four,
+// without the ports of the module, so bench/ can run it. Channel c is lane
+// c % 4 of group c / 4. Each voice steps to a new value once per cycle and
+// glides to it along a Bézier curve shared by all voices.
+struct BezierGenerator {
+    SimdRandom rng;
+
+    // Voice state
+    rack::simd::float_4 phase[4] = {};
+    rack::simd::float_4 currentValue[4] = {};
+    rack::simd::float_4 targetValue[4] = {};
+    rack::simd::float_4 fmParam[4] = {};
+    rack::simd::float_4 fm[4] = {};
+    // Remaining time of the TRIG pulse
+    rack::simd::float_4 pulseTime[4] = {};
+    // Curve parameter t at the phase, where the next solve starts
+    rack::simd::float_4 curveT[4] = {};
+    // Phase increment per sample for the pitch it was computed for
+    rack::simd::float_4 phaseDelta[4] = {};
+    rack::simd::float_4 deltaPitch[4] = {INFINITY, INFINITY, INFINITY, INFINITY};
+    float deltaSampleTime = 0.f;
+
+    // Polynomial coefficients of the curve, x(t) = ((xA * t + xB) * t + xC) * t
+    // and the same for y(t), for the CURVE value and asymmetry they were
+    // computed for
+    float xA = 0.f, xB = 0.f, xC = 1.f;
+    float yA = 0.f, yB = 0.f, yC = 1.f;
+    bool linearCurve = true;
+    float coefficientsCurvePoint = INFINITY;
+    bool coefficientsAssymetric = false;
+
+    // Set by beginFrame() for the groups of the frame
+    bool curveChanged = false;
+    bool sampleTimeChanged = false;
+    bool voicesStarted = false;
+
+    // context menu variables
+    bool contLevelModulation = false;
+    bool contFreqModulation = false;
+    bool assymetricCurve = false;
+    int distributionType = 0;
+
+    // Reflects x back into [a, b] as often as needed
+    static rack::simd::float_4 fold(rack::simd::float_4 x, float a, float b) {
+        float range = b - a;
+        rack::simd::float_4 y = x - a;
+        y -= 2.f * range * rack::simd::floor(y / (2.f * range));
+        return a + rack::simd::ifelse(y > range, 2.f * range - y, y);
+    }
+
+    // Wraps x into [a, b], leaving values inside unchanged
+    static rack::simd::float_4 wrap(rack::simd::float_4 x, float a, float b) {
+        float range = b - a;
+        rack::simd::float_4 y = x - range * rack::simd::floor((x - a) / range);
+        return rack::simd::ifelse((x < a) | (x > b), y, x);
+    }
+
+    // Keeps x within +-5V as set by the LIMIT switch: 1 clips, 0 folds and -1 wraps
+    static rack::simd::float_4 limit(rack::simd::float_4 x, int limitSwitch) {
+        switch (limitSwitch) {
+            case 1: return rack::simd::clamp(x, -5.f, 5.f);
+            case 0: return fold(x, -5.f, 5.f);
+            default: return wrap(x, -5.f, 5.f);
+        }
+    }
+
+    float A(float aA1, float aA2) const { return 1.f - 3.f * aA2 + 3.f * aA1; }
+    float B(float aA1, float aA2) const { return 3.f * aA2 - 6.f * aA1; }
+    float C(float aA1) const { return 3.f * aA1; }
+
+    // Recomputes the curve coefficients if CURVE or the asymmetry changed,
+    // returns whether they did
+    bool updateCurve(float curvePoint) {
+        if (curvePoint == coefficientsCurvePoint && assymetricCurve == coefficientsAssymetric)
+            return false;
+        coefficientsCurvePoint = curvePoint;
+        coefficientsAssymetric = assymetricCurve;
+
+        float mX1, mY1, mX2, mY2;
+        if (curvePoint >= 0.f) {
+            mX1 = curvePoint;
+            mY1 = 0.f;
+            mX2 = assymetricCurve ? 1.f : 1.f - curvePoint;
+            mY2 = assymetricCurve ? 1.f - curvePoint : 1.f;
+        } else {
+            curvePoint *= -1;
+            mX1 = 0.f;
+            mY1 = curvePoint;
+            mX2 = assymetricCurve ? 1.f - curvePoint : 1.f;
+            mY2 = assymetricCurve ? 1.f : 1.f - curvePoint;
+        }
+        linearCurve = (mX1 == mY1 && mX2 == mY2);
+        xA = A(mX1, mX2);
+        xB = B(mX1, mX2);
+        xC = C(mX1);
+        yA = A(mY1, mY2);
+        yB = B(mY1, mY2);
+        yC = C(mY1);
+        return true;
+    }
+
+    // Bisection for the t where x(t) = aX, for when the phase or the curve
+    // jumps. x(t) is increasing for any CURVE within +-0.99.
+    rack::simd::float_4 bisectTForX(rack::simd::float_4 aX) const {
+        rack::simd::float_4 low = 0.f;
+        rack::simd::float_4 high = 1.f;
+        for (int i = 0; i < 16; ++i) {
+            rack::simd::float_4 t = 0.5f * (low + high);
+            rack::simd::float_4 below = ((xA * t + xB) * t + xC) * t < aX;
+            low = rack::simd::ifelse(below, t, low);
+            high = rack::simd::ifelse(below, high, t);
+        }
+        return 0.5f * (low + high);
+    }
+
+    // Newton raphson iteration for the t where x(t) = aX, starting from aGuessT,
+    // until every lane has converged. The slope is only flat at t = 0, lanes
+    // there restart from t = aX.
+    rack::simd::float_4 getTForX(rack::simd::float_4 aX, rack::simd::float_4 aGuessT) const {
+        for (int i = 0; i < 8; ++i) {
+            rack::simd::float_4 currentSlope = (3.f * xA * aGuessT + 2.f * xB) * aGuessT + xC;
+            rack::simd::float_4 currentX = ((xA * aGuessT + xB) * aGuessT + xC) * aGuessT - aX;
+            rack::simd::float_4 nextT = rack::simd::ifelse(currentSlope == 0.f, aX, aGuessT - currentX / currentSlope);
+            rack::simd::float_4 moving = rack::simd::abs(nextT - aGuessT) > 1e-6f;
+            aGuessT = nextT;
+            if (!rack::simd::movemask(moving))
+                break;
+        }
+        return aGuessT;
+    }
+
+    // Starts voice c at startPhase, from 0 to 1, with the frequency modulation
+    // it holds until its first step
+    void startVoice(int c, float startPhase, float fmVoltage, float fmKnob) {
+        int g = c / 4, i = c % 4;
+        phase[g][i] = startPhase;
+        currentValue[g][i] = 0.f;
+        targetValue[g][i] = 0.f;
+        fm[g][i] = fmVoltage;
+        fmParam[g][i] = fmKnob;
+        pulseTime[g][i] = 0.f;
+        voicesStarted = true;
+    }
+
+    // Called once per frame before process(), with CURVE within +-0.99
+    void beginFrame(float curvePoint, float sampleTime) {
+        // The curve is shared by all voices. Each sample moves the phase a
+        // little, so Newton from the last t converges in a step or two, except
+        // after a jump of the phase or the curve, which needs a bracketed search.
+        curveChanged = updateCurve(curvePoint) || voicesStarted;
+        voicesStarted = false;
+        sampleTimeChanged = (sampleTime != deltaSampleTime);
+        deltaSampleTime = sampleTime;
+    }
+
+    // Advances the voices of group g by one sample and returns their value
+    // before the offset and the limit. pitch is the FREQUENCY knob in octaves
+    // from 1 Hz, fmKnob the scaled FM amount, level the level of each voice.
+    // With sampling, signal gives the next values instead of the random
+    // generator. pulse is set to the mask of the voices whose TRIG is high.
+    rack::simd::float_4 process(int g, float sampleTime, float pitch, float fmKnob, rack::simd::float_4 fmInput,
+                                rack::simd::float_4 level, bool sampling, rack::simd::float_4 signal,
+                                rack::simd::float_4& pulse) {
+        using rack::simd::float_4;
+
+        if (contFreqModulation == true) {
+            fm[g] = fmInput;
+            fmParam[g] = fmKnob;
+        }
+        float_4 voicePitch = pitch + fm[g] * fmParam[g];
+        if (sampleTimeChanged || rack::simd::movemask(voicePitch != deltaPitch[g])) {
+            deltaPitch[g] = voicePitch;
+            phaseDelta[g] = sampleTime * fastmath::exp2(voicePitch);
+        }
+        // Calculate the phase
+        phase[g] += phaseDelta[g];
+        float_4 wrapped = phase[g] >= 1.f;
+        if (rack::simd::movemask(wrapped)) {
+            phase[g] = rack::simd::ifelse(wrapped, phase[g] - 1.f, phase[g]);
+            currentValue[g] = rack::simd::ifelse(wrapped, targetValue[g], currentValue[g]);
+            float_4 nextValue;
+            if (sampling) {
+                nextValue = signal;
+            } else {
+                if (distributionType == 0)
+                    nextValue = 5.f * (2.f * rng.uniform() - 1.f);  // Bipolar random value
+                else
+                    nextValue = rack::simd::clamp(1.6f * rng.normal(), -5.f, 5.f);  // 1.6 gives approximate -5..5
+            }
+
+            if (contLevelModulation == false) nextValue *= level;
+            targetValue[g] = rack::simd::ifelse(wrapped, nextValue, targetValue[g]);
+            if (contFreqModulation == false) {
+                fm[g] = rack::simd::ifelse(wrapped, fmInput, fm[g]);
+                fmParam[g] = rack::simd::ifelse(wrapped, fmKnob, fmParam[g]);
+            }
+
+            // SEND GATE
+            pulseTime[g] = rack::simd::ifelse(wrapped, 1e-3f, pulseTime[g]);
+        }
+
+        // Interpolate the current value using Bézier curve
+        float_4 bezierValue = phase[g];
+        if (!linearCurve) {
+            if (curveChanged)
+                curveT[g] = bisectTForX(phase[g]);
+            else if (rack::simd::movemask(wrapped))
+                curveT[g] = rack::simd::ifelse(wrapped, bisectTForX(phase[g]), curveT[g]);
+            curveT[g] = getTForX(phase[g], curveT[g]);
+            bezierValue = ((yA * curveT[g] + yB) * curveT[g] + yC) * curveT[g];
+        } else {
+            curveT[g] = phase[g];
+        }
+        float_4 outputValue = currentValue[g] + bezierValue * (targetValue[g] - currentValue[g]);
+        if (contLevelModulation == true) outputValue *= level;
+
+        // TRIGGER
+        pulse = pulseTime[g] > 0.f;
+        pulseTime[g] = rack::simd::ifelse(pulse, pulseTime[g] - sampleTime, pulseTime[g]);
+
+        return outputValue;
+    }
+};
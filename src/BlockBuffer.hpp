@@ -0,0 +1,87 @@
+#pragma once
+
+#include <algorithm>
+
+#include <rack.hpp>
+
+// Lets a module run its DSP over blocks of frames instead of one frame at a
+// time. Audio inputs are collected for a block, the module processes the whole
+// block at once, reading its controls once, and the outputs are played back
+// during the next block. Output is delayed by frames - 1 samples, a block of one
+// frame has no latency.
+//
+// Each frame, a module pushes its inputs, processes a block when ready() and
+// pulls its outputs:
+//
+//     block.push(0, inputs[IN_INPUT]);
+//     if (block.ready())
+//         processBlock();
+//     block.pull(0, outputs[OUT_OUTPUT]);
+//     block.advance();
+//
+// TwinPeaks and Resonators use it, their filters gain from a block of frames
+// with the controls held. Rich, Bezier, Euler and Byte do not: their cost is
+// the per-sample update of the voice state, not the controls, and with 8 voices
+// blocks of 8 to 32 frames ran within 5% of the per-sample code while the
+// buffering made the unblocked path 10 to 35% slower. They would only gain the
+// latency.
+template <int INPUTS, int OUTPUTS>
+struct BlockBuffer {
+    static constexpr int MAX_FRAMES = 32;
+
+    // Channel c of frame i of input k is in[k][i][c]
+    alignas(16) float in[INPUTS][MAX_FRAMES][rack::PORT_MAX_CHANNELS] = {};
+    alignas(16) float out[OUTPUTS][MAX_FRAMES][rack::PORT_MAX_CHANNELS] = {};
+    // Channels of each input when the block was completed
+    int inputChannels[INPUTS] = {};
+    // Channels of each output for the block being played back and the next one
+    int outputChannels[OUTPUTS] = {};
+    int nextOutputChannels[OUTPUTS] = {};
+
+    int frames = 1;
+    int position = 0;
+
+    // Changing the block size drops the block in progress
+    void setFrames(int newFrames) {
+        newFrames = rack::math::clamp(newFrames, 1, MAX_FRAMES);
+        if (newFrames == frames)
+            return;
+        frames = newFrames;
+        position = 0;
+        for (int k = 0; k < OUTPUTS; k++) {
+            std::fill(&out[k][0][0], &out[k][0][0] + MAX_FRAMES * rack::PORT_MAX_CHANNELS, 0.f);
+        }
+    }
+
+    void push(int k, rack::engine::Input& input) {
+        std::copy(input.getVoltages(), input.getVoltages() + rack::PORT_MAX_CHANNELS, in[k][position]);
+        inputChannels[k] = input.getChannels();
+    }
+
+    // Whether the block is complete and should be processed before pulling
+    bool ready() {
+        return position == frames - 1;
+    }
+
+    // Sets the channel count of output k for the frames of the block just
+    // processed
+    void setOutputChannels(int k, int channels) {
+        nextOutputChannels[k] = channels;
+    }
+
+    void pull(int k, rack::engine::Output& output) {
+        // The processed block is played back from the frame after the last one
+        int i = (position + 1 == frames) ? 0 : position + 1;
+        if (i == 0)
+            outputChannels[k] = nextOutputChannels[k];
+        int channels = outputChannels[k];
+        output.setChannels(channels);
+        float* voltages = output.getVoltages();
+        std::copy(out[k][i], out[k][i] + channels, voltages);
+        std::fill(voltages + channels, voltages + rack::PORT_MAX_CHANNELS, 0.f);
+    }
+
+    void advance() {
+        position = (position + 1 == frames) ? 0 : position + 1;
+    }
+};
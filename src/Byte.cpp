@@ -1,4 +1,8 @@
+#include <atomic>
+
 #include "ByteBeatParser.hpp"
+#include "BytebeatJit.hpp"
+#include "Profiler.hpp"
 #include "components.hpp"
 #include "plugin.hpp"
 
@@ -39,16 +43,41 @@ struct Byte : Module {
 
     std::string text;
     bool multiline = false;
+    // Translate compiled programs to machine code where supported
+    bool nativeCode = false;
     bool running = true;
     bool badInput = false;
     bool changed = false;
-    uint32_t t = 0;
-    float phase = 0.f;
-    float output = 0.f;
-
-    dsp::SchmittTrigger clockTrigger;
-    float clockFreq = 1.f;
-    dsp::Timer clockTimer;
+    int errorPosition = -1;
+
+    // Expressions are compiled on the UI thread and handed to the engine through
+    // pendingProgram. The engine parks the program it replaces in retiredProgram,
+    // which is freed back on the UI thread, so process() never allocates or frees.
+    std::atomic<BytebeatProgram*> pendingProgram{nullptr};
+    std::atomic<BytebeatProgram*> retiredProgram{nullptr};
+    BytebeatProgram* program = nullptr;
+
+    // Results of program for t in [blockT, blockT + LANES), valid while a/b/c
+    // stay equal to blockA/B/C
+    int32_t block[BytebeatProgram::LANES];
+    bool blockValid = false;
+    uint32_t blockT = 0;
+    int blockA = 0, blockB = 0, blockC = 0;
+    // Voices are polyphonic over the A/B/C, CLOCK and RESET inputs, each with
+    // its own counter and clock
+    static_assert(BytebeatProgram::LANES == PORT_MAX_CHANNELS, "one lane per voice");
+    int channels = 1;
+    uint32_t t[PORT_MAX_CHANNELS] = {};
+    float phase[PORT_MAX_CHANNELS] = {};
+    float output[PORT_MAX_CHANNELS] = {};
+
+    dsp::SchmittTrigger clockTrigger[PORT_MAX_CHANNELS];
+    float clockFreq[PORT_MAX_CHANNELS];
+    dsp::Timer clockTimer[PORT_MAX_CHANNELS];
+
+    // Places each output step at its position between samples
+    bool bandLimited = false;
+    dsp::MinBlepGenerator<16, 16, float> outputBlep[PORT_MAX_CHANNELS];
 
     int outputLevelType = 0;
     float levels[4][2] = {
@@ -61,14 +90,30 @@ struct Byte : Module {
     dsp::BooleanTrigger resetButtonTrigger;
 
     dsp::SchmittTrigger runTrigger;
-    dsp::SchmittTrigger resetTrigger;
+    dsp::SchmittTrigger resetTrigger[PORT_MAX_CHANNELS];
+
+    // Compiling on the UI thread and evaluating on the engine thread, see
+    // Profiler.hpp
+    enum ProfilerStages {
+        PARSE_STAGE,
+        EVALUATE_STAGE
+    };
+    Profiler profiler;
+
+    ~Byte() {
+        delete program;
+        delete pendingProgram.load();
+        delete retiredProgram.load();
+    }
 
     void onReset() override {
-        text = "";
-        t = 0;
-        phase = 0.f;
-        clockFreq = 2.f;
-        clockTimer.reset();
+        updateString("");
+        for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+            t[c] = 0;
+            phase[c] = 0.f;
+            clockFreq[c] = 2.f;
+            clockTimer[c].reset();
+        }
     }
 
     std::string getStringWithoutSpacesAndNewlines(const std::string& str) {
@@ -80,23 +125,79 @@ struct Byte : Module {
         return result;
     }
 
+    // Maps a position in the stripped expression back to the submitted text
+    int getPositionInText(const std::string& str, size_t strippedPosition) {
+        size_t kept = 0;
+        for (size_t i = 0; i < str.size(); i++) {
+            if (str[i] == ' ' || str[i] == '\n' || str[i] == '\r')
+                continue;
+            if (kept++ == strippedPosition)
+                return (int)i;
+        }
+        return (int)str.size();
+    }
+
+    // UI thread
+    void reclaimPrograms() {
+        delete retiredProgram.exchange(nullptr, std::memory_order_acq_rel);
+    }
+
+    // UI thread
+    void publishProgram(BytebeatProgram* next) {
+        reclaimPrograms();
+        // A pending program that the engine has not picked up was never visible to it
+        delete pendingProgram.exchange(next, std::memory_order_acq_rel);
+    }
+
+    // Engine thread
+    void swapProgram() {
+        // Wait until the previously replaced program has been reclaimed
+        if (retiredProgram.load(std::memory_order_acquire))
+            return;
+        BytebeatProgram* next = pendingProgram.exchange(nullptr, std::memory_order_acq_rel);
+        if (next) {
+            retiredProgram.store(program, std::memory_order_release);
+            program = next;
+            blockValid = false;
+        }
+    }
+
     void updateString(const std::string& newText) {
         std::string processed = getStringWithoutSpacesAndNewlines(newText);
         text = processed.c_str();
         // DEBUG("Module received text: %s", processed.c_str());
         badInput = false;
         changed = false;
+        errorPosition = -1;
+
+        BytebeatProgram* next = new BytebeatProgram;
+        {
+            CELLA_PROFILE_SCOPE(&profiler, PARSE_STAGE);
+            if (!text.empty()) {
+                BytebeatDiagnostic diagnostic = BytebeatCompiler(text).compile(*next);
+                if (!diagnostic.ok()) {
+                    badInput = true;
+                    errorPosition = getPositionInText(newText, diagnostic.position);
+                    DEBUG("%s at position %d", diagnostic.message(), (int)diagnostic.position);
+                }
+            }
+            if (nativeCode && !badInput && !BytebeatJit::compile(*next))
+                DEBUG("Byte: native code unavailable, using the interpreter");
+        }
+        publishProgram(next);
     }
 
     Byte() {
+        std::fill(clockFreq, clockFreq + PORT_MAX_CHANNELS, 1.f);
+
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
-        configInput(A_INPUT, "Param <a> CV");
-        configInput(B_INPUT, "Param <b> CV");
-        configInput(C_INPUT, "Param <c> CV");
+        configInput(A_INPUT, "Param <a> CV (Polyphonic)");
+        configInput(B_INPUT, "Param <b> CV (Polyphonic)");
+        configInput(C_INPUT, "Param <c> CV (Polyphonic)");
 
-        configInput(CLOCK_INPUT, "Clock");
+        configInput(CLOCK_INPUT, "Clock (Polyphonic)");
         configInput(RUN_INPUT, "Run");
-        configInput(RESET_INPUT, "Reset");
+        configInput(RESET_INPUT, "Reset (Polyphonic)");
 
         configButton(RUN_PARAM, "Run");
         configButton(RESET_PARAM, "Reset");
@@ -104,7 +205,7 @@ struct Byte : Module {
         struct FrequencyQuantity : ParamQuantity {
             float getDisplayValue() override {
                 Byte* module = reinterpret_cast<Byte*>(this->module);
-                if (module->clockFreq == 2.f) {
+                if (module->clockFreq[0] == 2.f) {
                     unit = " Hz";
                     displayMultiplier = 1.f;
                 } else {
@@ -129,86 +230,160 @@ struct Byte : Module {
         configParam(B_CV_PARAM, 0.f, 1.f, 0.f, "Param <b> CV");
         configParam(C_CV_PARAM, 0.f, 1.f, 0.f, "Param <c> CV");
 
-        configOutput(OUT_OUTPUT, "Audio");
+        configOutput(OUT_OUTPUT, "Audio (Polyphonic)");
+
+        profiler.addStage("Parse", false);
+        profiler.addStage("Evaluate");
     }
 
-    int getReading(int paramIndex, int inputIndex, int paramCVIndex) {
+    int getReading(int paramIndex, int inputIndex, int paramCVIndex, int channel) {
         float maxValue = 128.f;
         float reading = params[paramIndex].getValue();
         if (inputs[inputIndex].isConnected()) {
-            reading += params[paramCVIndex].getValue() * maxValue * inputs[inputIndex].getVoltage() / 10.f;
+            reading += params[paramCVIndex].getValue() * maxValue * inputs[inputIndex].getPolyVoltage(channel) / 10.f;
         }
         return (int)clamp(reading, 0.f, maxValue);
     }
 
+    // Engine thread. While a/b/c hold still, results are computed a block of
+    // consecutive t values at a time and consumed one per tick. After a change
+    // the next tick is evaluated on its own, so modulated a/b/c cost no more
+    // than before; blocks resume once they are stable again.
+    int evaluate(uint32_t t, int a, int b, int c) {
+        if (blockA != a || blockB != b || blockC != c) {
+            blockValid = false;
+            blockA = a;
+            blockB = b;
+            blockC = c;
+            return program->evaluate(t, a, b, c);
+        }
+        uint32_t offset = t - blockT;
+        if (!blockValid || offset >= (uint32_t)BytebeatProgram::LANES) {
+            program->evaluateBlock(t, a, b, c, block);
+            blockValid = true;
+            blockT = t;
+            offset = 0;
+        }
+        return block[offset];
+    }
+
+    // p is the position of the step relative to the current sample, in (-1, 0]
+    void setOutput(int c, float voltage, float p) {
+        if (bandLimited && voltage != output[c])
+            outputBlep[c].insertDiscontinuity(p, voltage - output[c]);
+        output[c] = voltage;
+    }
+
     void process(const ProcessArgs& args) override {
+        profiler.addSamples(1);
+
         bool runButtonTriggered = runButtonTrigger.process(params[RUN_PARAM].getValue());
         bool runTriggered = runTrigger.process(inputs[RUN_INPUT].getVoltage(), 0.1f, 2.f);
         if (runButtonTriggered || runTriggered) {
             running ^= true;
+            // Stopping drops the output to 0, band-limited like any other step
+            if (!running) {
+                for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+                    setOutput(c, 0.f, 0.f);
+                }
+            }
         }
 
         bool resetButtonTriggered = resetButtonTrigger.process(params[RESET_PARAM].getValue());
-        bool resetTriggered = resetTrigger.process(inputs[RESET_INPUT].getVoltage(), 0.1f, 2.f);
-        bool reset = (resetButtonTriggered || resetTriggered);
-
-        // // Clock
-        if (inputs[CLOCK_INPUT].isConnected()) {
-            clockTimer.process(args.sampleTime);
-
-            if (clockTrigger.process(inputs[CLOCK_INPUT].getVoltage(), 0.1f, 2.f)) {
-                float clockFreq = 1.f / clockTimer.getTime();
-                clockTimer.reset();
-                if (0.001f <= clockFreq && clockFreq <= 1000.f) {
-                    this->clockFreq = clockFreq;
+        bool reset = resetButtonTriggered;
+
+        channels = 1;
+        for (int input : {A_INPUT, B_INPUT, C_INPUT, CLOCK_INPUT, RESET_INPUT}) {
+            channels = std::max(channels, inputs[input].getChannels());
+        }
+
+        for (int c = 0; c < channels; c++) {
+            // // Clock
+            if (inputs[CLOCK_INPUT].isConnected()) {
+                clockTimer[c].process(args.sampleTime);
+
+                if (clockTrigger[c].process(inputs[CLOCK_INPUT].getPolyVoltage(c), 0.1f, 2.f)) {
+                    float clockFreq = 1.f / clockTimer[c].getTime();
+                    clockTimer[c].reset();
+                    if (0.001f <= clockFreq && clockFreq <= 1000.f) {
+                        this->clockFreq[c] = clockFreq;
+                    }
                 }
+            } else {
+                // Default frequency when clock is unpatched
+                clockFreq[c] = 2.f;
             }
-        } else {
-            // Default frequency when clock is unpatched
-            clockFreq = 2.f;
-        }
 
-        if (reset) {
-            t = 0;
+            bool resetTriggered = resetTrigger[c].process(inputs[RESET_INPUT].getPolyVoltage(c), 0.1f, 2.f);
+            if (resetButtonTriggered || resetTriggered) {
+                t[c] = 0;
+                reset = true;
+            }
         }
 
+        swapProgram();
+
         if (running) {
             float pitch = params[FREQ_PARAM].getValue();
-            float freq = clockFreq / 2.f * dsp::exp2_taylor5(pitch);
-            phase += args.sampleTime * freq;
-            if (phase >= 1.f) {
-                phase -= 1.f;
-                t++;
-
-                if (!text.empty() && !badInput) {
-                    try {
-                        int n = (int)params[BIT_PARAM].getValue();
-                        int resolution = (1 << n) - 1;
-                        BytebeatParser parser(text);
-                        int a = getReading(A_PARAM, A_INPUT, A_CV_PARAM);
-                        int b = getReading(B_PARAM, B_INPUT, B_CV_PARAM);
-                        int c = getReading(C_PARAM, C_INPUT, C_CV_PARAM);
-                        int res = parser.parseAndEvaluate(t, a, b, c);
-
-                        res = res & resolution;
-                        float out = res / (float)resolution;
-
-                        float minV = levels[outputLevelType][0];
-                        float maxV = levels[outputLevelType][1];
-
-                        output = out * (maxV - minV) + minV;
-                    } catch (const std::exception& e) {
-                        badInput = true;
-                        DEBUG("Exception caught: %s", e.what());
+            float pitchFactor = dsp::exp2_taylor5(pitch);
+            bool ticked[PORT_MAX_CHANNELS] = {};
+            bool anyTicked = false;
+            float deltaPhase[PORT_MAX_CHANNELS];
+            for (int c = 0; c < channels; c++) {
+                float freq = clockFreq[c] / 2.f * pitchFactor;
+                deltaPhase[c] = args.sampleTime * freq;
+                phase[c] += deltaPhase[c];
+                if (phase[c] >= 1.f) {
+                    phase[c] -= 1.f;
+                    t[c]++;
+                    ticked[c] = true;
+                    anyTicked = true;
+                }
+            }
+
+            if (anyTicked) {
+                if (program && !program->empty()) {
+                    int n = (int)params[BIT_PARAM].getValue();
+                    int resolution = (1 << n) - 1;
+                    int32_t a[PORT_MAX_CHANNELS] = {}, b[PORT_MAX_CHANNELS] = {}, c[PORT_MAX_CHANNELS] = {};
+                    int32_t res[PORT_MAX_CHANNELS];
+                    for (int ch = 0; ch < channels; ch++) {
+                        a[ch] = getReading(A_PARAM, A_INPUT, A_CV_PARAM, ch);
+                        b[ch] = getReading(B_PARAM, B_INPUT, B_CV_PARAM, ch);
+                        c[ch] = getReading(C_PARAM, C_INPUT, C_CV_PARAM, ch);
+                    }
+                    // Voices are evaluated together, also those that did not tick
+                    {
+                        CELLA_PROFILE_SCOPE(&profiler, EVALUATE_STAGE);
+                        if (channels == 1)
+                            res[0] = evaluate(t[0], a[0], b[0], c[0]);
+                        else
+                            program->evaluateLanes(t, a, b, c, res);
+                    }
+
+                    float minV = levels[outputLevelType][0];
+                    float maxV = levels[outputLevelType][1];
+                    for (int ch = 0; ch < channels; ch++) {
+                        if (!ticked[ch])
+                            continue;
+                        float out = (res[ch] & resolution) / (float)resolution;
+                        setOutput(ch, out * (maxV - minV) + minV, -phase[ch] / deltaPhase[ch]);
                     }
                 } else {
-                    output = 0.f;
+                    for (int c = 0; c < channels; c++) {
+                        if (ticked[c])
+                            setOutput(c, 0.f, -phase[c] / deltaPhase[c]);
+                    }
                 }
             }
-        } else {
-            output = 0.f;
         }
-        outputs[OUT_OUTPUT].setVoltage(output);
+        outputs[OUT_OUTPUT].setChannels(channels);
+        for (int c = 0; c < channels; c++) {
+            float voltage = output[c];
+            if (bandLimited)
+                voltage += outputBlep[c].process();
+            outputs[OUT_OUTPUT].setVoltage(voltage, c);
+        }
         lights[RUN_LIGHT].setBrightness(running);
         lights[EDIT_LIGHT].setBrightness(changed * 0.2);
         lights[ERROR_LIGHT].setBrightness(badInput * 0.2);
@@ -220,13 +395,19 @@ struct Byte : Module {
         json_object_set_new(rootJ, "text", json_stringn(text.c_str(), text.size()));
         json_object_set_new(rootJ, "outputLevelType", json_integer(outputLevelType));
         json_object_set_new(rootJ, "multiline", json_boolean(multiline));
+        json_object_set_new(rootJ, "nativeCode", json_boolean(nativeCode));
+        json_object_set_new(rootJ, "bandLimited", json_boolean(bandLimited));
         return rootJ;
     }
 
     void dataFromJson(json_t* rootJ) override {
+        json_t* nativeCodeJ = json_object_get(rootJ, "nativeCode");
+        if (nativeCodeJ)
+            nativeCode = json_boolean_value(nativeCodeJ);
+
         json_t* textJ = json_object_get(rootJ, "text");
         if (textJ)
-            text = json_string_value(textJ);
+            updateString(json_string_value(textJ));
 
         json_t* outputLevelTypeJ = json_object_get(rootJ, "outputLevelType");
         if (outputLevelTypeJ)
@@ -235,6 +416,10 @@ struct Byte : Module {
         json_t* multilineJ = json_object_get(rootJ, "multiline");
         if (multilineJ)
             multiline = json_boolean_value(multilineJ);
+
+        json_t* bandLimitedJ = json_object_get(rootJ, "bandLimited");
+        if (bandLimitedJ)
+            bandLimited = json_boolean_value(bandLimitedJ);
     }
 };
 
@@ -245,6 +430,7 @@ struct ByteTextField : LedDisplayTextField {
         LedDisplayTextField::step();
         if (module) {
             multiline = module->multiline;
+            module->reclaimPrograms();
         }
     }
 
@@ -277,8 +463,14 @@ struct ByteTextField : LedDisplayTextField {
     void onSubmit() {
         std::string enteredText = getText();
 
-        if (module)
+        if (module) {
             module->updateString(enteredText);
+            // Select the character where the expression stopped parsing
+            if (module->badInput && module->errorPosition >= 0) {
+                cursor = module->errorPosition;
+                selection = std::min(module->errorPosition + 1, (int)enteredText.size());
+            }
+        }
 
         // DEBUG("Enter pressed! Submitted text: %s", enteredText.c_str());
     }
@@ -349,9 +541,22 @@ struct ByteWidget : ModuleWidget {
         menu->addChild(createIndexPtrSubmenuItem("Output Range",
                                                  {"-2.5V..2.5V", "-5V..5V", "0..5V", "0..10V"},
                                                  &module->outputLevelType));
+        menu->addChild(createBoolPtrMenuItem("Band-limited steps", "", &module->bandLimited));
 
         menu->addChild(new MenuSeparator);
         menu->addChild(createBoolPtrMenuItem("Multiline", "", &module->multiline));
+
+        if (BytebeatJit::supported()) {
+            menu->addChild(createBoolMenuItem(
+                "Native code", "",
+                [=]() { return module->nativeCode; },
+                [=](bool nativeCode) {
+                    module->nativeCode = nativeCode;
+                    module->updateString(module->text);
+                }));
+        }
+
+        appendProfilerMenu(menu, &module->profiler);
     }
 };
 
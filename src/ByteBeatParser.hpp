@@ -1,58 +1,210 @@
+#pragma once
+
+#include <algorithm>
 #include <cctype>
 #include <cmath>
 #include <cstdint>  // For uint32_t
-#include <iostream>
-#include <sstream>  // For std::ostringstream
-#include <stdexcept>
+#include <cstring>
+#include <map>
+#include <memory>
 #include <string>
+#include <tuple>
+#include <vector>
+
+// Operators of the bytebeat language.
+// Evaluation semantics are those of 32-bit C integers, with the undefined cases
+// pinned down: arithmetic wraps around, shift amounts are taken modulo 32 (as the
+// CPU does), and division/modulo by zero yield 0.
+enum class BytebeatOp : uint8_t {
+    Const,
+    T,
+    A,
+    B,
+    C,
+    Neg,
+    Not,
+    Mul,
+    Div,
+    Mod,
+    Add,
+    Sub,
+    Shl,
+    Shr,
+    Lt,
+    Le,
+    Gt,
+    Ge,
+    Eq,
+    Ne,
+    And,
+    Xor,
+    Or,
+    Select,
+    // Internal, produced by the optimizer: signed division and modulo by 2^value
+    DivPow2,
+    ModPow2
+};
+
+inline int32_t bytebeatApply(BytebeatOp op, int32_t x, int32_t y) {
+    switch (op) {
+        case BytebeatOp::Neg: return (int32_t)(0u - (uint32_t)x);
+        case BytebeatOp::Not: return ~x;
+        case BytebeatOp::Mul: return (int32_t)((uint32_t)x * (uint32_t)y);
+        case BytebeatOp::Div:
+            if (y == 0) return 0;
+            if (y == -1) return (int32_t)(0u - (uint32_t)x);
+            return x / y;
+        case BytebeatOp::Mod:
+            if (y == 0 || y == -1) return 0;
+            return x % y;
+        case BytebeatOp::Add: return (int32_t)((uint32_t)x + (uint32_t)y);
+        case BytebeatOp::Sub: return (int32_t)((uint32_t)x - (uint32_t)y);
+        case BytebeatOp::Shl: return (int32_t)((uint32_t)x << (y & 31));
+        case BytebeatOp::Shr: return x >> (y & 31);
+        case BytebeatOp::Lt: return x < y;
+        case BytebeatOp::Le: return x <= y;
+        case BytebeatOp::Gt: return x > y;
+        case BytebeatOp::Ge: return x >= y;
+        case BytebeatOp::Eq: return x == y;
+        case BytebeatOp::Ne: return x != y;
+        case BytebeatOp::And: return x & y;
+        case BytebeatOp::Xor: return x ^ y;
+        case BytebeatOp::Or: return x | y;
+        // Truncates toward zero like x / 2^y: bias negative x by 2^y - 1 before shifting
+        case BytebeatOp::DivPow2: return (int32_t)((uint32_t)x + ((uint32_t)(x >> 31) >> (32 - y))) >> y;
+        // Takes the sign of x like x % 2^y
+        case BytebeatOp::ModPow2: return x - (int32_t)((uint32_t)bytebeatApply(BytebeatOp::DivPow2, x, y) << y);
+        default: return 0;
+    }
+}
+
+enum class BytebeatError : uint8_t {
+    None,
+    UnexpectedCharacter,
+    ExpectedColon,
+    ExpectedClosingParenthesis,
+    TrailingCharacters,
+    NestingTooDeep,
+    ExpressionTooLong
+};
+
+inline const char* bytebeatErrorMessage(BytebeatError error) {
+    switch (error) {
+        case BytebeatError::None: return "No error";
+        case BytebeatError::UnexpectedCharacter: return "Unexpected character";
+        case BytebeatError::ExpectedColon: return "Expected ':' after '?'";
+        case BytebeatError::ExpectedClosingParenthesis: return "Expected closing parenthesis";
+        case BytebeatError::TrailingCharacters: return "Unexpected character after expression";
+        case BytebeatError::NestingTooDeep: return "Expression nested too deeply";
+        case BytebeatError::ExpressionTooLong: return "Expression too long";
+        default: return "Unknown error";
+    }
+}
+
+// Result of a parse: the first error found and the position of the offending
+// character. Plain data, so reporting an error never allocates or throws.
+struct BytebeatDiagnostic {
+    BytebeatError error = BytebeatError::None;
+    size_t position = 0;
+
+    bool ok() const {
+        return error == BytebeatError::None;
+    }
 
-class BytebeatParser {
+    const char* message() const {
+        return bytebeatErrorMessage(error);
+    }
+};
+
+// Recursive descent grammar shared by the tree-walking parser and the compiler.
+// Derived provides the semantic actions (constant, variable, unary, binary, select)
+// operating on Value, so both back ends accept exactly the same language.
+// The first error stops the parse: from then on the input reads as exhausted, so
+// every rule unwinds without consuming more and the diagnostic keeps that error.
+// The expression is not copied and must outlive the parser.
+template <typename Derived, typename Value>
+class BytebeatGrammar {
    public:
-    BytebeatParser(const std::string& expr) : expr(expr), pos(0) {}
+    static constexpr int MAX_DEPTH = 256;
 
-    int parseAndEvaluate(uint32_t t, int a, int b, int c) {
-        this->t = t;
-        this->a = a;
-        this->b = b;
-        this->c = c;
-        int result = parseConditional();
+    BytebeatGrammar(const char* expr, size_t size) : expr(expr), size(size), pos(0) {}
+    BytebeatGrammar(const char* expr) : BytebeatGrammar(expr, std::strlen(expr)) {}
+    BytebeatGrammar(const std::string& expr) : BytebeatGrammar(expr.data(), expr.size()) {}
+
+    const BytebeatDiagnostic& diagnostic() const {
+        return diag;
+    }
+
+   protected:
+    const char* expr;
+    size_t size;
+    size_t pos;
+    int depth = 0;
+    BytebeatDiagnostic diag;
+
+    bool failed() const {
+        return !diag.ok();
+    }
+
+    void fail(BytebeatError error) {
+        if (failed())
+            return;
+        diag.error = error;
+        diag.position = pos;
+    }
+
+    Value parseExpression() {
+        pos = 0;
+        depth = 0;
+        diag = BytebeatDiagnostic();
+        Value result = parseConditional();
         skipWhitespace();
-        if (pos < expr.size()) {
-            throw std::runtime_error("Unexpected character at position " + std::to_string(pos));
-            return 0;
+        if (pos < size) {
+            fail(BytebeatError::TrailingCharacters);
         }
-        return result;
+        return failed() ? Value() : result;
     }
 
    private:
-    std::string expr;
-    size_t pos;
-    uint32_t t;
-    int a, b, c;
+    Derived& self() {
+        return static_cast<Derived&>(*this);
+    }
+
+    // Guards the recursive rules against stack exhaustion
+    bool enter() {
+        if (++depth > MAX_DEPTH) {
+            fail(BytebeatError::NestingTooDeep);
+            return false;
+        }
+        return true;
+    }
 
     // 10. Conditional (?:)
-    int parseConditional() {
-        int condition = parseBitwiseOR();
+    Value parseConditional() {
+        if (!enter())
+            return Value();
+        Value condition = parseBitwiseOR();
         skipWhitespace();
         if (match('?')) {
-            int true_expr = parseConditional();
+            Value true_expr = parseConditional();
             if (!match(':')) {
-                throw std::runtime_error("Expected ':' after '?' at position " + std::to_string(pos));
+                fail(BytebeatError::ExpectedColon);
             }
-            int false_expr = parseConditional();
-            return condition ? true_expr : false_expr;
+            Value false_expr = parseConditional();
+            condition = self().select(condition, true_expr, false_expr);
         }
+        depth--;
         return condition;
     }
 
     // 9. Bitwise OR |
-    int parseBitwiseOR() {
-        int left = parseBitwiseXOR();
+    Value parseBitwiseOR() {
+        Value left = parseBitwiseXOR();
         while (true) {
             skipWhitespace();
             if (match('|')) {
-                int right = parseBitwiseXOR();
-                left |= right;
+                Value right = parseBitwiseXOR();
+                left = self().binary(BytebeatOp::Or, left, right);
             } else {
                 break;
             }
@@ -61,13 +213,13 @@ class BytebeatParser {
     }
 
     // 8. Bitwise XOR ^
-    int parseBitwiseXOR() {
-        int left = parseBitwiseAND();
+    Value parseBitwiseXOR() {
+        Value left = parseBitwiseAND();
         while (true) {
             skipWhitespace();
             if (match('^')) {
-                int right = parseBitwiseAND();
-                left ^= right;
+                Value right = parseBitwiseAND();
+                left = self().binary(BytebeatOp::Xor, left, right);
             } else {
                 break;
             }
@@ -76,13 +228,13 @@ class BytebeatParser {
     }
 
     // 7. Bitwise AND &
-    int parseBitwiseAND() {
-        int left = parseEquality();  // upd
+    Value parseBitwiseAND() {
+        Value left = parseEquality();
         while (true) {
             skipWhitespace();
             if (match('&')) {
-                int right = parseEquality();  // upd
-                left &= right;
+                Value right = parseEquality();
+                left = self().binary(BytebeatOp::And, left, right);
             } else {
                 break;
             }
@@ -91,16 +243,16 @@ class BytebeatParser {
     }
 
     // 6. Equality == !=
-    int parseEquality() {              // upd
-        int left = parseRelational();  // upd
+    Value parseEquality() {
+        Value left = parseRelational();
         while (true) {
             skipWhitespace();
-            if (matchString("==")) {  // upd
-                int right = parseRelational();
-                left = (left == right) ? 1 : 0;
-            } else if (matchString("!=")) {  // upd
-                int right = parseRelational();
-                left = (left != right) ? 1 : 0;
+            if (matchString("==")) {
+                Value right = parseRelational();
+                left = self().binary(BytebeatOp::Eq, left, right);
+            } else if (matchString("!=")) {
+                Value right = parseRelational();
+                left = self().binary(BytebeatOp::Ne, left, right);
             } else {
                 break;
             }
@@ -109,25 +261,25 @@ class BytebeatParser {
     }
 
     // 5. Relational < > <= >=
-    int parseRelational() {
-        int left = parseShift();
+    Value parseRelational() {
+        Value left = parseShift();
         while (true) {
             skipWhitespace();
             // Check multi-character operators first
-            if (matchString("<=")) {  // upd
-                int right = parseShift();
-                left = (left <= right) ? 1 : 0;
-            } else if (matchString(">=")) {  // upd
-                int right = parseShift();
-                left = (left >= right) ? 1 : 0;
+            if (matchString("<=")) {
+                Value right = parseShift();
+                left = self().binary(BytebeatOp::Le, left, right);
+            } else if (matchString(">=")) {
+                Value right = parseShift();
+                left = self().binary(BytebeatOp::Ge, left, right);
             }
             // Next, check for possible shift operators (so we can break back to parseShift)
-            else if (matchString("<<")) {  // upd
+            else if (matchString("<<")) {
                 // We found '<<' - belongs in parseShift, so revert position and break
                 pos -= 2;  // Put it back so parseShift() can handle it
                 break;
-            } else if (matchString(">>")) {  // upd
-                pos -= 2;                    // Put it back so parseShift() can handle it
+            } else if (matchString(">>")) {
+                pos -= 2;  // Put it back so parseShift() can handle it
                 break;
             }
             // Finally, handle single-character < or >
@@ -137,16 +289,16 @@ class BytebeatParser {
                     pos -= 1;
                     break;
                 }
-                int right = parseShift();
-                left = (left < right) ? 1 : 0;
+                Value right = parseShift();
+                left = self().binary(BytebeatOp::Lt, left, right);
             } else if (match('>')) {
                 if (match('>')) {
                     // We found '>>'; revert last consume, break to handle in parseShift
                     pos -= 1;
                     break;
                 }
-                int right = parseShift();
-                left = (left > right) ? 1 : 0;
+                Value right = parseShift();
+                left = self().binary(BytebeatOp::Gt, left, right);
             } else {
                 break;
             }
@@ -155,16 +307,16 @@ class BytebeatParser {
     }
 
     // 4. Shift << >>
-    int parseShift() {
-        int left = parseAdditive();
+    Value parseShift() {
+        Value left = parseAdditive();
         while (true) {
             skipWhitespace();
             if (matchString("<<")) {
-                int right = parseAdditive();
-                left <<= right;
+                Value right = parseAdditive();
+                left = self().binary(BytebeatOp::Shl, left, right);
             } else if (matchString(">>")) {
-                int right = parseAdditive();
-                left >>= right;
+                Value right = parseAdditive();
+                left = self().binary(BytebeatOp::Shr, left, right);
             } else {
                 break;
             }
@@ -173,16 +325,16 @@ class BytebeatParser {
     }
 
     // 3. Additive + -
-    int parseAdditive() {
-        int left = parseMultiplicative();
+    Value parseAdditive() {
+        Value left = parseMultiplicative();
         while (true) {
             skipWhitespace();
             if (match('+')) {
-                int right = parseMultiplicative();
-                left += right;
+                Value right = parseMultiplicative();
+                left = self().binary(BytebeatOp::Add, left, right);
             } else if (match('-')) {
-                int right = parseMultiplicative();
-                left -= right;
+                Value right = parseMultiplicative();
+                left = self().binary(BytebeatOp::Sub, left, right);
             } else {
                 break;
             }
@@ -191,27 +343,19 @@ class BytebeatParser {
     }
 
     // 2. Multiplicative * / %
-    int parseMultiplicative() {
-        int left = parseUnary();
+    Value parseMultiplicative() {
+        Value left = parseUnary();
         while (true) {
             skipWhitespace();
             if (match('*')) {
-                int right = parseUnary();
-                left *= right;
+                Value right = parseUnary();
+                left = self().binary(BytebeatOp::Mul, left, right);
             } else if (match('/')) {
-                int right = parseUnary();
-                if (right == 0) {
-                    left = 0;
-                } else {
-                    left /= right;
-                }
+                Value right = parseUnary();
+                left = self().binary(BytebeatOp::Div, left, right);
             } else if (match('%')) {
-                int right = parseUnary();
-                if (right == 0) {
-                    left = 0;
-                } else {
-                    left %= right;
-                }
+                Value right = parseUnary();
+                left = self().binary(BytebeatOp::Mod, left, right);
             } else {
                 break;
             }
@@ -220,61 +364,63 @@ class BytebeatParser {
     }
 
     // 1. Unary - ~
-    int parseUnary() {
+    Value parseUnary() {
+        if (!enter())
+            return Value();
+        Value value;
         skipWhitespace();
         if (match('-')) {
-            return -parseUnary();
+            value = self().unary(BytebeatOp::Neg, parseUnary());
         } else if (match('~')) {
-            return ~parseUnary();
+            value = self().unary(BytebeatOp::Not, parseUnary());
         } else {
-            return parsePrimary();
+            value = parsePrimary();
         }
+        depth--;
+        return value;
     }
 
     // Primary
-    int parsePrimary() {
+    Value parsePrimary() {
         skipWhitespace();
         if (match('(')) {
-            int value = parseConditional();
+            Value value = parseConditional();
             if (!match(')')) {
-                std::ostringstream oss;
-                oss << "Expected closing parenthesis at position " << pos;
-                throw std::runtime_error(oss.str());
+                fail(BytebeatError::ExpectedClosingParenthesis);
             }
             return value;
         } else if (match('t')) {
-            return static_cast<int>(t);
+            return self().variable(BytebeatOp::T);
         } else if (match('a')) {
-            return static_cast<int>(a);
+            return self().variable(BytebeatOp::A);
         } else if (match('b')) {
-            return static_cast<int>(b);
+            return self().variable(BytebeatOp::B);
         } else if (match('c')) {
-            return static_cast<int>(c);
+            return self().variable(BytebeatOp::C);
         } else if (isdigit(peek())) {
-            return parseNumber();
+            return self().constant(parseNumber());
         } else {
-            std::ostringstream oss;
-            oss << "Unexpected character '" << peek() << "' at position " << pos;
-            throw std::runtime_error(oss.str());
+            fail(BytebeatError::UnexpectedCharacter);
+            return Value();
         }
     }
 
-    int parseNumber() {
+    int32_t parseNumber() {
         skipWhitespace();
-        int result = 0;
+        uint32_t result = 0;
         while (isdigit(peek())) {
             result = result * 10 + (consume() - '0');
         }
-        return result;
+        return (int32_t)result;
     }
 
     // Utility functions
     char peek() const {
-        return pos < expr.size() ? expr[pos] : '\0';
+        return (pos < size && !failed()) ? expr[pos] : '\0';
     }
 
     char consume() {
-        return pos < expr.size() ? expr[pos++] : '\0';
+        return (pos < size && !failed()) ? expr[pos++] : '\0';
     }
 
     void skipWhitespace() {
@@ -291,10 +437,10 @@ class BytebeatParser {
         return false;
     }
 
-    bool matchString(const std::string& expected) {
+    bool matchString(const char* expected) {
         size_t start = pos;
-        for (char c : expected) {
-            if (!match(c)) {
+        for (; *expected; expected++) {
+            if (!match(*expected)) {
                 pos = start;
                 return false;
             }
@@ -303,22 +449,661 @@ class BytebeatParser {
     }
 };
 
-bool runTest(const std::string& expression, uint32_t t, int expected) {
-    BytebeatParser parser(expression);
-    int result = parser.parseAndEvaluate(t, 0, 0, 0);
-    return (result == expected);
-}
+// Tree-walking evaluator: parses and evaluates the expression in one pass.
+// Returns 0 for an invalid expression, see diagnostic().
+class BytebeatParser : public BytebeatGrammar<BytebeatParser, int32_t> {
+   public:
+    using BytebeatGrammar::BytebeatGrammar;
 
-int main() {
-    std::string expression;
-    int t = 1234567;
+    int parseAndEvaluate(uint32_t t, int a, int b, int c) {
+        this->t = t;
+        this->a = a;
+        this->b = b;
+        this->c = c;
+        return parseExpression();
+    }
 
-    int test1 = t % (t >> 10 & t);
-    std::cout << "Test 1: "
-              << (runTest("t % (t >> 10 & t)", t, test1) ? "PASS" : "FAIL")
-              << std::endl;
+   private:
+    friend class BytebeatGrammar<BytebeatParser, int32_t>;
 
-    return 0;
+    uint32_t t;
+    int a, b, c;
+
+    int32_t constant(int32_t value) {
+        return value;
+    }
+
+    int32_t variable(BytebeatOp op) {
+        switch (op) {
+            case BytebeatOp::T: return static_cast<int32_t>(t);
+            case BytebeatOp::A: return a;
+            case BytebeatOp::B: return b;
+            default: return c;
+        }
+    }
+
+    int32_t unary(BytebeatOp op, int32_t x) {
+        return bytebeatApply(op, x, 0);
+    }
+
+    int32_t binary(BytebeatOp op, int32_t x, int32_t y) {
+        return bytebeatApply(op, x, y);
+    }
+
+    int32_t select(int32_t condition, int32_t x, int32_t y) {
+        return condition ? x : y;
+    }
+};
+
+struct BytebeatInstruction {
+    BytebeatOp op;
+    // Operand registers
+    uint16_t x, y, z;
+    // Immediate for BytebeatOp::Const, shift amount for DivPow2/ModPow2
+    int32_t value;
+};
+
+inline int bytebeatArity(BytebeatOp op) {
+    switch (op) {
+        case BytebeatOp::Const:
+        case BytebeatOp::T:
+        case BytebeatOp::A:
+        case BytebeatOp::B:
+        case BytebeatOp::C: return 0;
+        case BytebeatOp::Neg:
+        case BytebeatOp::Not:
+        case BytebeatOp::DivPow2:
+        case BytebeatOp::ModPow2: return 1;
+        case BytebeatOp::Select: return 3;
+        default: return 2;
+    }
 }
 
-// MODEM: 100*((t<<2|t>>5|t^63)&(t<<10|t>>11))
+// Flat register-based program: instruction i writes register i and only reads
+// registers written by earlier instructions.
+// Instructions are scheduled in three sections:
+//   [0, uniformBegin)             constants, loaded into their registers once
+//   [uniformBegin, varyingBegin)  instructions depending only on a, b, c, rerun when those change
+//   [varyingBegin, size)          instructions depending on t, run for every evaluation
+struct BytebeatProgram {
+    static constexpr size_t MAX_INSTRUCTIONS = 65535;
+    // Number of t values computed by evaluateBlock() and evaluateLanes()
+    static constexpr int LANES = 16;
+
+    std::vector<BytebeatInstruction> code;
+    std::vector<int32_t> registers;
+    // LANES copies of every register, lane l of register i at i * LANES + l
+    std::vector<int32_t> lanes;
+    // a/b/c the uniform section of each lane was computed for
+    bool lanesValid = false;
+    int32_t lanesA[LANES], lanesB[LANES], lanesC[LANES];
+    size_t uniformBegin = 0;
+    size_t varyingBegin = 0;
+    uint16_t result = 0;
+
+    bool uniformValid = false;
+    int uniformA = 0, uniformB = 0, uniformC = 0;
+
+    // Optional machine code for the uniform and varying sections, attached by
+    // BytebeatJit. Called with the registers and {t, a, b, c}.
+    typedef void (*NativeSection)(int32_t* registers, const int32_t* inputs);
+    NativeSection nativeUniform = nullptr;
+    NativeSection nativeVarying = nullptr;
+    // The same sections on all lanes, called with the lanes and LANES values
+    // of each of t, a, b and c in turn
+    NativeSection nativeUniformLanes = nullptr;
+    NativeSection nativeVaryingLanes = nullptr;
+    std::shared_ptr<void> nativeCode;
+
+    bool empty() const {
+        return code.empty();
+    }
+
+    // Builds the program from unscheduled code whose result is register root.
+    // Drops instructions that do not contribute to the result.
+    void schedule(const std::vector<BytebeatInstruction>& source, uint16_t root) {
+        enum { DEAD = 0, CONSTANT, UNIFORM, VARYING };
+        std::vector<uint8_t> kind(source.size(), DEAD);
+        std::vector<bool> live(source.size(), false);
+        if (!source.empty())
+            live[root] = true;
+        for (size_t i = source.size(); i-- > 0;) {
+            if (!live[i])
+                continue;
+            const BytebeatInstruction& in = source[i];
+            int arity = bytebeatArity(in.op);
+            if (arity > 0) live[in.x] = true;
+            if (arity > 1) live[in.y] = true;
+            if (arity > 2) live[in.z] = true;
+        }
+        for (size_t i = 0; i < source.size(); i++) {
+            if (!live[i])
+                continue;
+            const BytebeatInstruction& in = source[i];
+            int arity = bytebeatArity(in.op);
+            switch (in.op) {
+                case BytebeatOp::Const: kind[i] = CONSTANT; break;
+                case BytebeatOp::T: kind[i] = VARYING; break;
+                case BytebeatOp::A:
+                case BytebeatOp::B:
+                case BytebeatOp::C: kind[i] = UNIFORM; break;
+                default:
+                    // Operations on constants only remain in code that was not folded
+                    kind[i] = std::max<uint8_t>(UNIFORM, kind[in.x]);
+                    if (arity > 1) kind[i] = std::max(kind[i], kind[in.y]);
+                    if (arity > 2) kind[i] = std::max(kind[i], kind[in.z]);
+                    break;
+            }
+        }
+
+        // Source order is topological, so a stable partition keeps it valid
+        std::vector<uint16_t> remap(source.size(), 0);
+        code.clear();
+        for (int section = CONSTANT; section <= VARYING; section++) {
+            if (section == UNIFORM) uniformBegin = code.size();
+            if (section == VARYING) varyingBegin = code.size();
+            for (size_t i = 0; i < source.size(); i++) {
+                if (kind[i] != section)
+                    continue;
+                BytebeatInstruction in = source[i];
+                in.x = remap[in.x];
+                in.y = remap[in.y];
+                in.z = remap[in.z];
+                remap[i] = (uint16_t)code.size();
+                code.push_back(in);
+            }
+        }
+        result = source.empty() ? 0 : remap[root];
+
+        registers.assign(code.size(), 0);
+        for (size_t i = 0; i < uniformBegin; i++) {
+            registers[i] = code[i].value;
+        }
+        nativeUniform = nativeVarying = nativeUniformLanes = nativeVaryingLanes = nullptr;
+        nativeCode.reset();
+        lanes.assign(code.size() * LANES, 0);
+        for (size_t i = 0; i < uniformBegin; i++) {
+            std::fill(&lanes[i * LANES], &lanes[i * LANES] + LANES, code[i].value);
+        }
+        uniformValid = false;
+        lanesValid = false;
+    }
+
+    int evaluate(uint32_t t, int a, int b, int c) {
+        if (code.empty())
+            return 0;
+        updateUniform(t, a, b, c);
+        if (nativeVarying) {
+            int32_t inputs[4] = {(int32_t)t, a, b, c};
+            nativeVarying(registers.data(), inputs);
+        } else {
+            run(varyingBegin, code.size(), t, a, b, c);
+        }
+        return registers[result];
+    }
+
+    // Computes the results for t, t + 1, ..., t + LANES - 1 into out, equal to
+    // LANES calls of evaluate(). Each instruction is decoded once and applied to
+    // all lanes in a tight loop the compiler can vectorize.
+    void evaluateBlock(uint32_t t, int a, int b, int c, int32_t* out) {
+        if (code.empty()) {
+            std::fill(out, out + LANES, 0);
+            return;
+        }
+        if (!lanesValid || !sameLanes(lanesA, a) || !sameLanes(lanesB, b) || !sameLanes(lanesC, c)) {
+            updateUniform(t, a, b, c);
+            for (size_t i = uniformBegin; i < varyingBegin; i++) {
+                std::fill(&lanes[i * LANES], &lanes[i * LANES] + LANES, registers[i]);
+            }
+            std::fill(lanesA, lanesA + LANES, a);
+            std::fill(lanesB, lanesB + LANES, b);
+            std::fill(lanesC, lanesC + LANES, c);
+            lanesValid = true;
+        }
+        uint32_t ts[LANES];
+        for (int l = 0; l < LANES; l++) ts[l] = t + (uint32_t)l;
+        if (nativeVaryingLanes)
+            runNativeLanes(nativeVaryingLanes, ts);
+        else
+            runLanes(varyingBegin, code.size(), ts);
+        std::copy(&lanes[result * LANES], &lanes[result * LANES] + LANES, out);
+    }
+
+    // Computes the results for LANES independent (t, a, b, c) inputs into out,
+    // equal to one call of evaluate() per lane.
+    void evaluateLanes(const uint32_t* t, const int32_t* a, const int32_t* b, const int32_t* c, int32_t* out) {
+        if (code.empty()) {
+            std::fill(out, out + LANES, 0);
+            return;
+        }
+        if (!lanesValid || !std::equal(a, a + LANES, lanesA) || !std::equal(b, b + LANES, lanesB) ||
+            !std::equal(c, c + LANES, lanesC)) {
+            std::copy(a, a + LANES, lanesA);
+            std::copy(b, b + LANES, lanesB);
+            std::copy(c, c + LANES, lanesC);
+            if (nativeUniformLanes)
+                runNativeLanes(nativeUniformLanes, t);
+            else
+                runLanes(uniformBegin, varyingBegin, t);
+            lanesValid = true;
+        }
+        if (nativeVaryingLanes)
+            runNativeLanes(nativeVaryingLanes, t);
+        else
+            runLanes(varyingBegin, code.size(), t);
+        std::copy(&lanes[result * LANES], &lanes[result * LANES] + LANES, out);
+    }
+
+   private:
+    void updateUniform(uint32_t t, int a, int b, int c) {
+        if (uniformValid && a == uniformA && b == uniformB && c == uniformC)
+            return;
+        if (nativeUniform) {
+            int32_t inputs[4] = {(int32_t)t, a, b, c};
+            nativeUniform(registers.data(), inputs);
+        } else {
+            run(uniformBegin, varyingBegin, t, a, b, c);
+        }
+        uniformValid = true;
+        uniformA = a;
+        uniformB = b;
+        uniformC = c;
+    }
+
+    static bool sameLanes(const int32_t* x, int32_t value) {
+        for (int l = 0; l < LANES; l++) {
+            if (x[l] != value)
+                return false;
+        }
+        return true;
+    }
+
+    // Runs a native lane section on t and the a/b/c of the lanes
+    void runNativeLanes(NativeSection section, const uint32_t* t) {
+        int32_t inputs[4 * LANES];
+        for (int l = 0; l < LANES; l++) inputs[l] = (int32_t)t[l];
+        std::copy(lanesA, lanesA + LANES, inputs + LANES);
+        std::copy(lanesB, lanesB + LANES, inputs + 2 * LANES);
+        std::copy(lanesC, lanesC + LANES, inputs + 3 * LANES);
+        section(lanes.data(), inputs);
+    }
+
+    template <typename F>
+    static void lanewise(int32_t* r, const int32_t* x, const int32_t* y, F f) {
+        for (int l = 0; l < LANES; l++) r[l] = f(x[l], y[l]);
+    }
+
+    // Runs the uniform or varying section on all lanes. Constants are never
+    // run, their lanes are filled in by schedule().
+    void runLanes(size_t begin, size_t end, const uint32_t* t) {
+        const BytebeatInstruction* in = code.data() + begin;
+        for (size_t i = begin; i < end; i++, in++) {
+            int32_t* r = &lanes[i * LANES];
+            const int32_t* x = &lanes[in->x * LANES];
+            const int32_t* y = &lanes[in->y * LANES];
+            switch (in->op) {
+                case BytebeatOp::T:
+                    for (int l = 0; l < LANES; l++) r[l] = (int32_t)t[l];
+                    break;
+                case BytebeatOp::A: std::copy(lanesA, lanesA + LANES, r); break;
+                case BytebeatOp::B: std::copy(lanesB, lanesB + LANES, r); break;
+                case BytebeatOp::C: std::copy(lanesC, lanesC + LANES, r); break;
+                case BytebeatOp::Neg:
+                    lanewise(r, x, x, [](int32_t u, int32_t) { return (int32_t)(0u - (uint32_t)u); });
+                    break;
+                case BytebeatOp::Not:
+                    lanewise(r, x, x, [](int32_t u, int32_t) { return ~u; });
+                    break;
+                case BytebeatOp::Mul:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)((uint32_t)u * (uint32_t)v); });
+                    break;
+                case BytebeatOp::Add:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)((uint32_t)u + (uint32_t)v); });
+                    break;
+                case BytebeatOp::Sub:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)((uint32_t)u - (uint32_t)v); });
+                    break;
+                case BytebeatOp::Shl:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)((uint32_t)u << (v & 31)); });
+                    break;
+                case BytebeatOp::Shr:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return u >> (v & 31); });
+                    break;
+                case BytebeatOp::Lt:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)(u < v); });
+                    break;
+                case BytebeatOp::Le:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)(u <= v); });
+                    break;
+                case BytebeatOp::Gt:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)(u > v); });
+                    break;
+                case BytebeatOp::Ge:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)(u >= v); });
+                    break;
+                case BytebeatOp::Eq:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)(u == v); });
+                    break;
+                case BytebeatOp::Ne:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return (int32_t)(u != v); });
+                    break;
+                case BytebeatOp::And:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return u & v; });
+                    break;
+                case BytebeatOp::Xor:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return u ^ v; });
+                    break;
+                case BytebeatOp::Or:
+                    lanewise(r, x, y, [](int32_t u, int32_t v) { return u | v; });
+                    break;
+                case BytebeatOp::Select: {
+                    const int32_t* z = &lanes[in->z * LANES];
+                    for (int l = 0; l < LANES; l++) r[l] = x[l] ? y[l] : z[l];
+                    break;
+                }
+                case BytebeatOp::DivPow2:
+                case BytebeatOp::ModPow2:
+                    for (int l = 0; l < LANES; l++) r[l] = bytebeatApply(in->op, x[l], in->value);
+                    break;
+                default:
+                    for (int l = 0; l < LANES; l++) r[l] = bytebeatApply(in->op, x[l], y[l]);
+                    break;
+            }
+        }
+    }
+
+    void run(size_t begin, size_t end, uint32_t t, int a, int b, int c) {
+        int32_t* r = registers.data();
+        const BytebeatInstruction* in = code.data() + begin;
+        for (size_t i = begin; i < end; i++, in++) {
+            switch (in->op) {
+                case BytebeatOp::Const: r[i] = in->value; break;
+                case BytebeatOp::T: r[i] = (int32_t)t; break;
+                case BytebeatOp::A: r[i] = a; break;
+                case BytebeatOp::B: r[i] = b; break;
+                case BytebeatOp::C: r[i] = c; break;
+                case BytebeatOp::Neg: r[i] = (int32_t)(0u - (uint32_t)r[in->x]); break;
+                case BytebeatOp::Not: r[i] = ~r[in->x]; break;
+                case BytebeatOp::Add: r[i] = (int32_t)((uint32_t)r[in->x] + (uint32_t)r[in->y]); break;
+                case BytebeatOp::Sub: r[i] = (int32_t)((uint32_t)r[in->x] - (uint32_t)r[in->y]); break;
+                case BytebeatOp::Shl: r[i] = (int32_t)((uint32_t)r[in->x] << (r[in->y] & 31)); break;
+                case BytebeatOp::Shr: r[i] = r[in->x] >> (r[in->y] & 31); break;
+                case BytebeatOp::And: r[i] = r[in->x] & r[in->y]; break;
+                case BytebeatOp::Xor: r[i] = r[in->x] ^ r[in->y]; break;
+                case BytebeatOp::Or: r[i] = r[in->x] | r[in->y]; break;
+                case BytebeatOp::Select: r[i] = r[in->x] ? r[in->y] : r[in->z]; break;
+                case BytebeatOp::DivPow2:
+                case BytebeatOp::ModPow2: r[i] = bytebeatApply(in->op, r[in->x], in->value); break;
+                default: r[i] = bytebeatApply(in->op, r[in->x], r[in->y]); break;
+            }
+        }
+    }
+};
+
+// Rewrites unscheduled code into cheaper, equivalent code:
+//  - constant folding and algebraic identities (x+0, x*1, x^x, c?x:y with constant c, ...)
+//  - strength reduction of *, / and % by powers of two into shifts and masks
+//  - common subexpression elimination, so repeated terms such as t>>8 are computed once
+class BytebeatOptimizer {
+   public:
+    // Sets result to the register holding the result in the rewritten code.
+    // Returns false if the rewritten code would not fit in MAX_INSTRUCTIONS,
+    // which strength reduction can cause by adding shift constants.
+    static bool optimize(const std::vector<BytebeatInstruction>& source, uint16_t root,
+                         std::vector<BytebeatInstruction>& code, uint16_t& result) {
+        BytebeatOptimizer optimizer(code);
+        std::vector<uint16_t> remap(source.size(), 0);
+        for (size_t i = 0; i < source.size(); i++) {
+            BytebeatInstruction in = source[i];
+            in.x = remap[in.x];
+            in.y = remap[in.y];
+            in.z = remap[in.z];
+            remap[i] = optimizer.rewrite(in);
+            if (optimizer.overflow)
+                return false;
+        }
+        result = source.empty() ? 0 : remap[root];
+        return true;
+    }
+
+   private:
+    std::vector<BytebeatInstruction>& code;
+    bool overflow = false;
+    std::map<std::tuple<uint8_t, uint16_t, uint16_t, uint16_t, int32_t>, uint16_t> table;
+
+    BytebeatOptimizer(std::vector<BytebeatInstruction>& code) : code(code) {
+        code.clear();
+    }
+
+    bool isConstant(uint16_t x) const {
+        return code[x].op == BytebeatOp::Const;
+    }
+
+    bool isConstant(uint16_t x, int32_t value) const {
+        return isConstant(x) && code[x].value == value;
+    }
+
+    static bool isCommutative(BytebeatOp op) {
+        switch (op) {
+            case BytebeatOp::Mul:
+            case BytebeatOp::Add:
+            case BytebeatOp::Eq:
+            case BytebeatOp::Ne:
+            case BytebeatOp::And:
+            case BytebeatOp::Xor:
+            case BytebeatOp::Or: return true;
+            default: return false;
+        }
+    }
+
+    // Returns log2(x) if x is a power of two as an unsigned value, -1 otherwise
+    static int log2Exact(int32_t x) {
+        uint32_t u = (uint32_t)x;
+        if (u == 0 || (u & (u - 1)) != 0)
+            return -1;
+        int k = 0;
+        while (u >>= 1) k++;
+        return k;
+    }
+
+    // Hash-conses the instruction, so structurally equal instructions share a register
+    uint16_t add(BytebeatOp op, uint16_t x = 0, uint16_t y = 0, uint16_t z = 0, int32_t value = 0) {
+        int arity = bytebeatArity(op);
+        if (arity < 3) z = 0;
+        if (arity < 2) y = 0;
+        if (arity < 1) x = 0;
+        auto key = std::make_tuple((uint8_t)op, x, y, z, value);
+        auto it = table.find(key);
+        if (it != table.end())
+            return it->second;
+        if (code.size() >= BytebeatProgram::MAX_INSTRUCTIONS) {
+            overflow = true;
+            return 0;
+        }
+        BytebeatInstruction in;
+        in.op = op;
+        in.x = x;
+        in.y = y;
+        in.z = z;
+        in.value = value;
+        code.push_back(in);
+        uint16_t index = (uint16_t)(code.size() - 1);
+        table[key] = index;
+        return index;
+    }
+
+    uint16_t constant(int32_t value) {
+        return add(BytebeatOp::Const, 0, 0, 0, value);
+    }
+
+    uint16_t rewrite(BytebeatInstruction in) {
+        BytebeatOp op = in.op;
+        uint16_t x = in.x, y = in.y, z = in.z;
+        switch (bytebeatArity(op)) {
+            case 0:
+                return add(op, 0, 0, 0, in.value);
+            case 1:
+                if (isConstant(x))
+                    return constant(bytebeatApply(op, code[x].value, in.value));
+                // --x and ~~x
+                if ((op == BytebeatOp::Neg || op == BytebeatOp::Not) && code[x].op == op)
+                    return code[x].x;
+                return add(op, x, 0, 0, in.value);
+            case 3:
+                if (isConstant(x))
+                    return code[x].value ? y : z;
+                if (y == z)
+                    return y;
+                return add(op, x, y, z);
+            default:
+                break;
+        }
+
+        if (isConstant(x) && isConstant(y))
+            return constant(bytebeatApply(op, code[x].value, code[y].value));
+        // Keep constants on the right of commutative operators
+        if (isCommutative(op) && (isConstant(x) || (!isConstant(y) && x > y)))
+            std::swap(x, y);
+
+        bool cy = isConstant(y);
+        int32_t vy = cy ? code[y].value : 0;
+        switch (op) {
+            case BytebeatOp::Add:
+                if (cy && vy == 0) return x;
+                break;
+            case BytebeatOp::Sub:
+                if (cy && vy == 0) return x;
+                if (x == y) return constant(0);
+                if (isConstant(x, 0)) return add(BytebeatOp::Neg, y);
+                break;
+            case BytebeatOp::Mul:
+                if (cy) {
+                    if (vy == 0) return y;
+                    if (vy == 1) return x;
+                    if (vy == -1) return add(BytebeatOp::Neg, x);
+                    int k = log2Exact(vy);
+                    if (k > 0) return add(BytebeatOp::Shl, x, constant(k));
+                }
+                break;
+            case BytebeatOp::Div:
+                if (isConstant(x, 0)) return x;
+                if (cy) {
+                    if (vy == 0) return y;
+                    if (vy == 1) return x;
+                    if (vy == -1) return add(BytebeatOp::Neg, x);
+                    int k = log2Exact(vy);
+                    if (vy > 0 && k > 0) return add(BytebeatOp::DivPow2, x, 0, 0, k);
+                }
+                break;
+            case BytebeatOp::Mod:
+                if (isConstant(x, 0)) return x;
+                if (x == y) return constant(0);
+                if (cy) {
+                    if (vy == 0 || vy == 1 || vy == -1) return constant(0);
+                    int k = log2Exact(vy);
+                    if (vy > 0 && k > 0) return add(BytebeatOp::ModPow2, x, 0, 0, k);
+                }
+                break;
+            case BytebeatOp::Shl:
+            case BytebeatOp::Shr:
+                if (cy && (vy & 31) == 0) return x;
+                if (isConstant(x, 0)) return x;
+                break;
+            case BytebeatOp::And:
+                if (cy && vy == 0) return y;
+                if (cy && vy == -1) return x;
+                if (x == y) return x;
+                break;
+            case BytebeatOp::Or:
+                if (cy && vy == 0) return x;
+                if (cy && vy == -1) return y;
+                if (x == y) return x;
+                break;
+            case BytebeatOp::Xor:
+                if (cy && vy == 0) return x;
+                if (cy && vy == -1) return add(BytebeatOp::Not, x);
+                if (x == y) return constant(0);
+                break;
+            case BytebeatOp::Eq:
+            case BytebeatOp::Le:
+            case BytebeatOp::Ge:
+                if (x == y) return constant(1);
+                break;
+            case BytebeatOp::Ne:
+            case BytebeatOp::Lt:
+            case BytebeatOp::Gt:
+                if (x == y) return constant(0);
+                break;
+            default:
+                break;
+        }
+        return add(op, x, y);
+    }
+};
+
+// Compiles an expression into a BytebeatProgram, so that the expression is
+// parsed once and only evaluated afterwards.
+class BytebeatCompiler : public BytebeatGrammar<BytebeatCompiler, uint16_t> {
+   public:
+    using BytebeatGrammar::BytebeatGrammar;
+
+    // Leaves the program empty if the expression is invalid
+    BytebeatDiagnostic compile(BytebeatProgram& program, bool optimize = true) {
+        code.clear();
+        uint16_t root = parseExpression();
+        if (failed())
+            code.clear();
+        if (optimize && !code.empty()) {
+            std::vector<BytebeatInstruction> optimized;
+            uint16_t optimizedRoot;
+            // An expression at the limit runs unoptimized rather than failing
+            if (BytebeatOptimizer::optimize(code, root, optimized, optimizedRoot)) {
+                code.swap(optimized);
+                root = optimizedRoot;
+            }
+        }
+        program.schedule(code, root);
+        return diag;
+    }
+
+   private:
+    friend class BytebeatGrammar<BytebeatCompiler, uint16_t>;
+
+    std::vector<BytebeatInstruction> code;
+
+    uint16_t emit(BytebeatOp op, uint16_t x = 0, uint16_t y = 0, uint16_t z = 0, int32_t value = 0) {
+        if (code.size() >= BytebeatProgram::MAX_INSTRUCTIONS) {
+            fail(BytebeatError::ExpressionTooLong);
+        }
+        if (failed())
+            return 0;
+        BytebeatInstruction in;
+        in.op = op;
+        in.x = x;
+        in.y = y;
+        in.z = z;
+        in.value = value;
+        code.push_back(in);
+        return (uint16_t)(code.size() - 1);
+    }
+
+    uint16_t constant(int32_t value) {
+        return emit(BytebeatOp::Const, 0, 0, 0, value);
+    }
+
+    uint16_t variable(BytebeatOp op) {
+        return emit(op);
+    }
+
+    uint16_t unary(BytebeatOp op, uint16_t x) {
+        return emit(op, x);
+    }
+
+    uint16_t binary(BytebeatOp op, uint16_t x, uint16_t y) {
+        return emit(op, x, y);
+    }
+
+    uint16_t select(uint16_t condition, uint16_t x, uint16_t y) {
+        return emit(BytebeatOp::Select, condition, x, y);
+    }
+};
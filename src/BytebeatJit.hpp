@@ -0,0 +1,477 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+
+#include "ByteBeatParser.hpp"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define BYTEBEAT_JIT 1
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#else
+#define BYTEBEAT_JIT 0
+#endif
+
+// Translates the uniform and varying sections of a scheduled BytebeatProgram
+// into x86-64 machine code, removing the per-instruction dispatch of the
+// interpreter. Registers stay in memory: every instruction loads its operands,
+// computes in eax and stores the result, with the same semantics as bytebeatApply.
+//
+// Each section is also translated for the LANES copies of the registers used
+// by evaluateBlock() and evaluateLanes(). There instructions compute four lanes
+// at a time in xmm registers. Shifts by a register that is not a constant and
+// divisions have no SSE form and are computed lane by lane as above, as are
+// multiplications when the plugin is built without SSE4.1.
+//
+// The generated functions only use rax, rcx, rdx, r10, r11 and xmm0-xmm3,
+// which are scratch registers in both the System V and the Windows calling
+// conventions, and never touch the stack.
+//
+// On other architectures, or when executable memory cannot be allocated,
+// compile() returns false and the program keeps using the interpreter.
+class BytebeatJit {
+   public:
+    static bool supported() {
+        return BYTEBEAT_JIT;
+    }
+
+    static bool compile(BytebeatProgram& program) {
+#if BYTEBEAT_JIT
+        if (program.empty())
+            return false;
+        BytebeatJit jit;
+        size_t uniformOffset = jit.section(program, program.uniformBegin, program.varyingBegin);
+        size_t varyingOffset = jit.section(program, program.varyingBegin, program.code.size());
+        size_t uniformLanesOffset = jit.laneSection(program, program.uniformBegin, program.varyingBegin);
+        size_t varyingLanesOffset = jit.laneSection(program, program.varyingBegin, program.code.size());
+
+        std::shared_ptr<void> memory = allocate(jit.bytes);
+        if (!memory)
+            return false;
+        uint8_t* base = (uint8_t*)memory.get();
+        program.nativeUniform = (BytebeatProgram::NativeSection)(void*)(base + uniformOffset);
+        program.nativeVarying = (BytebeatProgram::NativeSection)(void*)(base + varyingOffset);
+        program.nativeUniformLanes = (BytebeatProgram::NativeSection)(void*)(base + uniformLanesOffset);
+        program.nativeVaryingLanes = (BytebeatProgram::NativeSection)(void*)(base + varyingLanesOffset);
+        program.nativeCode = memory;
+        program.uniformValid = false;
+        program.lanesValid = false;
+        return true;
+#else
+        (void)program;
+        return false;
+#endif
+    }
+
+#if BYTEBEAT_JIT
+   private:
+    static constexpr int LANES = BytebeatProgram::LANES;
+
+    std::vector<uint8_t> bytes;
+    // Registers and inputs are addressed as lane of register index * stride,
+    // stride 1 for the scalar sections and LANES for the lane sections
+    int stride = 1;
+    int lane = 0;
+
+    enum Reg { EAX = 0, ECX = 1, EDX = 2 };
+    enum Xmm { XMM0 = 0, XMM1 = 1, XMM2 = 2, XMM3 = 3 };
+
+    void emit(std::initializer_list<uint8_t> b) {
+        bytes.insert(bytes.end(), b);
+    }
+
+    void emit32(int32_t v) {
+        uint32_t u = (uint32_t)v;
+        emit({(uint8_t)u, (uint8_t)(u >> 8), (uint8_t)(u >> 16), (uint8_t)(u >> 24)});
+    }
+
+    // Byte offset of the current lane of a register or input
+    int32_t slot(int32_t index) {
+        return 4 * (index * stride + lane);
+    }
+
+    // <opcode> reg, [r11 + slot]
+    void registerOperand(std::initializer_list<uint8_t> opcode, Reg reg, uint16_t index) {
+        emit({0x41});
+        emit(opcode);
+        emit({(uint8_t)(0x83 | reg << 3)});
+        emit32(slot(index));
+    }
+
+    void load(Reg reg, uint16_t index) {
+        registerOperand({0x8B}, reg, index);
+    }
+
+    // mov eax, [r10 + slot]
+    void loadInput(int input) {
+        emit({0x41, 0x8B, 0x82});
+        emit32(slot(input));
+    }
+
+    // movdqu reg, [r11 + slot], four lanes from the current one
+    void loadVector(Xmm reg, uint16_t index) {
+        emit({0xF3, 0x41, 0x0F, 0x6F, (uint8_t)(0x83 | reg << 3)});
+        emit32(slot(index));
+    }
+
+    // movdqu [r11 + slot], reg
+    void storeVector(Xmm reg, uint16_t index) {
+        emit({0xF3, 0x41, 0x0F, 0x7F, (uint8_t)(0x83 | reg << 3)});
+        emit32(slot(index));
+    }
+
+    // movdqu reg, [r10 + slot]
+    void loadInputVector(Xmm reg, int input) {
+        emit({0xF3, 0x41, 0x0F, 0x6F, (uint8_t)(0x82 | reg << 3)});
+        emit32(slot(input));
+    }
+
+    // <opcode> dst, src on packed 32-bit integers
+    void packed(uint8_t opcode, Xmm dst, Xmm src) {
+        emit({0x66, 0x0F, opcode, (uint8_t)(0xC0 | dst << 3 | src)});
+    }
+
+    // pslld (6), psrld (2) or psrad (4) reg, count
+    void shiftVector(uint8_t extension, Xmm reg, uint8_t count) {
+        emit({0x66, 0x0F, 0x72, (uint8_t)(0xC0 | extension << 3 | reg), count});
+    }
+
+    // reg = 1 in every lane
+    void ones(Xmm reg) {
+        packed(0x76, reg, reg);  // pcmpeqd reg, reg
+        shiftVector(2, reg, 31);
+    }
+
+    // Emits a rel8 jump and returns the position of its offset for patch()
+    size_t jump(uint8_t opcode) {
+        emit({opcode, 0x00});
+        return bytes.size() - 1;
+    }
+
+    void patch(size_t at) {
+        bytes[at] = (uint8_t)(bytes.size() - (at + 1));
+    }
+
+    // Moves the registers pointer to r11 and the inputs pointer to r10
+    void prologue() {
+#if defined(_WIN32)
+        emit({0x49, 0x89, 0xCB});  // mov r11, rcx
+        emit({0x49, 0x89, 0xD2});  // mov r10, rdx
+#else
+        emit({0x49, 0x89, 0xFB});  // mov r11, rdi
+        emit({0x49, 0x89, 0xF2});  // mov r10, rsi
+#endif
+    }
+
+    // Emits the function for instructions [begin, end) and returns its offset
+    size_t section(const BytebeatProgram& program, size_t begin, size_t end) {
+        size_t offset = bytes.size();
+        prologue();
+        for (size_t i = begin; i < end; i++) {
+            instruction(program.code[i]);
+            registerOperand({0x89}, EAX, (uint16_t)i);  // mov [r11 + 4 * i], eax
+        }
+        emit({0xC3});  // ret
+        return offset;
+    }
+
+    // Emits the function for instructions [begin, end) on all lanes and returns
+    // its offset
+    size_t laneSection(const BytebeatProgram& program, size_t begin, size_t end) {
+        size_t offset = bytes.size();
+        stride = LANES;
+        prologue();
+        for (size_t i = begin; i < end; i++) {
+            const BytebeatInstruction& in = program.code[i];
+            bool vector = true;
+            switch (in.op) {
+                case BytebeatOp::Shl:
+                case BytebeatOp::Shr: vector = in.y < program.uniformBegin; break;
+                case BytebeatOp::Div:
+                case BytebeatOp::Mod: vector = false; break;
+#ifndef __SSE4_1__
+                case BytebeatOp::Mul: vector = false; break;
+#endif
+                default: break;
+            }
+            for (lane = 0; lane < LANES; lane += vector ? 4 : 1) {
+                if (vector) {
+                    storeVector(vectorInstruction(program, in), (uint16_t)i);
+                } else {
+                    instruction(in);
+                    registerOperand({0x89}, EAX, (uint16_t)i);
+                }
+            }
+        }
+        emit({0xC3});  // ret
+        stride = 1;
+        lane = 0;
+        return offset;
+    }
+
+    void instruction(const BytebeatInstruction& in) {
+        switch (in.op) {
+            case BytebeatOp::Const:
+                emit({0xB8});  // mov eax, imm32
+                emit32(in.value);
+                break;
+            case BytebeatOp::T: loadInput(0); break;
+            case BytebeatOp::A: loadInput(1); break;
+            case BytebeatOp::B: loadInput(2); break;
+            case BytebeatOp::C: loadInput(3); break;
+            case BytebeatOp::Neg:
+                load(EAX, in.x);
+                emit({0xF7, 0xD8});  // neg eax
+                break;
+            case BytebeatOp::Not:
+                load(EAX, in.x);
+                emit({0xF7, 0xD0});  // not eax
+                break;
+            case BytebeatOp::Mul:
+                load(EAX, in.x);
+                registerOperand({0x0F, 0xAF}, EAX, in.y);  // imul eax, [y]
+                break;
+            case BytebeatOp::Add: arithmetic(0x03, in); break;
+            case BytebeatOp::Sub: arithmetic(0x2B, in); break;
+            case BytebeatOp::And: arithmetic(0x23, in); break;
+            case BytebeatOp::Xor: arithmetic(0x33, in); break;
+            case BytebeatOp::Or: arithmetic(0x0B, in); break;
+            // x86 masks the shift count in cl to 5 bits, as bytebeatApply does
+            case BytebeatOp::Shl:
+                load(EAX, in.x);
+                load(ECX, in.y);
+                emit({0xD3, 0xE0});  // shl eax, cl
+                break;
+            case BytebeatOp::Shr:
+                load(EAX, in.x);
+                load(ECX, in.y);
+                emit({0xD3, 0xF8});  // sar eax, cl
+                break;
+            case BytebeatOp::Lt: compare(0x9C, in); break;
+            case BytebeatOp::Le: compare(0x9E, in); break;
+            case BytebeatOp::Gt: compare(0x9F, in); break;
+            case BytebeatOp::Ge: compare(0x9D, in); break;
+            case BytebeatOp::Eq: compare(0x94, in); break;
+            case BytebeatOp::Ne: compare(0x95, in); break;
+            case BytebeatOp::Select:
+                load(EAX, in.y);
+                load(ECX, in.x);
+                emit({0x85, 0xC9});                          // test ecx, ecx
+                registerOperand({0x0F, 0x44}, EAX, in.z);  // cmovz eax, [z]
+                break;
+            case BytebeatOp::Div:
+            case BytebeatOp::Mod: divide(in); break;
+            case BytebeatOp::DivPow2:
+            case BytebeatOp::ModPow2: dividePow2(in); break;
+        }
+    }
+
+    // Computes four lanes of an instruction and returns the register holding them
+    Xmm vectorInstruction(const BytebeatProgram& program, const BytebeatInstruction& in) {
+        switch (in.op) {
+            case BytebeatOp::Const:
+                emit({0xB8});  // mov eax, imm32
+                emit32(in.value);
+                emit({0x66, 0x0F, 0x6E, 0xC0});        // movd xmm0, eax
+                emit({0x66, 0x0F, 0x70, 0xC0, 0x00});  // pshufd xmm0, xmm0, 0
+                return XMM0;
+            case BytebeatOp::T: loadInputVector(XMM0, 0); return XMM0;
+            case BytebeatOp::A: loadInputVector(XMM0, 1); return XMM0;
+            case BytebeatOp::B: loadInputVector(XMM0, 2); return XMM0;
+            case BytebeatOp::C: loadInputVector(XMM0, 3); return XMM0;
+            case BytebeatOp::Neg:
+                loadVector(XMM0, in.x);
+                packed(0xEF, XMM1, XMM1);  // pxor
+                packed(0xFA, XMM1, XMM0);  // psubd
+                return XMM1;
+            case BytebeatOp::Not:
+                loadVector(XMM0, in.x);
+                packed(0x76, XMM1, XMM1);  // pcmpeqd
+                packed(0xEF, XMM0, XMM1);  // pxor
+                return XMM0;
+            case BytebeatOp::Mul:
+                loadVector(XMM0, in.x);
+                loadVector(XMM1, in.y);
+                emit({0x66, 0x0F, 0x38, 0x40, 0xC1});  // pmulld xmm0, xmm1
+                return XMM0;
+            case BytebeatOp::Add: return packedOperands(0xFE, in);  // paddd
+            case BytebeatOp::Sub: return packedOperands(0xFA, in);  // psubd
+            case BytebeatOp::And: return packedOperands(0xDB, in);  // pand
+            case BytebeatOp::Xor: return packedOperands(0xEF, in);  // pxor
+            case BytebeatOp::Or: return packedOperands(0xEB, in);   // por
+            // By a constant only, see laneSection()
+            case BytebeatOp::Shl:
+            case BytebeatOp::Shr:
+                loadVector(XMM0, in.x);
+                shiftVector(in.op == BytebeatOp::Shl ? 6 : 4, XMM0, (uint8_t)(program.code[in.y].value & 31));
+                return XMM0;
+            // pcmpgtd and pcmpeqd give -1 for true, shifted or masked down to 1
+            case BytebeatOp::Lt:
+                packedOperands(0x66, in, true);  // pcmpgtd xmm1, xmm0
+                shiftVector(2, XMM1, 31);
+                return XMM1;
+            case BytebeatOp::Gt:
+                packedOperands(0x66, in);  // pcmpgtd xmm0, xmm1
+                shiftVector(2, XMM0, 31);
+                return XMM0;
+            case BytebeatOp::Le:
+                packedOperands(0x66, in);
+                ones(XMM2);
+                packed(0xDF, XMM0, XMM2);  // pandn
+                return XMM0;
+            case BytebeatOp::Ge:
+                packedOperands(0x66, in, true);
+                ones(XMM2);
+                packed(0xDF, XMM1, XMM2);
+                return XMM1;
+            case BytebeatOp::Eq:
+                packedOperands(0x76, in);  // pcmpeqd
+                shiftVector(2, XMM0, 31);
+                return XMM0;
+            case BytebeatOp::Ne:
+                packedOperands(0x76, in);
+                ones(XMM2);
+                packed(0xDF, XMM0, XMM2);
+                return XMM0;
+            case BytebeatOp::Select:
+                loadVector(XMM0, in.x);
+                loadVector(XMM1, in.y);
+                loadVector(XMM2, in.z);
+                packed(0xEF, XMM3, XMM3);
+                packed(0x76, XMM0, XMM3);  // xmm0 = x == 0
+                packed(0xDB, XMM2, XMM0);
+                packed(0xDF, XMM0, XMM1);
+                packed(0xEB, XMM0, XMM2);
+                return XMM0;
+            case BytebeatOp::DivPow2:
+            case BytebeatOp::ModPow2: {
+                uint8_t k = (uint8_t)in.value;
+                loadVector(XMM0, in.x);
+                packed(0x6F, XMM1, XMM0);  // movdqa
+                shiftVector(4, XMM1, 31);
+                shiftVector(2, XMM1, (uint8_t)(32 - k));
+                packed(0xFE, XMM1, XMM0);
+                shiftVector(4, XMM1, k);
+                if (in.op == BytebeatOp::DivPow2)
+                    return XMM1;
+                shiftVector(6, XMM1, k);
+                packed(0xFA, XMM0, XMM1);
+                return XMM0;
+            }
+            default:
+                // Div and Mod are computed lane by lane, see laneSection()
+                return XMM0;
+        }
+    }
+
+    // Loads x into xmm0 and y into xmm1 and applies <opcode> xmm0, xmm1, or
+    // <opcode> xmm1, xmm0 if swapped
+    Xmm packedOperands(uint8_t opcode, const BytebeatInstruction& in, bool swapped = false) {
+        loadVector(XMM0, in.x);
+        loadVector(XMM1, in.y);
+        if (swapped) {
+            packed(opcode, XMM1, XMM0);
+            return XMM1;
+        }
+        packed(opcode, XMM0, XMM1);
+        return XMM0;
+    }
+
+    void arithmetic(uint8_t opcode, const BytebeatInstruction& in) {
+        load(EAX, in.x);
+        registerOperand({opcode}, EAX, in.y);
+    }
+
+    void compare(uint8_t setcc, const BytebeatInstruction& in) {
+        load(ECX, in.x);
+        emit({0x31, 0xC0});                  // xor eax, eax
+        registerOperand({0x3B}, ECX, in.y);  // cmp ecx, [y]
+        emit({0x0F, setcc, 0xC0});           // setcc al
+    }
+
+    // x / 0 and x % 0 give 0, x / -1 wraps and x % -1 is 0; idiv would trap on both
+    void divide(const BytebeatInstruction& in) {
+        bool mod = in.op == BytebeatOp::Mod;
+        load(EAX, in.x);
+        load(ECX, in.y);
+        emit({0x85, 0xC9});  // test ecx, ecx
+        size_t zero = jump(0x74);
+        emit({0x83, 0xF9, 0xFF});  // cmp ecx, -1
+        size_t minusOne = jump(0x74);
+        emit({0x99});        // cdq
+        emit({0xF7, 0xF9});  // idiv ecx
+        if (mod)
+            emit({0x89, 0xD0});  // mov eax, edx
+        size_t done = jump(0xEB);
+        patch(minusOne);
+        if (mod)
+            emit({0x31, 0xC0});  // xor eax, eax
+        else
+            emit({0xF7, 0xD8});  // neg eax
+        size_t doneMinusOne = jump(0xEB);
+        patch(zero);
+        emit({0x31, 0xC0});  // xor eax, eax
+        patch(done);
+        patch(doneMinusOne);
+    }
+
+    // Shift amount k in [1, 30], as produced by BytebeatOptimizer
+    void dividePow2(const BytebeatInstruction& in) {
+        uint8_t k = (uint8_t)in.value;
+        load(EAX, in.x);
+        emit({0x89, 0xC2});                     // mov edx, eax
+        emit({0xC1, 0xFA, 31});                 // sar edx, 31
+        emit({0xC1, 0xEA, (uint8_t)(32 - k)});  // shr edx, 32 - k
+        emit({0x01, 0xD0});                     // add eax, edx
+        emit({0xC1, 0xF8, k});                  // sar eax, k
+        if (in.op == BytebeatOp::ModPow2) {
+            emit({0xC1, 0xE0, k});  // shl eax, k
+            load(ECX, in.x);
+            emit({0x29, 0xC1});  // sub ecx, eax
+            emit({0x89, 0xC8});  // mov eax, ecx
+        }
+    }
+
+    // Copies code into fresh memory and makes it executable (never writable and
+    // executable at the same time)
+    static std::shared_ptr<void> allocate(const std::vector<uint8_t>& code) {
+        size_t size = code.size();
+#if defined(_WIN32)
+        void* memory = VirtualAlloc(nullptr, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (!memory)
+            return nullptr;
+        std::copy(code.begin(), code.end(), (uint8_t*)memory);
+        DWORD previous;
+        if (!VirtualProtect(memory, size, PAGE_EXECUTE_READ, &previous)) {
+            VirtualFree(memory, 0, MEM_RELEASE);
+            return nullptr;
+        }
+        FlushInstructionCache(GetCurrentProcess(), memory, size);
+        return std::shared_ptr<void>(memory, [](void* p) { VirtualFree(p, 0, MEM_RELEASE); });
+#else
+        void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            return nullptr;
+        std::copy(code.begin(), code.end(), (uint8_t*)memory);
+        if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+            munmap(memory, size);
+            return nullptr;
+        }
+        return std::shared_ptr<void>(memory, [size](void* p) { munmap(p, size); });
+#endif
+    }
+#endif
+};
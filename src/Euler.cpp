@@ -1,6 +1,181 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "FastMath.hpp"
 #include "components.hpp"
 #include "plugin.hpp"
 
+// Smooths a signal over a window of up to a second, in constant memory.
+//
+// The moving average subtracts the cumulative sum of the input at the start of
+// the window from the current one. The input is summed in fixed point, whose
+// sums wrap without losing precision, so the average never drifts. Cumulative
+// sums are kept at every sample and every 4, 16, ... 4096 samples, the last 256
+// of each. A window reads the coarsest level that still has 32 blocks inside
+// it and interpolates within the block where it starts, which is exact for
+// windows under 128 samples. One-pole and two-pole lowpasses with the same
+// mean delay as the window are the alternatives with no history.
+struct Smoother {
+    enum Type {
+        MOVING_AVERAGE,
+        ONE_POLE,
+        TWO_POLE
+    };
+
+    static constexpr int LEVELS = 7;
+    static constexpr int LEVEL_SHIFT = 2;
+    static constexpr int MIN_BLOCKS = 32;
+    // Holds a window of up to MIN_BLOCKS << LEVEL_SHIFT blocks and the partial
+    // blocks at each end, a power of two for masking
+    static constexpr int LEVEL_BLOCKS = 256;
+    static constexpr double STEPS_PER_VOLT = 16777216.0;
+
+    // sums[l][j & (LEVEL_BLOCKS - 1)] is the sum of the first j << (l * LEVEL_SHIFT)
+    // samples
+    uint64_t sums[LEVELS][LEVEL_BLOCKS] = {};
+    uint64_t runningSum = 0;
+    int64_t samples = 0;
+
+    double pole1 = 0.0;
+    double pole2 = 0.0;
+    int poleWindow = 0;
+    int poleType = MOVING_AVERAGE;
+    double poleCoefficient = 1.0;
+
+    void reset() {
+        std::fill(&sums[0][0], &sums[0][0] + LEVELS * LEVEL_BLOCKS, 0);
+        runningSum = 0;
+        samples = 0;
+        pole1 = 0.0;
+        pole2 = 0.0;
+    }
+
+    // Longest window in samples
+    static int getMaxWindow() {
+        return (LEVEL_BLOCKS - 4) << ((LEVELS - 1) * LEVEL_SHIFT);
+    }
+
+    // Sum of the first k samples from level l, the history before the first
+    // sample is 0. Between the ends of a block the sum follows a Catmull-Rom
+    // spline through the neighbouring block sums, so that the sum of a smooth
+    // signal stays smooth and its slope is close to the exact one.
+    uint64_t getSum(int64_t k, int l) {
+        if (k <= 0) return 0;
+        int shift = l * LEVEL_SHIFT;
+        int64_t j = k >> shift;
+        int64_t r = k & (((int64_t)1 << shift) - 1);
+        const int mask = LEVEL_BLOCKS - 1;
+        uint64_t s0 = sums[l][j & mask];
+        if (r == 0) return s0;
+        // Levels above the first are only read at least MIN_BLOCKS back, so
+        // the next two blocks are complete
+        double p = (double)(int64_t)(sums[l][(j - 1) & mask] - s0);
+        double n1 = (double)(int64_t)(sums[l][(j + 1) & mask] - s0);
+        double n2 = (double)(int64_t)(sums[l][(j + 2) & mask] - s0);
+        double t = std::ldexp((double)r, -shift);
+        double y = 0.5 * t * ((n1 - p) + t * ((2.0 * p + 4.0 * n1 - n2) + t * (n2 - p - 3.0 * n1)));
+        return s0 + (uint64_t)(int64_t)std::floor(y + 0.5);
+    }
+
+    // Adds x and returns it smoothed over window samples, x itself for a
+    // window shorter than a sample
+    double process(double x, int window, int type) {
+        for (int l = 0; l < LEVELS; l++) {
+            int shift = l * LEVEL_SHIFT;
+            if ((samples & (((int64_t)1 << shift) - 1)) == 0) {
+                sums[l][(samples >> shift) & (LEVEL_BLOCKS - 1)] = runningSum;
+            }
+        }
+        runningSum += (uint64_t)(int64_t)std::floor(clamp(x, -100.0, 100.0) * STEPS_PER_VOLT + 0.5);
+        samples++;
+
+        window = std::min(window, getMaxWindow());
+        if (window != poleWindow || type != poleType) {
+            poleWindow = window;
+            poleType = type;
+            // One pole of time constant window / 2, or two of window / 4,
+            // delay by window / 2 on average like the moving average
+            float tau = (type == TWO_POLE) ? 0.25f * window : 0.5f * window;
+            poleCoefficient = (window >= 1) ? 1.0 - std::exp(-1.0 / tau) : 1.0;
+        }
+        pole1 += poleCoefficient * (x - pole1);
+        pole2 += poleCoefficient * (pole1 - pole2);
+
+        if (window < 1) return x;
+        switch (type) {
+            case ONE_POLE:
+                return pole1;
+            case TWO_POLE:
+                return pole2;
+            default: {
+                int l = 0;
+                while (l + 1 < LEVELS && window >= (MIN_BLOCKS << ((l + 1) * LEVEL_SHIFT))) {
+                    l++;
+                }
+                return (double)(int64_t)(runningSum - getSum(samples - window, l)) / (STEPS_PER_VOLT * window);
+            }
+        }
+    }
+};
+
+struct Euler;
+
+// Allocates the smoothers of channels added to Euler instances off the engine
+// thread, so they arrive without a widget, e.g. in headless Rack. The worker
+// runs while any instance exists.
+struct EulerSmootherWorker {
+    // How often the worker looks for requests
+    static constexpr int WORKER_PERIOD_MS = 5;
+
+    // Serializes adding and removing instances, so the worker is started and
+    // joined in order
+    std::mutex instancesChangeMutex;
+    // Guards instances, held by the worker while it serves them
+    std::mutex instancesMutex;
+    std::condition_variable instancesChanged;
+    std::vector<Euler*> instances;
+    std::thread worker;
+
+    void addInstance(Euler* module) {
+        std::lock_guard<std::mutex> changeLock(instancesChangeMutex);
+        bool start;
+        {
+            std::lock_guard<std::mutex> lock(instancesMutex);
+            instances.push_back(module);
+            start = instances.size() == 1;
+        }
+        if (start)
+            worker = std::thread(&EulerSmootherWorker::run, this);
+    }
+
+    // Once this returns, the worker no longer touches module
+    void removeInstance(Euler* module) {
+        std::lock_guard<std::mutex> changeLock(instancesChangeMutex);
+        bool stop;
+        {
+            std::lock_guard<std::mutex> lock(instancesMutex);
+            instances.erase(std::remove(instances.begin(), instances.end(), module), instances.end());
+            stop = instances.empty();
+        }
+        if (stop) {
+            instancesChanged.notify_all();
+            worker.join();
+        }
+    }
+
+    void run();
+
+    static EulerSmootherWorker& get() {
+        static EulerSmootherWorker worker;
+        return worker;
+    }
+};
+
 struct Euler : Module {
     enum ParamId {
         FREQ_PARAM,
@@ -24,28 +199,21 @@ struct Euler : Module {
         LIGHTS_LEN
     };
 
-    double previousVoltage = 0.f;
-    double currentValue = 0.f;
+    // Channel c is lane c % 4 of group c / 4
+    simd::float_4 previousVoltage[4] = {};
+    simd::float_4 currentValue[4] = {};
+    // Every channel is sampled on the same step, the window depends on FREQ
+    // only
     int step = 0;
-    int smoothStep = 0;
+    int channels = 0;
     dsp::ClockDivider lightDivider;
-    float *steps;
-    float average = 0.f;
-    int _sampleRate;
-
-    float calculateMovingAverage(const float *steps, float average, int size, int step, int windowLength) {
-        return average + (steps[step % size] - steps[((step - windowLength + 1 + size) % size)]) / windowLength;
-    }
-
-    float pos(float signal) {
-        if (signal > 0.f) return signal;
-        return 0.f;
-    }
-
-    float neg(float signal) {
-        if (signal < 0.f) return -signal;
-        return 0.f;
-    }
+    // Smoothers of the channels used so far, about 14 KB of history each. The
+    // first is allocated with the module. For added channels process() raises
+    // requestedChannels and the worker of EulerSmootherWorker allocates theirs;
+    // until it arrives, a few ms later, a channel is measured unsmoothed.
+    std::atomic<Smoother*> smoothers[PORT_MAX_CHANNELS];
+    std::atomic<int> requestedChannels{1};
+    int smoothingType = Smoother::MOVING_AVERAGE;
 
     Euler() {
         config(PARAMS_LEN, INPUTS_LEN, OUTPUTS_LEN, LIGHTS_LEN);
@@ -57,61 +225,125 @@ struct Euler : Module {
         configOutput(SLOPE_POS_OUTPUT, "Positive part of the angle");
         configOutput(SLOPE_NEG_OUTPUT, "Negative part of the angle");
         lightDivider.setDivision(16);
-        _sampleRate = (int)APP->engine->getSampleRate();
-        steps = new float[_sampleRate];
+
+        smoothers[0].store(new Smoother);
+        for (int c = 1; c < PORT_MAX_CHANNELS; c++) {
+            smoothers[c].store(nullptr);
+        }
+        EulerSmootherWorker::get().addInstance(this);
+    }
+
+    ~Euler() {
+        EulerSmootherWorker::get().removeInstance(this);
+        for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+            delete smoothers[c].load();
+        }
+    }
+
+    // Worker thread, see EulerSmootherWorker
+    void allocateSmoothers() {
+        int requested = requestedChannels.load(std::memory_order_relaxed);
+        for (int c = 0; c < requested; c++) {
+            if (!smoothers[c].load(std::memory_order_relaxed))
+                smoothers[c].store(new Smoother, std::memory_order_release);
+        }
     }
 
     void onSampleRateChange() override {
-        delete[] steps;
-        _sampleRate = (int)APP->engine->getSampleRate();
-        steps = new float[_sampleRate];
-        average = 0.f;
-        smoothStep = 0;
+        for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+            Smoother* smoother = smoothers[c].load(std::memory_order_acquire);
+            if (smoother)
+                smoother->reset();
+        }
         step = 0;
     }
 
     void process(const ProcessArgs &args) override {
-        double voltage = inputs[SIGNAL_INPUT].getVoltage();
-        double pitch = params[FREQ_PARAM].getValue();
+        float pitch = params[FREQ_PARAM].getValue();
         double smooth = params[SMOOTH_PARAM].getValue();
-        double freq = std::pow(2.f, pitch);
+        float freq = fastmath::exp2(pitch);
+        int smoothWindow = (int)(smooth * args.sampleRate);
+
+        // Added channels start from silence, like their smoothing history
+        int newChannels = std::max(1, inputs[SIGNAL_INPUT].getChannels());
+        for (int c = channels; c < newChannels; c++) {
+            Smoother* smoother = smoothers[c].load(std::memory_order_acquire);
+            if (smoother)
+                smoother->reset();
+            previousVoltage[c / 4][c % 4] = 0.f;
+            currentValue[c / 4][c % 4] = 0.f;
+        }
+        channels = newChannels;
+        if (channels > requestedChannels.load(std::memory_order_relaxed))
+            requestedChannels.store(channels, std::memory_order_relaxed);
 
-        steps[smoothStep] = voltage;
-        if (smooth * _sampleRate >= 1.f) {
-            average = calculateMovingAverage(steps, average, _sampleRate, smoothStep, (int)(smooth * _sampleRate));
-            voltage = average;
+        alignas(16) float voltages[PORT_MAX_CHANNELS] = {};
+        for (int c = 0; c < channels; c++) {
+            float voltage = inputs[SIGNAL_INPUT].getVoltage(c);
+            Smoother* smoother = smoothers[c].load(std::memory_order_acquire);
+            voltages[c] = smoother ? (float)smoother->process(voltage, smoothWindow, smoothingType) : voltage;
         }
 
         // sampling window affects precision on low frequencies
         int window = (int)clamp(2.f / freq, 1, 1024);
 
         if (step % window == 0) {
-            double diff = voltage - previousVoltage;
-            double angle = std::atan2(diff, window * args.sampleTime * 31.5 * freq) * 180 / M_PI;
-            currentValue = 10.f * angle / 90.f;
-            previousVoltage = voltage;
+            float run = window * args.sampleTime * 31.5f * freq;
+            for (int c = 0; c < channels; c += 4) {
+                int g = c / 4;
+                simd::float_4 voltage = simd::float_4::load(voltages + c);
+                // Angle in degrees times 10 / 90, so that 90 degrees is 10V
+                currentValue[g] = fastmath::atan2(voltage - previousVoltage[g], simd::float_4(run)) * (float)(20.0 / M_PI);
+                previousVoltage[g] = voltage;
+            }
         }
 
-        outputs[SLOPE_OUTPUT].setVoltage(currentValue);
-        outputs[SLOPE_ABS_OUTPUT].setVoltage(std::abs(currentValue));
-        outputs[SLOPE_POS_OUTPUT].setVoltage(pos(currentValue));
-        outputs[SLOPE_NEG_OUTPUT].setVoltage(neg(currentValue));
+        for (int c = 0; c < channels; c += 4) {
+            int g = c / 4;
+            outputs[SLOPE_OUTPUT].setVoltageSimd(currentValue[g], c);
+            outputs[SLOPE_ABS_OUTPUT].setVoltageSimd(simd::abs(currentValue[g]), c);
+            outputs[SLOPE_POS_OUTPUT].setVoltageSimd(simd::fmax(currentValue[g], 0.f), c);
+            outputs[SLOPE_NEG_OUTPUT].setVoltageSimd(simd::fmax(-currentValue[g], 0.f), c);
+        }
+        outputs[SLOPE_OUTPUT].setChannels(channels);
+        outputs[SLOPE_ABS_OUTPUT].setChannels(channels);
+        outputs[SLOPE_POS_OUTPUT].setChannels(channels);
+        outputs[SLOPE_NEG_OUTPUT].setChannels(channels);
 
         step += 1;
         step = step % window;
 
-        smoothStep += 1;
-        smoothStep = smoothStep % _sampleRate;
-
-        // LIGHT
+        // LIGHT, follows the first channel
         if (lightDivider.process()) {
             float lightTime = args.sampleTime * lightDivider.getDivision();
-            lights[SIG_LIGHT_POS].setBrightnessSmooth(fmaxf(0.0f, currentValue / 10.f), lightTime);
-            lights[SIG_LIGHT_NEG].setBrightnessSmooth(fmaxf(0.0f, -currentValue / 10.f), lightTime);
+            lights[SIG_LIGHT_POS].setBrightnessSmooth(fmaxf(0.0f, currentValue[0][0] / 10.f), lightTime);
+            lights[SIG_LIGHT_NEG].setBrightnessSmooth(fmaxf(0.0f, -currentValue[0][0] / 10.f), lightTime);
         }
     }
+
+    json_t *dataToJson() override {
+        json_t *rootJ = json_object();
+        json_object_set_new(rootJ, "smoothingType", json_integer(smoothingType));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t *rootJ) override {
+        json_t *smoothingTypeJ = json_object_get(rootJ, "smoothingType");
+        if (smoothingTypeJ)
+            smoothingType = clamp((int)json_integer_value(smoothingTypeJ), 0, 2);
+    }
 };
 
+void EulerSmootherWorker::run() {
+    std::unique_lock<std::mutex> lock(instancesMutex);
+    while (!instances.empty()) {
+        for (Euler* module : instances) {
+            module->allocateSmoothers();
+        }
+        instancesChanged.wait_for(lock, std::chrono::milliseconds(WORKER_PERIOD_MS));
+    }
+}
+
 struct EulerWidget : ModuleWidget {
     EulerWidget(Euler *module) {
         setModule(module);
@@ -132,6 +364,15 @@ struct EulerWidget : ModuleWidget {
         addOutput(createOutputCentered<ThemedPJ301MPort>(Vec(21, 330.01), module, Euler::SLOPE_POS_OUTPUT));
         addOutput(createOutputCentered<ThemedPJ301MPort>(Vec(54, 330.01), module, Euler::SLOPE_NEG_OUTPUT));
     }
+
+    void appendContextMenu(Menu *menu) override {
+        Euler *module = dynamic_cast<Euler *>(this->module);
+        assert(module);
+        menu->addChild(new MenuSeparator);
+        menu->addChild(createIndexPtrSubmenuItem("Smoothing",
+                                                 {"Moving average", "One-pole", "Two-pole"},
+                                                 &module->smoothingType));
+    }
 };
 
 Model *modelEuler = createModel<Euler, EulerWidget>("Euler");
\ No newline at end of file
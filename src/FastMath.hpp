@@ -0,0 +1,183 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include <rack.hpp>
+
+// Polynomial approximations for audio-rate code, each for float and
+// simd::float_4. Maximum errors against libm over the stated domains:
+//
+//   exp2(x)     x in (-126, 126]             relative error < 2e-7
+//   log2(x)     x normal and positive        absolute error < 1.2e-7 * max(1, |log2(x)|)
+//   pow(x, y)   x normal and positive,       relative error < 2e-7 + 1.4e-7 * |y| * max(1, |log2(x)|)
+//               |y * log2(x)| < 126
+//               x <= 0 gives 0
+//   tanhPade(x) all x                        absolute error < 1.1e-2, exact at 0,
+//               constant at +-0.98974 from |x| = 2 * sqrt(3)
+//   atan2(y, x) all x, y except (0, 0)       absolute error < 2e-6 rad
+//
+// The float and float_4 versions give the same results. bench/FastMathCheck.cpp
+// measures the errors.
+namespace fastmath {
+
+namespace detail {
+
+inline float floor(float x) {
+    return std::floor(x);
+}
+
+inline rack::simd::float_4 floor(rack::simd::float_4 x) {
+    return rack::simd::floor(x);
+}
+
+inline float fmax(float a, float b) {
+    return (a > b) ? a : b;
+}
+
+inline rack::simd::float_4 fmax(rack::simd::float_4 a, rack::simd::float_4 b) {
+    return rack::simd::fmax(a, b);
+}
+
+inline float clamp(float x, float a, float b) {
+    return (x < a) ? a : ((x > b) ? b : x);
+}
+
+inline rack::simd::float_4 clamp(rack::simd::float_4 x, rack::simd::float_4 a, rack::simd::float_4 b) {
+    return rack::simd::clamp(x, a, b);
+}
+
+inline float abs(float x) {
+    return std::fabs(x);
+}
+
+inline rack::simd::float_4 abs(rack::simd::float_4 x) {
+    return rack::simd::abs(x);
+}
+
+// |a| with the sign of b
+inline float copysign(float a, float b) {
+    return std::copysign(a, b);
+}
+
+inline rack::simd::float_4 copysign(rack::simd::float_4 a, rack::simd::float_4 b) {
+    rack::simd::float_4 sign = -0.f;
+    return rack::simd::abs(a) | (b & sign);
+}
+
+inline float ifelse(bool mask, float a, float b) {
+    return mask ? a : b;
+}
+
+inline rack::simd::float_4 ifelse(rack::simd::float_4 mask, rack::simd::float_4 a, rack::simd::float_4 b) {
+    return rack::simd::ifelse(mask, a, b);
+}
+
+// 2^n for integral n in [-126, 127]
+inline float exp2Integer(float n) {
+    int32_t bits = ((int32_t)n + 127) << 23;
+    float result;
+    std::memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+inline rack::simd::float_4 exp2Integer(rack::simd::float_4 n) {
+    return rack::simd::float_4::cast((rack::simd::int32_4(n) + 127) << 23);
+}
+
+// Splits normal positive x into x = m * 2^e with m in [1, 2)
+inline void split(float x, float& m, float& e) {
+    int32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    e = (float)(((bits >> 23) & 0xff) - 127);
+    bits = (bits & 0x7fffff) | 0x3f800000;
+    std::memcpy(&m, &bits, sizeof(m));
+}
+
+inline void split(rack::simd::float_4 x, rack::simd::float_4& m, rack::simd::float_4& e) {
+    rack::simd::int32_4 bits = rack::simd::int32_4::cast(x);
+    e = rack::simd::float_4(((bits >> 23) & 0xff) - 127);
+    m = rack::simd::float_4::cast((bits & 0x7fffff) | 0x3f800000);
+}
+
+}  // namespace detail
+
+// 2^x. Minimax polynomial for the fraction, exponent bits for the integer part.
+template <typename T>
+T exp2(T x) {
+    x = detail::clamp(x, -126.f, 126.f);
+    T xi = detail::floor(x);
+    T f = x - xi;
+    T p = 1.877576700e-03f;
+    p = p * f + 8.989340024e-03f;
+    p = p * f + 5.582631812e-02f;
+    p = p * f + 2.401536170e-01f;
+    p = p * f + 6.931530732e-01f;
+    p = p * f + 9.999999251e-01f;
+    return p * detail::exp2Integer(xi);
+}
+
+// log2(x) for normal positive x. Reduces to m in [sqrt(1/2), sqrt(2)) and
+// sums the atanh series of t = (m - 1) / (m + 1) up to t^9.
+template <typename T>
+T log2(T x) {
+    T m, e;
+    detail::split(x, m, e);
+    auto large = m > 1.41421356f;
+    m = detail::ifelse(large, m * 0.5f, m);
+    e = detail::ifelse(large, e + 1.f, e);
+    T t = (m - 1.f) / (m + 1.f);
+    T t2 = t * t;
+    T p = 2.885390082f / 9.f;
+    p = p * t2 + 2.885390082f / 7.f;
+    p = p * t2 + 2.885390082f / 5.f;
+    p = p * t2 + 2.885390082f / 3.f;
+    p = p * t2 + 2.885390082f;
+    return e + t * p;
+}
+
+// x^y for x > 0, 0 for x <= 0
+template <typename T>
+T pow(T x, T y) {
+    // Smallest normal float, log2() needs normal x
+    T result = fastmath::exp2(y * fastmath::log2(detail::fmax(x, 1.17549435e-38f)));
+    return detail::ifelse(x > 0.f, result, T(0.f));
+}
+
+// The Pade approximant of tanh used by the Ripples OTA model
+template <typename T>
+T tanhPade(T x) {
+    const float kZlim = 2.f * std::sqrt(3.f);
+    T z = detail::clamp(x, -kZlim, kZlim);
+    T z2 = z * z;
+    T q = 12.f + z2;
+    return 12.f * z * q / (36.f * z2 + q * q);
+}
+
+// atan2(y, x) in radians. Odd minimax polynomial for atan on [0, 1] and
+// octant reconstruction.
+template <typename T>
+T atan2(T y, T x) {
+    T ax = detail::abs(x);
+    T ay = detail::abs(y);
+    auto swap = ay > ax;
+    T num = detail::ifelse(swap, ax, ay);
+    T den = detail::ifelse(swap, ay, ax);
+    // Smallest normal float, so that a <= 1 whenever den is normal
+    T a = num / detail::fmax(den, 1.17549435e-38f);
+    T s = a * a;
+    T p = -1.171913820e-02f;
+    p = p * s + 5.264735790e-02f;
+    p = p * s - 1.164264880e-01f;
+    p = p * s + 1.935403786e-01f;
+    p = p * s - 3.326228283e-01f;
+    p = p * s + 9.999772191e-01f;
+    T r = p * a;
+    r = detail::ifelse(swap, (float)M_PI_2 - r, r);
+    r = detail::ifelse(x < 0.f, (float)M_PI - r, r);
+    // Sign of y, also that of -0 like std::atan2
+    return detail::copysign(r, y);
+}
+
+}  // namespace fastmath
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+#include <rack.hpp>
+
+// Opt-in timing of the DSP stages of a module, so that quality settings can be
+// tuned from real patches. Building with `make PROFILE=1` defines
+// CELLA_PROFILE. Without it Profiler is empty, appendProfilerMenu() adds
+// nothing and the scopes compile to nothing.
+//
+// A module owns a Profiler, names its stages in its constructor, counts the
+// frames it processes and times a stage with a scope:
+//
+//     CELLA_PROFILE_SCOPE(&profiler, EVALUATE_STAGE);
+//
+// Time spent in a scope opened inside another is counted for the inner stage
+// only. Each stage is written by one thread, the engine thread for audio
+// stages, and read by the menu with relaxed atomics, so nothing locks. The
+// cost of reading the clock is measured once and taken off every scope.
+#ifdef CELLA_PROFILE
+
+struct Profiler {
+    static constexpr int MAX_STAGES = 4;
+
+    struct Stage {
+        const char* name = "";
+        // Audio stages are reported per processed sample, others per call
+        bool audio = true;
+        // Value of Profiler::generation when the stage was last cleared
+        std::atomic<int> generation{0};
+        std::atomic<uint64_t> calls{0};
+        std::atomic<uint64_t> nanoseconds{0};
+        std::atomic<uint64_t> worstNanoseconds{0};
+    };
+
+    Stage stages[MAX_STAGES];
+    int stageCount = 0;
+    // Frames processed by the module, counted on the engine thread
+    std::atomic<uint64_t> samples{0};
+    std::atomic<int> samplesGeneration{0};
+    // Bumped by reset(). Writers clear what they own once they see it change,
+    // so every counter keeps a single writer.
+    std::atomic<int> generation{0};
+
+    // Constructor only
+    void addStage(const char* name, bool audio = true) {
+        if (stageCount == MAX_STAGES)
+            return;
+        stages[stageCount].name = name;
+        stages[stageCount].audio = audio;
+        stageCount++;
+    }
+
+    // Engine thread
+    void addSamples(int frames) {
+        int g = generation.load(std::memory_order_relaxed);
+        uint64_t total = samples.load(std::memory_order_relaxed);
+        if (samplesGeneration.load(std::memory_order_relaxed) != g) {
+            samplesGeneration.store(g, std::memory_order_relaxed);
+            total = 0;
+        }
+        samples.store(total + frames, std::memory_order_relaxed);
+    }
+
+    // Thread that writes the stage
+    void add(int index, int64_t elapsed) {
+        Stage& stage = stages[index];
+        uint64_t ns = (uint64_t)std::max<int64_t>(elapsed, 0);
+        int g = generation.load(std::memory_order_relaxed);
+        uint64_t calls = stage.calls.load(std::memory_order_relaxed);
+        uint64_t total = stage.nanoseconds.load(std::memory_order_relaxed);
+        uint64_t worst = stage.worstNanoseconds.load(std::memory_order_relaxed);
+        if (stage.generation.load(std::memory_order_relaxed) != g) {
+            stage.generation.store(g, std::memory_order_relaxed);
+            calls = total = worst = 0;
+        }
+        stage.calls.store(calls + 1, std::memory_order_relaxed);
+        stage.nanoseconds.store(total + ns, std::memory_order_relaxed);
+        stage.worstNanoseconds.store(std::max(worst, ns), std::memory_order_relaxed);
+    }
+
+    // Any thread
+    void reset() {
+        generation.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint64_t getSamples() const {
+        if (samplesGeneration.load(std::memory_order_relaxed) != generation.load(std::memory_order_relaxed))
+            return 0;
+        return samples.load(std::memory_order_relaxed);
+    }
+
+    // Counters of a stage, zero until its writer has seen the last reset
+    void getStage(int index, uint64_t& calls, uint64_t& ns, uint64_t& worst) const {
+        const Stage& stage = stages[index];
+        calls = ns = worst = 0;
+        if (stage.generation.load(std::memory_order_relaxed) != generation.load(std::memory_order_relaxed))
+            return;
+        calls = stage.calls.load(std::memory_order_relaxed);
+        ns = stage.nanoseconds.load(std::memory_order_relaxed);
+        worst = stage.worstNanoseconds.load(std::memory_order_relaxed);
+    }
+
+    // One line per stage, e.g. "Core: 412 ns/sample, worst call 9.8 us"
+    std::string getText(int index) const {
+        uint64_t calls, ns, worst;
+        getStage(index, calls, ns, worst);
+        const Stage& stage = stages[index];
+        if (stage.audio) {
+            uint64_t frames = getSamples();
+            return rack::string::f("%s: %.0f ns/sample, worst call %.1f us", stage.name,
+                                   frames ? (double)ns / frames : 0.0, worst * 1e-3);
+        }
+        return rack::string::f("%s: %llu calls, %.1f us each, worst %.1f us", stage.name, (unsigned long long)calls,
+                               calls ? ns * 1e-3 / calls : 0.0, worst * 1e-3);
+    }
+
+    json_t* toJson() const {
+        json_t* rootJ = json_object();
+        uint64_t frames = getSamples();
+        json_object_set_new(rootJ, "samples", json_integer((json_int_t)frames));
+        json_t* stagesJ = json_array();
+        for (int i = 0; i < stageCount; i++) {
+            uint64_t calls, ns, worst;
+            getStage(i, calls, ns, worst);
+            json_t* stageJ = json_object();
+            json_object_set_new(stageJ, "name", json_string(stages[i].name));
+            json_object_set_new(stageJ, "calls", json_integer((json_int_t)calls));
+            json_object_set_new(stageJ, "nanoseconds", json_integer((json_int_t)ns));
+            json_object_set_new(stageJ, "worstNanoseconds", json_integer((json_int_t)worst));
+            if (stages[i].audio)
+                json_object_set_new(stageJ, "nanosecondsPerSample", json_real(frames ? (double)ns / frames : 0.0));
+            json_array_append_new(stagesJ, stageJ);
+        }
+        json_object_set_new(rootJ, "stages", stagesJ);
+        return rootJ;
+    }
+
+    // Nanoseconds between two back-to-back clock reads, measured once
+    static int64_t getClockCost() {
+        static const int64_t cost = [] {
+            int64_t best = INT64_MAX;
+            for (int i = 0; i < 1000; i++) {
+                int64_t start = rack::system::getNanoseconds();
+                best = std::min(best, rack::system::getNanoseconds() - start);
+            }
+            return best;
+        }();
+        return cost;
+    }
+};
+
+struct ProfilerScope {
+    Profiler* profiler;
+    int stage;
+    int64_t start = 0;
+    // Time of the scopes opened inside this one, clock reads included
+    int64_t nested = 0;
+    ProfilerScope* parent = nullptr;
+
+    // Innermost open scope of the calling thread
+    static ProfilerScope*& current() {
+        static thread_local ProfilerScope* scope = nullptr;
+        return scope;
+    }
+
+    ProfilerScope(Profiler* profiler, int stage) : profiler(profiler), stage(stage) {
+        if (!profiler)
+            return;
+        parent = current();
+        current() = this;
+        start = rack::system::getNanoseconds();
+    }
+
+    ~ProfilerScope() {
+        if (!profiler)
+            return;
+        int64_t elapsed = rack::system::getNanoseconds() - start - Profiler::getClockCost();
+        profiler->add(stage, elapsed - nested);
+        if (parent)
+            parent->nested += elapsed + Profiler::getClockCost();
+        current() = parent;
+    }
+};
+
+#define CELLA_PROFILE_CONCAT2(a, b) a##b
+#define CELLA_PROFILE_CONCAT(a, b) CELLA_PROFILE_CONCAT2(a, b)
+#define CELLA_PROFILE_SCOPE(profiler, stage) ProfilerScope CELLA_PROFILE_CONCAT(profilerScope, __LINE__)(profiler, stage)
+
+// Adds a Profile submenu with one line per stage, and items to copy the
+// counters as JSON and to start over
+inline void appendProfilerMenu(rack::ui::Menu* menu, Profiler* profiler) {
+    menu->addChild(new rack::ui::MenuSeparator);
+    menu->addChild(rack::createSubmenuItem("Profile", "", [=](rack::ui::Menu* menu) {
+        for (int i = 0; i < profiler->stageCount; i++) {
+            menu->addChild(rack::createMenuLabel(profiler->getText(i)));
+        }
+        menu->addChild(new rack::ui::MenuSeparator);
+        menu->addChild(rack::createMenuItem("Copy as JSON", "", [=]() {
+            json_t* rootJ = profiler->toJson();
+            char* text = json_dumps(rootJ, JSON_INDENT(2));
+            json_decref(rootJ);
+            if (text) {
+                glfwSetClipboardString(APP->window->win, text);
+                std::free(text);
+            }
+        }));
+        menu->addChild(rack::createMenuItem("Reset", "", [=]() { profiler->reset(); }));
+    }));
+}
+
+#else
+
+struct Profiler {
+    void addStage(const char* name, bool audio = true) {}
+    void addSamples(int frames) {}
+};
+
+inline void appendProfilerMenu(rack::ui::Menu* menu, Profiler* profiler) {}
+
+#define CELLA_PROFILE_SCOPE(profiler, stage)
+
+#endif
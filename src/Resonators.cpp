@@ -1,8 +1,139 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <utility>
 #include <vector>
 
+#include "BlockBuffer.hpp"
+#include "Profiler.hpp"
+#include "ResonatorsBank.hpp"
 #include "components.hpp"
 #include "plugin.hpp"
 
+// Size of the delay memory of one Resonators instance: banks banks of 4 lines,
+// frames samples each
+struct ResonatorsArenaSize {
+    int frames;
+    int banks;
+};
+
+struct ResonatorsDelayArena {
+    int frames = 0;
+    int banks = 0;
+    std::vector<float> data;
+};
+
+struct Resonators;
+
+// All Resonators instances take their delay memory from one pool, so memory given
+// back when an instance grows or is removed is reused by the next one. Never used
+// from process().
+//
+// The pool also runs the worker thread that serves the instances' requests for
+// larger arenas, so lines grow without a widget, e.g. in headless Rack. The worker
+// runs while any instance exists.
+struct ResonatorsArenaPool {
+    // Free arenas kept per size
+    static constexpr size_t MAX_FREE = 4;
+    // How often the worker looks for requests
+    static constexpr int WORKER_PERIOD_MS = 5;
+
+    std::mutex mutex;
+    std::map<std::pair<int, int>, std::vector<ResonatorsDelayArena*>> freeArenas;
+
+    // Serializes adding and removing instances, so the worker is started and
+    // joined in order
+    std::mutex instancesChangeMutex;
+    // Guards instances, held by the worker while it serves them
+    std::mutex instancesMutex;
+    std::condition_variable instancesChanged;
+    std::vector<Resonators*> instances;
+    std::thread worker;
+
+    ~ResonatorsArenaPool() {
+        for (auto& entry : freeArenas) {
+            for (ResonatorsDelayArena* arena : entry.second) {
+                delete arena;
+            }
+        }
+    }
+
+    // Returns a zeroed arena
+    ResonatorsDelayArena* acquire(ResonatorsArenaSize size) {
+        ResonatorsDelayArena* arena = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<ResonatorsDelayArena*>& arenas = freeArenas[std::make_pair(size.frames, size.banks)];
+            if (!arenas.empty()) {
+                arena = arenas.back();
+                arenas.pop_back();
+            }
+        }
+        if (arena) {
+            std::fill(arena->data.begin(), arena->data.end(), 0.f);
+        } else {
+            arena = new ResonatorsDelayArena;
+            arena->frames = size.frames;
+            arena->banks = size.banks;
+            arena->data.resize(size.banks * 4 * size.frames, 0.f);
+        }
+        return arena;
+    }
+
+    void release(ResonatorsDelayArena* arena) {
+        if (!arena)
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            std::vector<ResonatorsDelayArena*>& arenas = freeArenas[std::make_pair(arena->frames, arena->banks)];
+            if (arenas.size() < MAX_FREE) {
+                arenas.push_back(arena);
+                return;
+            }
+        }
+        delete arena;
+    }
+
+    void addInstance(Resonators* module) {
+        std::lock_guard<std::mutex> changeLock(instancesChangeMutex);
+        bool start;
+        {
+            std::lock_guard<std::mutex> lock(instancesMutex);
+            instances.push_back(module);
+            start = instances.size() == 1;
+        }
+        if (start)
+            worker = std::thread(&ResonatorsArenaPool::run, this);
+    }
+
+    // Once this returns, the worker no longer touches module
+    void removeInstance(Resonators* module) {
+        std::lock_guard<std::mutex> changeLock(instancesChangeMutex);
+        bool stop;
+        {
+            std::lock_guard<std::mutex> lock(instancesMutex);
+            instances.erase(std::remove(instances.begin(), instances.end(), module), instances.end());
+            stop = instances.empty();
+        }
+        if (stop) {
+            instancesChanged.notify_all();
+            worker.join();
+        }
+    }
+
+    void run();
+
+    static ResonatorsArenaPool& get() {
+        static ResonatorsArenaPool pool;
+        return pool;
+    }
+};
+
 struct Resonators : Module {
     enum ParamIds {
         PITCH1_PARAM,
@@ -44,21 +175,78 @@ struct Resonators : Module {
         NUM_LIGHTS
     };
 
-    // Variables for filters
-    std::vector<dsp::RCFilter> lowPassFilter;
-    std::vector<dsp::RCFilter> highPassFilter;
-
-    std::vector<std::vector<float>> delayBuffers;
-    std::vector<int> delayIndices;
-    std::vector<float> prevDelayOutput;
-    std::vector<float> currentDelaySamples;
-    std::vector<float> targetDelaySamples;
+    // Each input channel gets its own bank
+    struct Bank : ResonatorsBank {
+        // While the history moves to a larger arena, see migrateArena(): the frames
+        // of history the bank has, counted from the oldest one moved, and how many
+        // of them have been copied. A bank that starts playing meanwhile passes its
+        // input through dry until the switch.
+        int historyWritten = 0;
+        int historyCopied = 0;
+        bool waitsForArena = false;
+    };
 
+    Bank banks[PORT_MAX_CHANNELS];
+    int channels = 1;
+
+    // Delay lines of the banks, one arena for all of them. bufferSize is a
+    // power of two so indices wrap with bufferMask.
+    //
+    // The arena has lines for the channels in use, sized for the lowest pitch the
+    // patch can reach, see getRequiredFrames(). When either grows, e.g. when a
+    // PITCH input is patched, processBlock() posts the size it needs in
+    // requestedSize, the pool's worker allocates a larger arena and hands it
+    // over through pendingArena, the engine moves the history into it as
+    // migratingArena over the next blocks, and then parks the arena it replaces
+    // in retiredArena for the worker to give back to the pool. Until then delays
+    // are limited to what fits, and channels without lines pass their input
+    // through dry.
+    ResonatorsDelayArena* arena = nullptr;
+    ResonatorsDelayArena* migratingArena = nullptr;
+    std::atomic<ResonatorsDelayArena*> pendingArena{nullptr};
+    std::atomic<ResonatorsDelayArena*> retiredArena{nullptr};
+    std::atomic<ResonatorsArenaSize> requestedSize{ResonatorsArenaSize{0, 0}};
     int bufferSize = 0;
-    float interpolationSpeed = 0.01f;  // Speed of interpolation
+    int bufferMask = 0;
+    int arenaBanks = 0;
+    int requiredFrames = 0;
+    float maxDelaySamples = 0.f;
+    // Frames of history moved to a larger arena per bank and per frame processed.
+    // The history of the longest lines, 131072 frames at 768 kHz, moves in
+    // about 60 ms.
+    static constexpr int MIGRATION_RATE = 4;
+
+    // Fractional delay interpolation of the delay line reads, see
+    // ResonatorsBank::Interpolation
+    int interpolation = ResonatorsBank::LINEAR;
 
     float sampleRate = 44100.f;
 
+    // Pitch, decay, color and gain are read every controlDivisions[controlRate]
+    // samples, the delay time keeps its own smoothing
+    int controlRate = 2;
+    const int controlDivisions[4] = {1, 4, 16, 64};
+    dsp::ClockDivider controlDivider;
+
+    // A bank sleeps once its input and what it reads from its lines have been
+    // silent for a whole line length, so everything left in the lines is silent
+    // too. Feedback stays below 1, so a silent bank cannot start ringing on its own.
+    bool sleepWhenSilent = true;
+
+    // Audio is processed in blocks of blockSizes[blockSize] frames, see
+    // BlockBuffer. Output 0 is OUT, output 1 is WET.
+    const int blockSizes[4] = {1, 8, 16, 32};
+    int blockSize = 0;
+    BlockBuffer<1, 2> block;
+
+    // Control-rate coefficient updates and the per-sample loop of the banks,
+    // see Profiler.hpp
+    enum ProfilerStages {
+        COEFFICIENTS_STAGE,
+        DELAY_LINES_STAGE
+    };
+    Profiler profiler;
+
     Resonators() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
         configParam(PITCH1_PARAM, -54.f, 54.f, 0.f, "Frequency I", " Hz", dsp::FREQ_SEMITONE, dsp::FREQ_C4);
@@ -80,176 +268,378 @@ struct Resonators : Module {
         configParam(MIX_CV_PARAM, -1.f, 1.f, 0.f, "Mix CV", "%", 0, 100);
 
         configInput(PITCH1_INPUT, "I 1V/octave pitch (Polyphonic)");
-        configInput(PITCH2_INPUT, "II 1V/octave pitch");
-        configInput(PITCH3_INPUT, "III 1V/octave pitch");
-        configInput(PITCH4_INPUT, "IV 1V/octave pitch");
+        configInput(PITCH2_INPUT, "II 1V/octave pitch (Polyphonic)");
+        configInput(PITCH3_INPUT, "III 1V/octave pitch (Polyphonic)");
+        configInput(PITCH4_INPUT, "IV 1V/octave pitch (Polyphonic)");
 
-        configInput(IN_INPUT, "Audio");
+        configInput(IN_INPUT, "Audio (Polyphonic)");
         configInput(DECAY_INPUT, "Decay (Polyphonic)");
         configInput(COLOR_INPUT, "Color (Polyphonic)");
         configInput(GAIN_INPUT, "Gain (Polyphonic)");
-        configInput(MIX_INPUT, "Mix");
+        configInput(MIX_INPUT, "Mix (Polyphonic)");
 
         configOutput(WET_OUTPUT, "Wet signal (Polyphonic)");
-        configOutput(OUT_OUTPUT, "Audio");
+        configOutput(OUT_OUTPUT, "Audio (Polyphonic)");
 
         configBypass(IN_INPUT, OUT_OUTPUT);
+
+        // Build the shared table here rather than on the audio thread
+        ResonatorsSincTable::get();
+
+        profiler.addStage("Coefficients");
+        profiler.addStage("Delay lines and filters");
+
+        ResonatorsArenaPool::get().addInstance(this);
+    }
+
+    ~Resonators() {
+        ResonatorsArenaPool& pool = ResonatorsArenaPool::get();
+        pool.removeInstance(this);
+        pool.release(arena);
+        pool.release(migratingArena);
+        pool.release(pendingArena.load());
+        pool.release(retiredArena.load());
     }
 
     void onSampleRateChange() override {
         sampleRate = APP->engine->getSampleRate();
-        delayBuffers.resize(4);
-        lowPassFilter.resize(4);
-        highPassFilter.resize(4);
-        delayIndices.resize(4, 0);
-        currentDelaySamples.resize(4, 0.f);
-        prevDelayOutput.resize(4, 0.f);
-        targetDelaySamples.resize(4, 0.f);
-        bufferSize = (int)(sampleRate * 0.1);  // buffer sufficient for 10Hz as lowest frequency
-
-        for (auto& buffer : delayBuffers) {
-            buffer.resize((int)bufferSize);
-            std::fill(buffer.begin(), buffer.end(), 0.f);
+        ResonatorsArenaPool& pool = ResonatorsArenaPool::get();
+        pool.release(pendingArena.exchange(nullptr));
+        pool.release(retiredArena.exchange(nullptr));
+        pool.release(arena);
+        pool.release(migratingArena);
+        migratingArena = nullptr;
+        requestedSize = ResonatorsArenaSize{0, 0};
+        requiredFrames = getRequiredFrames();
+        int bankCount = std::max(std::max(channels, inputs[IN_INPUT].getChannels()), 1);
+        useArena(pool.acquire(ResonatorsArenaSize{requiredFrames, bankCount}));
+        for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+            banks[c].delayIndex = 0;
+            banks[c].waitsForArena = false;
+            banks[c].currentDelaySamples = simd::fmin(banks[c].currentDelaySamples, maxDelaySamples);
         }
     }
 
-    // Function to read from the delay buffer
-    float readDelayBuffer(int bufferIndex, float delayTimeSamples) {
-        float readIndex = delayIndices[bufferIndex] - delayTimeSamples;
-        if (readIndex < 0)
-            readIndex += bufferSize;
-        int index0 = (int)readIndex;
-        int index1 = (index0 + 1) % bufferSize;
-        float frac = readIndex - index0;
-        float delayedSample = (1.f - frac) * delayBuffers[bufferIndex][index0] + frac * delayBuffers[bufferIndex][index1];
-        return delayedSample;
+    // Returns the line length needed for the lowest pitch the patch can reach,
+    // see updateParameters(). A patched PITCH input can take any bank down to
+    // the -4.5 V clamp at once, so the lines cover the full range then. Without
+    // one the pitches are the knobs', and the lines are sized an octave below
+    // the lowest, so turning a knob rarely has to wait for the lines to grow.
+    int getRequiredFrames() {
+        float lowestPitch = 4.5f;
+        for (int i = 0; i < 4; i++) {
+            if (inputs[PITCH1_INPUT + i].isConnected())
+                lowestPitch = -4.5f;
+            else
+                lowestPitch = std::min(lowestPitch, params[PITCH1_PARAM + i * 2].getValue() / 12.f - 1.f);
+        }
+        lowestPitch = std::max(lowestPitch, -4.5f);
+        float delaySamples = sampleRate / (dsp::FREQ_C4 * std::pow(2.f, lowestPitch));
+        int frames = 1;
+        while (frames < (int)delaySamples + ResonatorsBank::DELAY_MARGIN) frames *= 2;
+        return frames;
     }
 
-    void writeDelayBuffer(int bufferIndex, float value) {
-        int writeIndex = delayIndices[bufferIndex];
-        delayBuffers[bufferIndex][writeIndex] = value;              // Write the new sample
-        delayIndices[bufferIndex] = (writeIndex + 1) % bufferSize;  // Increment and wrap around
+    void useArena(ResonatorsDelayArena* next) {
+        arena = next;
+        bufferSize = arena->frames;
+        bufferMask = bufferSize - 1;
+        arenaBanks = arena->banks;
+        maxDelaySamples = (float)(bufferSize - ResonatorsBank::DELAY_MARGIN);
+        for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+            banks[c].delayBuffer = (c < arenaBanks) ? &arena->data[c * 4 * bufferSize] : nullptr;
+            banks[c].bufferMask = bufferMask;
+        }
     }
 
-    void process(const ProcessArgs& args) override {
-        float input = inputs[IN_INPUT].getVoltage();
+    // Arena worker thread, see ResonatorsArenaPool
+    void updateArena() {
+        ResonatorsArenaPool& pool = ResonatorsArenaPool::get();
+        pool.release(retiredArena.exchange(nullptr, std::memory_order_acq_rel));
+        ResonatorsArenaSize size = requestedSize.exchange(ResonatorsArenaSize{0, 0});
+        if (size.frames > 0) {
+            // An arena that the engine has not picked up was never visible to it
+            pool.release(pendingArena.exchange(pool.acquire(size), std::memory_order_acq_rel));
+        }
+    }
+
+    // Engine thread. Picks up a larger arena from the worker and moves the history
+    // of the active banks into it, MIGRATION_RATE frames per bank for each frame
+    // processed, oldest frame first. The banks keep reading and writing the old
+    // arena meanwhile, and switch once all their history has been copied. Copying
+    // outpaces writing, so no frame leaves the old lines before it is copied.
+    void migrateArena() {
+        if (!migratingArena) {
+            // Wait until the previously replaced arena has been reclaimed
+            if (retiredArena.load(std::memory_order_acquire))
+                return;
+            ResonatorsDelayArena* next = pendingArena.exchange(nullptr, std::memory_order_acq_rel);
+            if (!next)
+                return;
+            if (next->frames < bufferSize || next->banks < arenaBanks ||
+                (next->frames == bufferSize && next->banks == arenaBanks)) {
+                retiredArena.store(next, std::memory_order_release);
+                return;
+            }
+            migratingArena = next;
+            for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+                banks[c].historyWritten = (c < channels && c < arenaBanks) ? bufferSize : 0;
+                banks[c].historyCopied = 0;
+            }
+        }
 
-        // Single-channel mix handling remains the same
-        float mix = params[MIX_PARAM].getValue();
-        if (inputs[MIX_INPUT].isConnected()) {
-            mix += (inputs[MIX_INPUT].getVoltage() / 10.f) * params[MIX_CV_PARAM].getValue();
+        bool copied = true;
+        for (int c = 0; c < arenaBanks; c++) {
+            copyHistory(c, MIGRATION_RATE * block.frames);
+            copied = copied && banks[c].historyCopied == banks[c].historyWritten;
         }
-        mix = clamp(mix, 0.f, 1.f);
+        if (!copied)
+            return;
+
+        ResonatorsDelayArena* next = migratingArena;
+        migratingArena = nullptr;
+        int oldBanks = arenaBanks;
+        for (int c = 0; c < PORT_MAX_CHANNELS; c++) {
+            banks[c].delayIndex = (c < oldBanks) ? banks[c].historyWritten & (next->frames - 1) : 0;
+        }
+        retiredArena.store(arena, std::memory_order_release);
+        useArena(next);
+        // Banks that were playing dry start from silent lines
+        for (int c = 0; c < std::min(channels, arenaBanks); c++) {
+            if (c >= oldBanks || banks[c].waitsForArena)
+                resetBank(banks[c], false);
+        }
+    }
 
-        // Determine how many channels to handle for each of the poly CV inputs
-        int decayChannels = inputs[DECAY_INPUT].getChannels();
-        int colorChannels = inputs[COLOR_INPUT].getChannels();
-        int gainChannels = inputs[GAIN_INPUT].getChannels();
+    // Copies up to count frames of the history of bank c into migratingArena.
+    // Frame k of the history goes to frame k of the new lines, wrapped. Frames
+    // older than the old lines are silent.
+    void copyHistory(int c, int count) {
+        Bank& bank = banks[c];
+        int frames = migratingArena->frames;
+        float* to = &migratingArena->data[c * 4 * frames];
+        int end = std::min(bank.historyCopied + count, bank.historyWritten);
+        for (int k = bank.historyCopied; k < end; k++) {
+            float* frame = &to[4 * (k & (frames - 1))];
+            int age = bank.historyWritten - k;
+            if (age <= bufferSize) {
+                const float* from = &bank.delayBuffer[4 * ((bank.delayIndex - age) & bufferMask)];
+                std::copy(from, from + 4, frame);
+            } else {
+                std::fill(frame, frame + 4, 0.f);
+            }
+        }
+        bank.historyCopied = std::max(bank.historyCopied, end);
+    }
 
-        // Determine pitch input polyphony for PITCH1_INPUT (used as multi-resonator reference)
-        int pitch1Channels = inputs[PITCH1_INPUT].getChannels();
+    // Clears a bank that starts playing, so it does not replay what it held when
+    // its channel was last active. Lines fresh from the pool are already clear.
+    void resetBank(Bank& bank, bool clearLines = true) {
+        if (clearLines && bank.delayBuffer)
+            std::fill(bank.delayBuffer, bank.delayBuffer + 4 * bufferSize, 0.f);
+        bank.reset();
+        if (migratingArena) {
+            // Its new lines may hold history copied before, silence all of them
+            bank.historyWritten = 0;
+            bank.historyCopied = -migratingArena->frames;
+            bank.waitsForArena = true;
+        } else {
+            bank.waitsForArena = false;
+        }
+    }
 
-        outputs[WET_OUTPUT].setChannels(4);
+    // Returns the CV of channel i of a poly CV input, falling back to the last channel
+    float getChannelVoltage(int inputIndex, int i) {
+        int channels = inputs[inputIndex].getChannels();
+        if (channels == 0)
+            return 0.f;
+        return inputs[inputIndex].getVoltage(std::min(i, channels - 1));
+    }
 
-        float sumOutput = 0.f;
+    // With a mono input, channels of the PITCH I, DECAY, COLOR and GAIN inputs are
+    // spread across the four resonators. With a poly input, channel c of every CV
+    // input controls the bank of voice c.
+    void updateParameters(Bank& bank, int c, bool poly, int rampLength) {
+        // Determine pitch input polyphony for PITCH1_INPUT (used as multi-resonator reference)
+        int pitch1Channels = inputs[PITCH1_INPUT].getChannels();
 
+        simd::float_4 pitch, decay, color, gain;
         for (int i = 0; i < 4; i++) {
-            // Handle per-resonator amplitude (knob) param
-            float amp = params[AMP_PARAM].getValue();
-
             // Compute local pitch in semitones, then convert to frequency
-            float pitch = params[PITCH1_PARAM + i * 2].getValue() / 12.f;
-            if (inputs[PITCH1_INPUT + i].isConnected()) {
-                pitch += inputs[PITCH1_INPUT + i].getVoltage();
+            pitch[i] = params[PITCH1_PARAM + i * 2].getValue() / 12.f;
+            if (poly) {
+                pitch[i] += inputs[PITCH1_INPUT + i].getPolyVoltage(c);
+            } else if (inputs[PITCH1_INPUT + i].isConnected()) {
+                pitch[i] += inputs[PITCH1_INPUT + i].getVoltage();
             } else if (inputs[PITCH1_INPUT].isConnected() && pitch1Channels > 1) {
                 if (i < pitch1Channels) {
-                    pitch += inputs[PITCH1_INPUT].getVoltage(i);
+                    pitch[i] += inputs[PITCH1_INPUT].getVoltage(i);
                 }
             }
-            pitch = clamp(pitch, -4.5f, 4.5f);
-            float targetFrequency = dsp::FREQ_C4 * std::pow(2.0f, pitch);
-
-            // Per-resonator local decay value (if i >= decayChannels, fallback to channel 0 or 0V)
-            float localDecay = params[DECAY_PARAM].getValue();
-            if (decayChannels > i) {
-                localDecay += (inputs[DECAY_INPUT].getVoltage(i) / 10.f) * params[DECAY_CV_PARAM].getValue();
-            } else if (decayChannels > 0) {
-                // If not enough channels for all 4, you could fallback to last channel or 0
-                localDecay += (inputs[DECAY_INPUT].getVoltage(decayChannels - 1) / 10.f) * params[DECAY_CV_PARAM].getValue();
-            }
-            localDecay = clamp(localDecay, 0.f, 1.f);
-            float localFeedback = powf(localDecay, 0.2f);
-            localFeedback = rescale(localFeedback, 0.f, 1.f, 0.7f, 0.995f);
-
-            // Per-resonator local color
-            float localColor = params[COLOR_PARAM].getValue();
-            if (colorChannels > i) {
-                localColor += (inputs[COLOR_INPUT].getVoltage(i) / 10.f) * params[COLOR_CV_PARAM].getValue();
-            } else if (colorChannels > 0) {
-                localColor += (inputs[COLOR_INPUT].getVoltage(colorChannels - 1) / 10.f) * params[COLOR_CV_PARAM].getValue();
-            }
-            localColor = clamp(localColor, 0.f, 1.f);
-            float colorFreq = std::pow(100.f, 2.f * localColor - 1.f);
-
-            // Per-resonator local gain
-            float localGain = params[GAIN1_PARAM + i * 2].getValue();
-            if (gainChannels > i) {
-                localGain += (inputs[GAIN_INPUT].getVoltage(i) / 10.f) * params[GAIN_CV_PARAM].getValue();
-            } else if (gainChannels > 0) {
-                localGain += (inputs[GAIN_INPUT].getVoltage(gainChannels - 1) / 10.f) * params[GAIN_CV_PARAM].getValue();
-            }
-            localGain = clamp(localGain, 0.0001f, 1.f);
 
-            // Calculate target delay time for each resonator
-            float targetDelayTime = 1.0f / targetFrequency;
-            targetDelaySamples[i] = targetDelayTime * sampleRate;
+            // Per-resonator local decay, color and gain (if i >= channels, fallback to the last channel or 0V)
+            float decayCV = poly ? inputs[DECAY_INPUT].getPolyVoltage(c) : getChannelVoltage(DECAY_INPUT, i);
+            float colorCV = poly ? inputs[COLOR_INPUT].getPolyVoltage(c) : getChannelVoltage(COLOR_INPUT, i);
+            float gainCV = poly ? inputs[GAIN_INPUT].getPolyVoltage(c) : getChannelVoltage(GAIN_INPUT, i);
+            decay[i] = params[DECAY_PARAM].getValue() + (decayCV / 10.f) * params[DECAY_CV_PARAM].getValue();
+            color[i] = params[COLOR_PARAM].getValue() + (colorCV / 10.f) * params[COLOR_CV_PARAM].getValue();
+            gain[i] = params[GAIN1_PARAM + i * 2].getValue() + (gainCV / 10.f) * params[GAIN_CV_PARAM].getValue();
+        }
 
-            // Smooth interpolation of new delay times
-            currentDelaySamples[i] += (targetDelaySamples[i] - currentDelaySamples[i]) * interpolationSpeed;
+        bank.setControls(pitch, decay, color, gain, sampleRate, maxDelaySamples, rampLength);
+    }
 
-            // Read from delay buffer
-            float delayOutput = readDelayBuffer(i, currentDelaySamples[i]);
+    void process(const ProcessArgs& args) override {
+        if (!arena)
+            return;
+
+        block.setFrames(blockSizes[blockSize]);
+        block.push(0, inputs[IN_INPUT]);
+        if (block.ready())
+            processBlock();
+        block.pull(0, outputs[OUT_OUTPUT]);
+        block.pull(1, outputs[WET_OUTPUT]);
+        block.advance();
+    }
 
-            // Simple smoothing
-            float filteredOutput = 0.5f * (delayOutput + prevDelayOutput[i]);
-            prevDelayOutput[i] = delayOutput;
+    // Runs the buffered block through the banks, one bank at a time
+    void processBlock() {
+        profiler.addSamples(block.frames);
+        migrateArena();
 
-            // Apply feedback
-            delayOutput = filteredOutput * localFeedback;
+        int newChannels = std::max(block.inputChannels[0], 1);
+        for (int c = channels; c < newChannels; c++) {
+            resetBank(banks[c]);
+        }
+        channels = newChannels;
+        bool poly = channels > 1;
+
+        // Frames of the block at which controls are read
+        controlDivider.setDivision(controlDivisions[controlRate]);
+        bool updateControl[BlockBuffer<1, 2>::MAX_FRAMES];
+        bool anyUpdate = false;
+        for (int i = 0; i < block.frames; i++) {
+            updateControl[i] = controlDivider.process();
+            anyUpdate = anyUpdate || updateControl[i];
+        }
+        if (anyUpdate)
+            requiredFrames = getRequiredFrames();
+        if ((requiredFrames > bufferSize || channels > arenaBanks) && !migratingArena &&
+            !pendingArena.load(std::memory_order_relaxed))
+            requestedSize.store(ResonatorsArenaSize{std::max(requiredFrames, bufferSize), std::max(channels, arenaBanks)});
+
+        float amp = params[AMP_PARAM].getValue();
+        int holdFrames = std::max(bufferSize, (int)(0.1f * sampleRate));
+
+        CELLA_PROFILE_SCOPE(&profiler, DELAY_LINES_STAGE);
+        for (int c = 0; c < channels; c++) {
+            Bank& bank = banks[c];
+
+            // Mix CV is per voice
+            float mix = params[MIX_PARAM].getValue();
+            if (inputs[MIX_INPUT].isConnected()) {
+                mix += (inputs[MIX_INPUT].getPolyVoltage(c) / 10.f) * params[MIX_CV_PARAM].getValue();
+            }
+            mix = clamp(mix, 0.f, 1.f);
 
-            // Lowpass filter
-            float lowpassFreq = clamp(20000.f * colorFreq, 20.f, 20000.f);
-            lowPassFilter[i].setCutoffFreq(lowpassFreq / args.sampleRate);
-            lowPassFilter[i].process(delayOutput);
-            delayOutput = lowPassFilter[i].lowpass();
+            if (!sleepWhenSilent)
+                bank.silenceDetector.reset();
 
-            // Highpass filter
-            float highpassFreq = clamp(20.f * colorFreq, 20.f, 20000.f);
-            highPassFilter[i].setCutoff(highpassFreq / args.sampleRate);
-            highPassFilter[i].process(delayOutput);
-            delayOutput = highPassFilter[i].highpass();
+            // Until the worker has grown the arena
+            if (!bank.delayBuffer || bank.waitsForArena) {
+                for (int i = 0; i < block.frames; i++) {
+                    block.out[0][i][c] = crossfade(block.in[0][i][c], 0.f, mix);
+                    block.out[1][i][c] = 0.f;
+                }
+                continue;
+            }
 
-            // Mix dry input with resonator's delayed output
-            float resonatorOut = input + delayOutput;
+            int written = 0;
+            for (int i = 0; i < block.frames; i++) {
+                float input = block.in[0][i][c];
+                float* out = block.out[0][i];
+                float* wet = block.out[1][i];
+
+                if (sleepWhenSilent) {
+                    bool quiet = std::fabs(input) < SilenceDetector::THRESHOLD &&
+                                 simd::movemask(simd::abs(bank.prevDelayOutput) >= SilenceDetector::THRESHOLD) == 0;
+                    if (bank.silenceDetector.process(quiet, holdFrames)) {
+                        // Controls jump to their current values on waking up
+                        bank.controlInitialized = false;
+                        if (poly)
+                            wet[c] = 0.f;
+                        else
+                            simd::float_4(0.f).store(wet);
+                        out[c] = crossfade(input, 0.f, mix);
+                        continue;
+                    }
+                }
 
-            // Write to delay buffer
-            writeDelayBuffer(i, resonatorOut);
+                if (updateControl[i] || !bank.controlInitialized) {
+                    CELLA_PROFILE_SCOPE(&profiler, COEFFICIENTS_STAGE);
+                    updateParameters(bank, c, poly, controlDivider.getDivision());
+                }
 
-            // Apply per-resonator amplitude knob and local gain
-            float finalOut = delayOutput * localGain;
+                simd::float_4 finalOut = bank.process(input, interpolation);
+                written++;
+                float wetOutput = finalOut[0] + finalOut[1] + finalOut[2] + finalOut[3];
 
-            // Send per-resonator wet signal to poly output
-            outputs[WET_OUTPUT].setVoltage(finalOut, i);
+                // Send per-resonator wet signal to poly output
+                if (poly)
+                    wet[c] = wetOutput;
+                else
+                    finalOut.store(wet);
 
-            // Accumulate for summed output
-            sumOutput += finalOut * amp;
+                // After summing all resonators, apply amplitude knob and global crossfade
+                out[c] = crossfade(input, wetOutput * amp, mix);
+            }
+            if (migratingArena)
+                bank.historyWritten += written;
         }
 
-        // After summing all resonators, apply global crossfade
-        outputs[OUT_OUTPUT].setVoltage(crossfade(input, sumOutput, mix));
+        // The wet output has one channel per resonator for a mono input, one per voice otherwise
+        block.setOutputChannels(0, channels);
+        block.setOutputChannels(1, poly ? channels : 4);
+    }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "controlRate", json_integer(controlRate));
+        json_object_set_new(rootJ, "interpolation", json_integer(interpolation));
+        json_object_set_new(rootJ, "sleepWhenSilent", json_boolean(sleepWhenSilent));
+        json_object_set_new(rootJ, "blockSize", json_integer(blockSize));
+        return rootJ;
+    }
+
+    void dataFromJson(json_t* rootJ) override {
+        json_t* controlRateJ = json_object_get(rootJ, "controlRate");
+        if (controlRateJ)
+            controlRate = clamp((int)json_integer_value(controlRateJ), 0, 3);
+
+        json_t* interpolationJ = json_object_get(rootJ, "interpolation");
+        if (interpolationJ)
+            interpolation = clamp((int)json_integer_value(interpolationJ), (int)ResonatorsBank::LINEAR, (int)ResonatorsBank::SINC);
+
+        json_t* sleepJ = json_object_get(rootJ, "sleepWhenSilent");
+        if (sleepJ)
+            sleepWhenSilent = json_boolean_value(sleepJ);
+
+        json_t* blockSizeJ = json_object_get(rootJ, "blockSize");
+        if (blockSizeJ)
+            blockSize = clamp((int)json_integer_value(blockSizeJ), 0, 3);
     }
 };
 
+void ResonatorsArenaPool::run() {
+    std::unique_lock<std::mutex> lock(instancesMutex);
+    while (!instances.empty()) {
+        for (Resonators* module : instances) {
+            module->updateArena();
+        }
+        instancesChanged.wait_for(lock, std::chrono::milliseconds(WORKER_PERIOD_MS));
+    }
+}
+
 struct ResonatorsWidget : ModuleWidget {
     ResonatorsWidget(Resonators* module) {
         setModule(module);
@@ -296,6 +686,24 @@ struct ResonatorsWidget : ModuleWidget {
         addOutput(createOutputCentered<ThemedPJ301MPort>(Vec(112.5, 329.25), module, Resonators::WET_OUTPUT));
         addOutput(createOutputCentered<ThemedPJ301MPort>(Vec(157.5, 329.25), module, Resonators::OUT_OUTPUT));
     }
+
+    void appendContextMenu(Menu* menu) override {
+        Resonators* module = dynamic_cast<Resonators*>(this->module);
+        assert(module);
+        menu->addChild(new MenuSeparator);
+        menu->addChild(createIndexPtrSubmenuItem("Control Rate",
+                                                 {"Every sample", "Every 4 samples", "Every 16 samples", "Every 64 samples"},
+                                                 &module->controlRate));
+        menu->addChild(createIndexPtrSubmenuItem("Interpolation",
+                                                 {"Linear", "Lagrange (cubic)", "Allpass", "Windowed sinc"},
+                                                 &module->interpolation));
+        menu->addChild(createBoolPtrMenuItem("Sleep When Silent", "", &module->sleepWhenSilent));
+        menu->addChild(createIndexPtrSubmenuItem("Block Processing",
+                                                 {"Off", "8 samples", "16 samples", "32 samples"},
+                                                 &module->blockSize));
+
+        appendProfilerMenu(menu, &module->profiler);
+    }
 };
 
 // Define the model
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include <rack.hpp>
+
+#include "FastMath.hpp"
+#include "SilenceDetector.hpp"
+
+// Windowed-sinc fractional delay filters for Resonators, one per fraction
+// p / PHASES of a sample and interpolated linearly in between. Built once and
+// shared by all instances.
+struct ResonatorsSincTable {
+    static constexpr int TAPS = 8;
+    static constexpr int PHASES = 128;
+    // Taps apply to the samples index - 3 ... index + 4 around the read position index + frac
+    float coefficients[PHASES + 1][TAPS];
+
+    ResonatorsSincTable() {
+        for (int p = 0; p <= PHASES; p++) {
+            double frac = (double)p / PHASES;
+            double sum = 0.0;
+            double h[TAPS];
+            for (int k = 0; k < TAPS; k++) {
+                double x = (k - (TAPS / 2 - 1)) - frac;
+                double sinc = (x == 0.0) ? 1.0 : std::sin(M_PI * x) / (M_PI * x);
+                // Blackman window spanning [-TAPS / 2, TAPS / 2]
+                double w = 0.42 + 0.5 * std::cos(2.0 * M_PI * x / TAPS) + 0.08 * std::cos(4.0 * M_PI * x / TAPS);
+                h[k] = sinc * w;
+                sum += h[k];
+            }
+            // Unity gain at DC for every fraction
+            for (int k = 0; k < TAPS; k++) {
+                coefficients[p][k] = (float)(h[k] / sum);
+            }
+        }
+    }
+
+    static const ResonatorsSincTable& get() {
+        static const ResonatorsSincTable table;
+        return table;
+    }
+};
+
+// Four resonators processed together, one lane per resonator: the delay lines,
+// their interpolated reads and the filters in the feedback path. Resonators
+// gives each input channel a bank and owns the memory of the lines, so bench/
+// can run a bank on lines of its own.
+struct ResonatorsBank {
+    struct Ramp {
+        rack::simd::float_4 value = 0.f;
+        rack::simd::float_4 step = 0.f;
+
+        void setTarget(rack::simd::float_4 target, int length) {
+            step = (target - value) / (float)length;
+        }
+
+        void jump(rack::simd::float_4 target) {
+            value = target;
+            step = 0.f;
+        }
+
+        rack::simd::float_4 process() {
+            value += step;
+            return value;
+        }
+    };
+
+    // Fractional delay interpolation of the delay line reads
+    enum Interpolation {
+        LINEAR,
+        LAGRANGE,
+        ALLPASS,
+        SINC
+    };
+
+    // Frames beyond the delay needed by the interpolators
+    static constexpr int DELAY_MARGIN = ResonatorsSincTable::TAPS;
+    // Speed of the glide to a new delay time, per sample
+    static constexpr float INTERPOLATION_SPEED = 0.01f;
+
+    // Variables for filters
+    rack::dsp::TRCFilter<rack::simd::float_4> lowPassFilter;
+    rack::dsp::TRCFilter<rack::simd::float_4> highPassFilter;
+
+    // Frame j of the bank's delay lines holds sample j of each line. All
+    // lines are written at the same index. The line length is a power of two,
+    // so indices wrap with bufferMask.
+    float* delayBuffer = nullptr;
+    int bufferMask = 0;
+    int delayIndex = 0;
+
+    rack::simd::float_4 prevDelayOutput = 0.f;
+    rack::simd::float_4 currentDelaySamples = 0.f;
+    rack::simd::float_4 targetDelaySamples = 0.f;
+    rack::simd::float_4 allpassState = 0.f;
+
+    // Feedback, gain and filter cutoffs ramp linearly between control updates
+    Ramp feedbackRamp, gainRamp, lowpassCutoffRamp, highpassCutoffRamp;
+    bool controlInitialized = false;
+
+    SilenceDetector silenceDetector;
+
+    // Clears the state, the lines excepted
+    void reset() {
+        delayIndex = 0;
+        lowPassFilter.reset();
+        highPassFilter.reset();
+        prevDelayOutput = 0.f;
+        allpassState = 0.f;
+        controlInitialized = false;
+        silenceDetector.reset();
+    }
+
+    // Sets the controls of the four resonators: pitch in V/oct from C4, decay,
+    // color and gain from 0 to 1. Delays are limited to maxDelaySamples. Unless
+    // the bank starts playing, the controls ramp to their new values over
+    // rampLength samples.
+    void setControls(rack::simd::float_4 pitch, rack::simd::float_4 decay, rack::simd::float_4 color,
+                     rack::simd::float_4 gain, float sampleRate, float maxDelaySamples, int rampLength) {
+        using rack::simd::float_4;
+
+        pitch = rack::simd::clamp(pitch, -4.5f, 4.5f);
+        float_4 targetFrequency = rack::dsp::FREQ_C4 * fastmath::exp2(pitch);
+        // Calculate target delay time for each resonator
+        targetDelaySamples = rack::simd::fmin(sampleRate / targetFrequency, maxDelaySamples);
+
+        decay = rack::simd::clamp(decay, 0.f, 1.f);
+        float_4 feedback = fastmath::pow(decay, float_4(0.2f));
+        feedback = rack::simd::rescale(feedback, 0.f, 1.f, 0.7f, 0.995f);
+
+        color = rack::simd::clamp(color, 0.f, 1.f);
+        // 100^(2 * color - 1)
+        float_4 colorFreq = fastmath::exp2((2.f * color - 1.f) * 6.64385619f);
+        float_4 lowpassFreq = rack::simd::clamp(20000.f * colorFreq, 20.f, 20000.f);
+        float_4 highpassFreq = rack::simd::clamp(20.f * colorFreq, 20.f, 20000.f);
+        // Cutoffs as taken by TRCFilter::setCutoff(): the lowpass is set by frequency,
+        // the highpass by the normalized frequency directly
+        float_4 lowpassCutoff = 2.f * (float)M_PI * lowpassFreq / sampleRate;
+        float_4 highpassCutoff = highpassFreq / sampleRate;
+
+        gain = rack::simd::clamp(gain, 0.0001f, 1.f);
+
+        if (!controlInitialized) {
+            // Start at the target delay rather than gliding up from 0, which would
+            // put the taps of the wider interpolators at or ahead of the write index
+            currentDelaySamples = targetDelaySamples;
+            feedbackRamp.jump(feedback);
+            gainRamp.jump(gain);
+            lowpassCutoffRamp.jump(lowpassCutoff);
+            highpassCutoffRamp.jump(highpassCutoff);
+            controlInitialized = true;
+        } else {
+            feedbackRamp.setTarget(feedback, rampLength);
+            gainRamp.setTarget(gain, rampLength);
+            lowpassCutoffRamp.setTarget(lowpassCutoff, rampLength);
+            highpassCutoffRamp.setTarget(highpassCutoff, rampLength);
+        }
+    }
+
+    // Returns the sample offset frames after index of each line
+    rack::simd::float_4 readFrame(rack::simd::int32_4 index, int offset) const {
+        rack::simd::float_4 sample;
+        for (int i = 0; i < 4; i++) {
+            sample[i] = delayBuffer[4 * ((index[i] + offset) & bufferMask) + i];
+        }
+        return sample;
+    }
+
+    // Reads each line delayTimeSamples behind the write index. The delay is at
+    // least 7 samples, so all taps lie in the written part of the line.
+    rack::simd::float_4 readDelayBuffer(rack::simd::float_4 delayTimeSamples, int interpolation) {
+        using rack::simd::float_4;
+
+        float_4 readIndex = (float)delayIndex - delayTimeSamples;
+        float_4 floorIndex = rack::simd::floor(readIndex);
+        float_4 frac = readIndex - floorIndex;
+        rack::simd::int32_4 index = rack::simd::int32_4(floorIndex) & bufferMask;
+
+        switch (interpolation) {
+            case LAGRANGE: {
+                // Third-order Lagrange over the samples index - 1 ... index + 2
+                float_4 xm1 = readFrame(index, -1);
+                float_4 x0 = readFrame(index, 0);
+                float_4 x1 = readFrame(index, 1);
+                float_4 x2 = readFrame(index, 2);
+                float_4 fm1 = frac + 1.f, f1 = frac - 1.f, f2 = frac - 2.f;
+                return -frac * f1 * f2 * (1.f / 6.f) * xm1 + fm1 * f1 * f2 * 0.5f * x0 -
+                       fm1 * frac * f2 * 0.5f * x1 + fm1 * frac * f1 * (1.f / 6.f) * x2;
+            }
+            case ALLPASS: {
+                // First-order allpass after an integer delay, choosing the split so the
+                // allpass delay stays in [0.5, 1.5] samples where it behaves best
+                float_4 x0 = readFrame(index, 0);
+                float_4 x1 = readFrame(index, 1);
+                float_4 x2 = readFrame(index, 2);
+                float_4 late = frac > 0.5f;
+                float_4 current = rack::simd::ifelse(late, x2, x1);
+                float_4 previous = rack::simd::ifelse(late, x1, x0);
+                float_4 eta = rack::simd::ifelse(late, (frac - 1.f) / (3.f - frac), frac / (2.f - frac));
+                allpassState = eta * (current - allpassState) + previous;
+                return allpassState;
+            }
+            case SINC: {
+                const ResonatorsSincTable& table = ResonatorsSincTable::get();
+                float_4 sample;
+                for (int i = 0; i < 4; i++) {
+                    float phase = frac[i] * ResonatorsSincTable::PHASES;
+                    int p = std::min((int)phase, ResonatorsSincTable::PHASES - 1);
+                    float t = phase - p;
+                    const float* h0 = table.coefficients[p];
+                    const float* h1 = table.coefficients[p + 1];
+                    float sum = 0.f;
+                    for (int k = 0; k < ResonatorsSincTable::TAPS; k++) {
+                        int frame = (index[i] + k - (ResonatorsSincTable::TAPS / 2 - 1)) & bufferMask;
+                        sum += (h0[k] + t * (h1[k] - h0[k])) * delayBuffer[4 * frame + i];
+                    }
+                    sample[i] = sum;
+                }
+                return sample;
+            }
+            default: {
+                float_4 x0 = readFrame(index, 0);
+                float_4 x1 = readFrame(index, 1);
+                return (1.f - frac) * x0 + frac * x1;
+            }
+        }
+    }
+
+    void writeDelayBuffer(rack::simd::float_4 value) {
+        value.store(&delayBuffer[4 * delayIndex]);  // Write the new sample
+        delayIndex = (delayIndex + 1) & bufferMask;  // Increment and wrap around
+    }
+
+    // Runs one sample and returns the output of the four resonators
+    rack::simd::float_4 process(float input, int interpolation) {
+        using rack::simd::float_4;
+
+        // Smooth interpolation of new delay times
+        currentDelaySamples += (targetDelaySamples - currentDelaySamples) * INTERPOLATION_SPEED;
+
+        // Read from delay buffer
+        float_4 delayOutput = readDelayBuffer(currentDelaySamples, interpolation);
+
+        // Simple smoothing
+        float_4 filteredOutput = 0.5f * (delayOutput + prevDelayOutput);
+        prevDelayOutput = delayOutput;
+
+        // Apply feedback
+        delayOutput = filteredOutput * feedbackRamp.process();
+
+        // Lowpass filter
+        lowPassFilter.setCutoff(lowpassCutoffRamp.process());
+        lowPassFilter.process(delayOutput);
+        delayOutput = lowPassFilter.lowpass();
+
+        // Highpass filter
+        highPassFilter.setCutoff(highpassCutoffRamp.process());
+        highPassFilter.process(delayOutput);
+        delayOutput = highPassFilter.highpass();
+
+        // Mix dry input with resonator's delayed output and write to delay buffer
+        writeDelayBuffer(input + delayOutput);
+
+        // Apply per-resonator local gain
+        return delayOutput * gainRamp.process();
+    }
+};
@@ -1,3 +1,4 @@
+#include "RichEnvelope.hpp"
 #include "components.hpp"
 #include "plugin.hpp"
 
@@ -33,62 +34,31 @@ struct Rich : Module {
         NUM_LIGHTS
     };
 
-    static constexpr float MIN_TIME = 1e-3f;
-    static constexpr float MAX_TIME = 10.f;
-    static constexpr float LAMBDA_BASE = MAX_TIME / MIN_TIME;
-
     bool invert = false;
-    float phase = 0.f;
+    int channels = 1;
 
-    float accentCounter = 0.f;
-    float accent = 1.f;
-    float accentScale = 0.f;
-    bool isAttacking = false;
-    bool isDecaying = false;
-    float envelopeValue = 0.f;
+    // Voice state and the envelope menu settings
+    RichEnvelope envelope;
 
     // context menu variables
-    bool exponentialAttack = false;
-    bool retriggerStrategy = false;
-    int exponentType = 0;
     int triggerSyncDelay = 1;
     bool retriggerEnabled = true;
 
-    // vars for retrigger strategy II
-    bool preserveAccent = false;
-    float preserveAccentValue = -1.f;
-    float preserveAccentScaleValue = -1.f;
-
-    // retrigger strategy I
-    float crossfadeValue = -1.f;
-    float crossfadePhase = 0.f;
-
     // capture delayed triggers
-    int64_t triggerFrame = -1;
-    int64_t accentFrame = -1;
-    float initialAccentValueOnTrigger = 0.f;
+    int64_t triggerFrame[PORT_MAX_CHANNELS];
+    int64_t accentFrame[PORT_MAX_CHANNELS];
+    float initialAccentValueOnTrigger[PORT_MAX_CHANNELS] = {};
 
-    dsp::SchmittTrigger trigger;
-    dsp::SchmittTrigger accentTrigger;
+    dsp::SchmittTrigger trigger[PORT_MAX_CHANNELS];
+    dsp::SchmittTrigger accentTrigger[PORT_MAX_CHANNELS];
     dsp::ClockDivider lightDivider;
     dsp::BooleanTrigger invertBoolean;
     dsp::SchmittTrigger invertSchmitt;
 
-    float binarySearch(float targetValue, float shape, float exponent, float a, float b, float epsilon) {
-        float candidate = (a + b) / 2.f;
-        float value = (1 - shape) * candidate + shape * std::pow(candidate, 1.0 / exponent);
-        if (std::abs(targetValue - value) < epsilon) return candidate;
-        if (value < targetValue) {
-            return binarySearch(targetValue, shape, exponent, candidate, b, epsilon);
-        } else {
-            return binarySearch(targetValue, shape, exponent, a, candidate, epsilon);
-        };
-    }
-
     Rich() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
-        configParam(ATTACK_PARAM, 0.f, 1.0f, 0.0f, "Attack time", " ms", LAMBDA_BASE, MIN_TIME * 1000);
-        configParam(DECAY_PARAM, 0.f, 1.0f, std::log2(400.f) / std::log2(LAMBDA_BASE), "Decay time", " ms", LAMBDA_BASE, MIN_TIME * 1000);
+        configParam(ATTACK_PARAM, 0.f, 1.0f, 0.0f, "Attack time", " ms", RichEnvelope::LAMBDA_BASE, RichEnvelope::MIN_TIME * 1000);
+        configParam(DECAY_PARAM, 0.f, 1.0f, std::log2(400.f) / std::log2(RichEnvelope::LAMBDA_BASE), "Decay time", " ms", RichEnvelope::LAMBDA_BASE, RichEnvelope::MIN_TIME * 1000);
         configParam(SHAPE_PARAM, 0.0f, 1.0f, 1.0f, "Envelope shape");
 
         configParam(STEPS_PARAM, -8.f, 8.f, 3.f, "Accent steps");
@@ -110,6 +80,24 @@ struct Rich : Module {
         configOutput(ACCENT_OUTPUT, "Accent level");
 
         lightDivider.setDivision(4);
+        std::fill(triggerFrame, triggerFrame + PORT_MAX_CHANNELS, -1);
+        std::fill(accentFrame, accentFrame + PORT_MAX_CHANNELS, -1);
+    }
+
+    // Clears channel c when it starts playing
+    void resetVoice(int c) {
+        envelope.resetVoice(c);
+        triggerFrame[c] = -1;
+        accentFrame[c] = -1;
+        trigger[c].reset();
+        accentTrigger[c].reset();
+    }
+
+    // Returns the attack or decay time, 0 to 1, for a knob, its CV amount and the CV
+    simd::float_4 getTime(float knob, float cvAmount, simd::float_4 cv) {
+        // square the cv value to make it more sensitive
+        cvAmount = (cvAmount > 0.f) ? cvAmount * cvAmount : -(cvAmount * cvAmount);
+        return simd::clamp(knob + cv / 10.f * cvAmount, 0.f, 1.f);
     }
 
     void process(const ProcessArgs &args) override {
@@ -118,7 +106,6 @@ struct Rich : Module {
         float accentLevel = params[ALVL_PARAM].getValue();
         float steps = params[STEPS_PARAM].getValue();
         float shape = params[SHAPE_PARAM].getValue();
-        float exponent = exponentType + 2.f;
         int samplesDelay = triggerSyncDelay * 5;
 
         if (invertBoolean.process(params[INVERT_PARAM].getValue()))
@@ -128,188 +115,85 @@ struct Rich : Module {
         if (invertSchmitt.process(inputs[INVERT_INPUT].getVoltage(), 0.1f, 1.f))
             invert ^= true;
 
-        if (trigger.process(inputs[TRIGGER_INPUT].getVoltage())) {
-            triggerFrame = args.frame;
-        }
-        if (accentTrigger.process(inputs[ACCENT_INPUT].getVoltage())) {
-            accentFrame = args.frame;
-            initialAccentValueOnTrigger = clamp(inputs[ACCENT_INPUT].getVoltage(), 0.f, 10.f);
+        // One voice per channel of the trigger input
+        int newChannels = std::max(inputs[TRIGGER_INPUT].getChannels(), 1);
+        for (int c = channels; c < newChannels; c++) {
+            resetVoice(c);
         }
+        channels = newChannels;
 
-        bool triggered = false;
-        bool accented = false;
+        for (int c = 0; c < channels; c++) {
+            float accentVoltage = inputs[ACCENT_INPUT].getPolyVoltage(c);
 
-        int64_t timeSinceTrigger = args.frame - triggerFrame;
-        int64_t timeBetreenTriggerAndAccent = abs(triggerFrame - accentFrame);
-        if (timeSinceTrigger == samplesDelay) {
-            triggered = true;
-            if (timeBetreenTriggerAndAccent <= samplesDelay) {
-                accented = true;
+            if (trigger[c].process(inputs[TRIGGER_INPUT].getVoltage(c))) {
+                triggerFrame[c] = args.frame;
             }
-        }
-
-        // Check if the trigger input is high
-        if (triggered && !isAttacking && (!isDecaying || retriggerEnabled)) {
-            float accentTriggerValue = clamp(inputs[ACCENT_INPUT].getVoltage(), 0.f, 10.f);
-
-            if (accentTriggerValue == 0.f && accented) {
-                accentTriggerValue = initialAccentValueOnTrigger;
+            if (accentTrigger[c].process(accentVoltage)) {
+                accentFrame[c] = args.frame;
+                initialAccentValueOnTrigger[c] = clamp(accentVoltage, 0.f, 10.f);
             }
 
-            float nextAccent = 0.f;
-            float nextAccentCounter = 0.f;
-            float nextAccentScale = 0.f;
+            bool triggered = false;
+            bool accented = false;
 
-            if (accentTriggerValue > 0.f && steps != 0.f) {
-                nextAccentCounter = clamp(accentCounter + 1, 1.f, std::abs(steps));
-                if (!invert) {
-                    nextAccent = clamp(nextAccentCounter / std::abs(steps), 0.f, 1.f);
-                } else {
-                    nextAccent = clamp((std::abs(steps) + 1 - nextAccentCounter) / std::abs(steps), 0.f, 1.f);
+            int64_t timeSinceTrigger = args.frame - triggerFrame[c];
+            int64_t timeBetreenTriggerAndAccent = std::abs(triggerFrame[c] - accentFrame[c]);
+            if (timeSinceTrigger == samplesDelay) {
+                triggered = true;
+                if (timeBetreenTriggerAndAccent <= samplesDelay) {
+                    accented = true;
                 }
-
-                nextAccentScale = accentTriggerValue / 10.f;
             }
 
-            if (isDecaying) {
-                // retrigger
-                float nextPeakValue;
-                if (steps >= 0.f) {
-                    nextPeakValue = 10.f * (baseLevel + nextAccent * nextAccentScale * accentLevel * (1 - baseLevel));
-                } else {
-                    nextPeakValue = 10.f * baseLevel * (1.f - nextAccent * nextAccentScale * accentLevel);
-                }
+            // Check if the trigger input is high
+            if (triggered && !envelope.attacking(c) && (!envelope.decaying(c) || retriggerEnabled)) {
+                float accentTriggerValue = clamp(accentVoltage, 0.f, 10.f);
 
-                // Next peak value is higher than the current envelope value, retrigger is possible
-                if (nextPeakValue > envelopeValue) {
-                    preserveAccent = false;
-                    preserveAccentValue = -1.f;
-                    preserveAccentScaleValue = -1.f;
-
-                    // Find phase value for the next envelope based on the current envelope value
-                    float intermediaryEnvelopeValue = envelopeValue / nextPeakValue;
-                    float exp = (exponentialAttack) ? 1.f / exponent : exponent;
-                    phase = binarySearch(intermediaryEnvelopeValue, shape, exp, 0.f, 1.f, 0.001f);
-                    isAttacking = true;
-                    isDecaying = false;
-                } else {
-                    // Strategy I: jump to decay phase of next envelope but
-                    // crossfade last value of previous envelope value and new envelope value
-                    // to avoid clicks
-                    if (retriggerStrategy == false) {
-                        phase = 1.f;
-                        isAttacking = false;
-                        isDecaying = true;
-                        crossfadeValue = envelopeValue;
-                    } else {
-                        // Strategy II: preserve accent value and scale until next suitable peak
-                        preserveAccent = true;
-                        if (preserveAccentValue == -1.f) {
-                            preserveAccentValue = accent;
-                            preserveAccentScaleValue = accentScale;
-                        }
-                    }
+                if (accentTriggerValue == 0.f && accented) {
+                    accentTriggerValue = initialAccentValueOnTrigger[c];
                 }
-            } else {
-                isAttacking = true;
-                isDecaying = false;
-            }
-            accentCounter = nextAccentCounter;
-            accent = nextAccent;
-            accentScale = nextAccentScale;
-        }
 
-        // Process the decay stage
-        float decayForCrossfade = 0.f;
-        if (isDecaying) {
-            float decayParam = params[DECAY_PARAM].getValue();
-            float decayCvParam = params[DECAY_CV_PARAM].getValue();
-            // square the cv value to make it more sensitive
-            decayCvParam = (decayCvParam > 0.f) ? decayCvParam * decayCvParam : -(decayCvParam * decayCvParam);
-            float decay = decayParam + inputs[DECAY_INPUT].getVoltage() / 10.f * decayCvParam;
-            decay = clamp(decay, 0.f, 1.f);
-            decayForCrossfade = decay;
-            float decayLambda = std::pow(LAMBDA_BASE, -decay) / MIN_TIME;
-            phase -= deltaTime * decayLambda;
-            if (phase <= 0.0f) {
-                phase = 0.0f;
-                isDecaying = false;
+                envelope.trigger(c, accentTriggerValue, baseLevel, accentLevel, steps, shape, invert);
             }
         }
 
-        // Process the attack stage
-        if (isAttacking) {
-            float attackParam = params[ATTACK_PARAM].getValue();
-            float attackCvParam = params[ATTACK_CV_PARAM].getValue();
-            // square the cv value to make it more sensitive
-            attackCvParam = (attackCvParam > 0.f) ? attackCvParam * attackCvParam : -(attackCvParam * attackCvParam);
-            float attack = attackParam + inputs[ATTACK_INPUT].getVoltage() / 10.f * attackCvParam;
-            attack = clamp(attack, 0.f, 1.f);
-            float attackLambda = std::pow(LAMBDA_BASE, -attack) / MIN_TIME;
-            phase += deltaTime * attackLambda;
-            if (phase >= 1.0) {
-                phase = 1.0;
-                isAttacking = false;
-                isDecaying = true;
-            }
-        }
-
-        //----------- Merging envelopes ---------------
-
-        float expEnvelope;
-        if (exponentialAttack) {
-            expEnvelope = std::pow(phase, exponent);
-        } else {
-            expEnvelope = (isAttacking) ? std::pow(phase, 1.f / exponent) : std::pow(phase, exponent);
-        }
-
-        float envelopeMix = (1.f - shape) * phase + shape * expEnvelope;
-
-        // -------------
-
-        // Retrigger strategy II
+        float attackParam = params[ATTACK_PARAM].getValue();
+        float attackCvParam = params[ATTACK_CV_PARAM].getValue();
+        float decayParam = params[DECAY_PARAM].getValue();
+        float decayCvParam = params[DECAY_CV_PARAM].getValue();
+        float lightLevel = 0.f;
 
-        float usedAccent = (preserveAccent == true) ? preserveAccentValue : accent;
-        float usedAccentScale = (preserveAccent == true) ? preserveAccentScaleValue : accentScale;
+        for (int c = 0; c < channels; c += 4) {
+            simd::float_4 attack = getTime(attackParam, attackCvParam, inputs[ATTACK_INPUT].getPolyVoltageSimd<simd::float_4>(c));
+            simd::float_4 decay = getTime(decayParam, decayCvParam, inputs[DECAY_INPUT].getPolyVoltageSimd<simd::float_4>(c));
+            simd::float_4 accent;
+            simd::float_4 env = envelope.process(c / 4, deltaTime, attack, decay, baseLevel, accentLevel, steps, shape, accent);
 
-        // Envelope update
+            outputs[ENVELOPE_OUTPUT].setVoltageSimd(env, c);
+            outputs[ACCENT_OUTPUT].setVoltageSimd(10.f * accent, c);
 
-        if (steps >= 0.f) {
-            envelopeValue = envelopeMix * 10.f * (baseLevel + usedAccent * usedAccentScale * accentLevel * (1 - baseLevel));
-        } else {
-            envelopeValue = envelopeMix * 10.f * baseLevel * (1.f - usedAccent * usedAccentScale * accentLevel);
-        }
-
-        // Retrigger Strategy I
-        if (crossfadeValue != -1.f) {
-            float crossfadeLambda = std::pow(LAMBDA_BASE, -decayForCrossfade * 0.55f) / MIN_TIME;
-            crossfadePhase += deltaTime * crossfadeLambda;
-            if (crossfadePhase > 1.f) {
-                crossfadeValue = -1.f;
-                crossfadePhase = 0.f;
-            } else {
-                envelopeValue = crossfade(crossfadeValue, envelopeValue, crossfadePhase);
+            for (int i = 0; i < 4 && c + i < channels; i++) {
+                lightLevel = std::max(lightLevel, env[i]);
             }
         }
 
-        // ----------------------------------------
-
-        outputs[ENVELOPE_OUTPUT].setVoltage(envelopeValue);
-        outputs[ACCENT_OUTPUT].setVoltage(10.f * usedAccent * usedAccentScale);
+        outputs[ENVELOPE_OUTPUT].setChannels(channels);
+        outputs[ACCENT_OUTPUT].setChannels(channels);
 
         if (lightDivider.process()) {
             float lightTime = args.sampleTime * lightDivider.getDivision();
-            lights[ENVELOPE_LIGHT].setBrightnessSmooth(std::pow(envelopeValue / 10.f, 2.f), lightTime);
+            float brightness = lightLevel / 10.f;
+            lights[ENVELOPE_LIGHT].setBrightnessSmooth(brightness * brightness, lightTime);
             lights[INVERT_LIGHT].setBrightness(invert * 0.5f);
         }
     }
 
     json_t *dataToJson() override {
         json_t *rootJ = json_object();
-        json_object_set_new(rootJ, "exponentialAttack", json_boolean(exponentialAttack));
-        json_object_set_new(rootJ, "retriggerStrategy", json_boolean(retriggerStrategy));
+        json_object_set_new(rootJ, "exponentialAttack", json_boolean(envelope.exponentialAttack));
+        json_object_set_new(rootJ, "retriggerStrategy", json_boolean(envelope.retriggerStrategy));
         json_object_set_new(rootJ, "retriggerEnabled", json_boolean(retriggerEnabled));
-        json_object_set_new(rootJ, "exponentType", json_integer(exponentType));
+        json_object_set_new(rootJ, "exponentType", json_integer(envelope.exponentType));
         json_object_set_new(rootJ, "triggerSyncDelay", json_integer(triggerSyncDelay));
         json_object_set_new(rootJ, "invert", json_boolean(invert));
         return rootJ;
@@ -317,13 +201,13 @@ struct Rich : Module {
 
     void dataFromJson(json_t *rootJ) override {
         json_t *expAttackJ = json_object_get(rootJ, "exponentialAttack");
-        if (expAttackJ) exponentialAttack = json_boolean_value(expAttackJ);
+        if (expAttackJ) envelope.exponentialAttack = json_boolean_value(expAttackJ);
         json_t *retriggerStrategyJ = json_object_get(rootJ, "retriggerStrategy");
-        if (retriggerStrategyJ) retriggerStrategy = json_boolean_value(retriggerStrategyJ);
+        if (retriggerStrategyJ) envelope.retriggerStrategy = json_boolean_value(retriggerStrategyJ);
         json_t *retriggerEnabledJ = json_object_get(rootJ, "retriggerEnabled");
         if (retriggerEnabledJ) retriggerEnabled = json_boolean_value(retriggerEnabledJ);
         json_t *exponentJ = json_object_get(rootJ, "exponentType");
-        if (exponentJ) exponentType = json_integer_value(exponentJ);
+        if (exponentJ) envelope.exponentType = json_integer_value(exponentJ);
         json_t *triggerSyncDelayJ = json_object_get(rootJ, "triggerSyncDelay");
         if (triggerSyncDelayJ) triggerSyncDelay = json_integer_value(triggerSyncDelayJ);
         json_t *invertJ = json_object_get(rootJ, "invert");
@@ -376,10 +260,10 @@ struct RichWidget : ModuleWidget {
         menu->addChild(createIndexPtrSubmenuItem("Attack Curve",
                                                  {"Logarithmic",
                                                   "Exponential"},
-                                                 &module->exponentialAttack));
+                                                 &module->envelope.exponentialAttack));
         menu->addChild(createIndexPtrSubmenuItem("Exponent Function",
                                                  {"Quadratic", "Cubic", "Quartic"},
-                                                 &module->exponentType));
+                                                 &module->envelope.exponentType));
         menu->addChild(createIndexPtrSubmenuItem("Retrigger",
                                                  {"Off",
                                                   "On"},
@@ -387,7 +271,7 @@ struct RichWidget : ModuleWidget {
         menu->addChild(createIndexPtrSubmenuItem("Retrigger Strategy",
                                                  {"I",
                                                   "II"},
-                                                 &module->retriggerStrategy));
+                                                 &module->envelope.retriggerStrategy));
         menu->addChild(createIndexPtrSubmenuItem("Trigger Sync Delay",
                                                  {"Off",
                                                   "5 samples",
@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include <rack.hpp>
+
+#include "FastMath.hpp"
+
+// Returns the attack phase at which the attack curve of Rich reaches value, for
+// retriggering from the current envelope level. The curve is
+// (1 - shape) * phase + shape * phase^(1 / exponent) for the logarithmic attack
+// and (1 - shape) * phase + shape * phase^exponent for the exponential one.
+//
+// With z = phase^(1 / exponent) for the logarithmic curve and z = phase for the
+// exponential one, the curve is a * z + b * z^exponent, increasing and convex
+// in z. Newton's method started above the root therefore approaches it from
+// above without overshooting, and four steps reach float precision for every
+// shape. bench/RichCheck.cpp checks the result against bisection and
+// bench/RichBench.cpp times it.
+inline float findAttackPhase(float value, float shape, int exponent, bool exponentialAttack) {
+    if (value <= 0.f) return 0.f;
+    if (value >= 1.f) return 1.f;
+    double a = exponentialAttack ? 1.f - shape : shape;
+    double b = 1.0 - a;
+    // Both a * z and z^exponent are at most the curve on [0, 1]
+    double z = std::pow(value, 1.f / exponent);
+    if (a * z > value) z = value / a;
+    // In double, so rounding in the steps and in phase = z^exponent does not
+    // add up to more than half an ulp of the result
+    for (int i = 0; i < 4; i++) {
+        double zPower = 1.0;  // z^(exponent - 1)
+        for (int k = 1; k < exponent; k++) zPower *= z;
+        double error = a * z + b * zPower * z - value;
+        z -= error / (a + exponent * b * zPower);
+    }
+    if (exponentialAttack) return (float)z;
+    double phase = z;
+    for (int k = 1; k < exponent; k++) phase *= z;
+    return (float)phase;
+}
+
+// The envelopes of Rich, up to 16 voices in groups of four, without the
+// trigger detection and the ports of the module, so bench/ can run them.
+// Channel c is lane c % 4 of group c / 4.
+struct RichEnvelope {
+    static constexpr float MIN_TIME = 1e-3f;
+    static constexpr float MAX_TIME = 10.f;
+    static constexpr float LAMBDA_BASE = MAX_TIME / MIN_TIME;
+    // log2(LAMBDA_BASE), so LAMBDA_BASE^x is exp2(x * LOG2_LAMBDA_BASE)
+    static constexpr float LOG2_LAMBDA_BASE = 13.28771238f;
+    static constexpr int ROOT_TABLE_SIZE = 256;
+
+    // Voice state, flags are 1 when set and 0 otherwise
+    rack::simd::float_4 phase[4] = {};
+
+    rack::simd::float_4 accentCounter[4] = {};
+    rack::simd::float_4 accent[4] = {1.f, 1.f, 1.f, 1.f};
+    rack::simd::float_4 accentScale[4] = {};
+    rack::simd::float_4 isAttacking[4] = {};
+    rack::simd::float_4 isDecaying[4] = {};
+    rack::simd::float_4 envelopeValue[4] = {};
+
+    // context menu variables
+    bool exponentialAttack = false;
+    bool retriggerStrategy = false;
+    int exponentType = 0;
+
+    // vars for retrigger strategy II
+    rack::simd::float_4 preserveAccent[4] = {};
+    rack::simd::float_4 preserveAccentValue[4] = {-1.f, -1.f, -1.f, -1.f};
+    rack::simd::float_4 preserveAccentScaleValue[4] = {-1.f, -1.f, -1.f, -1.f};
+
+    // retrigger strategy I
+    rack::simd::float_4 crossfadeValue[4] = {-1.f, -1.f, -1.f, -1.f};
+    rack::simd::float_4 crossfadePhase[4] = {};
+
+    // Rates of phase change, recomputed only when the time of a lane changes
+    struct LambdaCache {
+        rack::simd::float_4 time = -1.f;
+        rack::simd::float_4 lambda = 0.f;
+    };
+    LambdaCache attackLambdaCache[4];
+    LambdaCache decayLambdaCache[4];
+    LambdaCache crossfadeLambdaCache[4];
+
+    // q^(4/3) for q = k / ROOT_TABLE_SIZE, gives the cube root from the fourth root
+    float cubeRootTable[ROOT_TABLE_SIZE + 1];
+
+    RichEnvelope() {
+        for (int k = 0; k <= ROOT_TABLE_SIZE; k++) {
+            cubeRootTable[k] = std::pow((float)k / ROOT_TABLE_SIZE, 4.f / 3.f);
+        }
+    }
+
+    // Clears voice c when it starts playing
+    void resetVoice(int c) {
+        int g = c / 4, i = c % 4;
+        phase[g][i] = 0.f;
+        accentCounter[g][i] = 0.f;
+        accent[g][i] = 1.f;
+        accentScale[g][i] = 0.f;
+        isAttacking[g][i] = 0.f;
+        isDecaying[g][i] = 0.f;
+        envelopeValue[g][i] = 0.f;
+        preserveAccent[g][i] = 0.f;
+        preserveAccentValue[g][i] = -1.f;
+        preserveAccentScaleValue[g][i] = -1.f;
+        crossfadeValue[g][i] = -1.f;
+        crossfadePhase[g][i] = 0.f;
+    }
+
+    bool attacking(int c) const {
+        return isAttacking[c / 4][c % 4] > 0.f;
+    }
+
+    bool decaying(int c) const {
+        return isDecaying[c / 4][c % 4] > 0.f;
+    }
+
+    // Starts or retriggers the envelope of voice c. invert makes the accents
+    // descend.
+    void trigger(int c, float accentTriggerValue, float baseLevel, float accentLevel, float steps, float shape,
+                 bool invert) {
+        int g = c / 4, i = c % 4;
+        float nextAccent = 0.f;
+        float nextAccentCounter = 0.f;
+        float nextAccentScale = 0.f;
+
+        if (accentTriggerValue > 0.f && steps != 0.f) {
+            nextAccentCounter = rack::math::clamp(accentCounter[g][i] + 1, 1.f, std::abs(steps));
+            if (!invert) {
+                nextAccent = rack::math::clamp(nextAccentCounter / std::abs(steps), 0.f, 1.f);
+            } else {
+                nextAccent = rack::math::clamp((std::abs(steps) + 1 - nextAccentCounter) / std::abs(steps), 0.f, 1.f);
+            }
+
+            nextAccentScale = accentTriggerValue / 10.f;
+        }
+
+        if (isDecaying[g][i] > 0.f) {
+            // retrigger
+            float nextPeakValue;
+            if (steps >= 0.f) {
+                nextPeakValue = 10.f * (baseLevel + nextAccent * nextAccentScale * accentLevel * (1 - baseLevel));
+            } else {
+                nextPeakValue = 10.f * baseLevel * (1.f - nextAccent * nextAccentScale * accentLevel);
+            }
+
+            // Next peak value is higher than the current envelope value, retrigger is possible
+            if (nextPeakValue > envelopeValue[g][i]) {
+                preserveAccent[g][i] = 0.f;
+                preserveAccentValue[g][i] = -1.f;
+                preserveAccentScaleValue[g][i] = -1.f;
+
+                // Find phase value for the next envelope based on the current envelope value
+                float intermediaryEnvelopeValue = envelopeValue[g][i] / nextPeakValue;
+                phase[g][i] = findAttackPhase(intermediaryEnvelopeValue, shape, exponentType + 2, exponentialAttack);
+                isAttacking[g][i] = 1.f;
+                isDecaying[g][i] = 0.f;
+            } else {
+                // Strategy I: jump to decay phase of next envelope but
+                // crossfade last value of previous envelope value and new envelope value
+                // to avoid clicks
+                if (retriggerStrategy == false) {
+                    phase[g][i] = 1.f;
+                    isAttacking[g][i] = 0.f;
+                    isDecaying[g][i] = 1.f;
+                    crossfadeValue[g][i] = envelopeValue[g][i];
+                } else {
+                    // Strategy II: preserve accent value and scale until next suitable peak
+                    preserveAccent[g][i] = 1.f;
+                    if (preserveAccentValue[g][i] == -1.f) {
+                        preserveAccentValue[g][i] = accent[g][i];
+                        preserveAccentScaleValue[g][i] = accentScale[g][i];
+                    }
+                }
+            }
+        } else {
+            isAttacking[g][i] = 1.f;
+            isDecaying[g][i] = 0.f;
+        }
+        accentCounter[g][i] = nextAccentCounter;
+        accent[g][i] = nextAccent;
+        accentScale[g][i] = nextAccentScale;
+    }
+
+    // Returns the rate of phase change for a time
+    rack::simd::float_4 getLambda(LambdaCache& cache, rack::simd::float_4 time) {
+        if (rack::simd::movemask(time != cache.time)) {
+            cache.time = time;
+            cache.lambda = fastmath::exp2(-time * LOG2_LAMBDA_BASE) / MIN_TIME;
+        }
+        return cache.lambda;
+    }
+
+    // x^(1 / EXPONENT) for x in [0, 1]. Square and fourth roots are exact, the
+    // cube root interpolates q^(4/3) from the fourth root q, which is smooth
+    // enough near 0 for a small table.
+    template <int EXPONENT>
+    rack::simd::float_4 root(rack::simd::float_4 x) {
+        rack::simd::float_4 q = rack::simd::sqrt(rack::simd::clamp(x, 0.f, 1.f));
+        if (EXPONENT == 2) return q;
+        q = rack::simd::sqrt(q);
+        if (EXPONENT == 4) return q;
+
+        rack::simd::float_4 position = q * ROOT_TABLE_SIZE;
+        rack::simd::float_4 index = rack::simd::fmin(rack::simd::floor(position), ROOT_TABLE_SIZE - 1);
+        rack::simd::float_4 frac = position - index;
+        rack::simd::int32_4 i(index);
+        rack::simd::float_4 a, b;
+        for (int k = 0; k < 4; k++) {
+            a[k] = cubeRootTable[i[k]];
+            b[k] = cubeRootTable[i[k] + 1];
+        }
+        return a + (b - a) * frac;
+    }
+
+    // The exponential curve of the envelope, phase^EXPONENT, or its root for a
+    // logarithmic attack
+    template <int EXPONENT>
+    rack::simd::float_4 shapeEnvelope(rack::simd::float_4 phase, rack::simd::float_4 attacking) {
+        rack::simd::float_4 power = phase;
+        for (int k = 1; k < EXPONENT; k++) power *= phase;
+        if (exponentialAttack || !rack::simd::movemask(attacking))
+            return power;
+        return rack::simd::ifelse(attacking, root<EXPONENT>(phase), power);
+    }
+
+    // Advances the voices of group g by deltaTime and returns their envelope.
+    // attack and decay are times from 0 to 1, accentOutput is set to the
+    // accent of each voice from 0 to 1.
+    rack::simd::float_4 process(int g, float deltaTime, rack::simd::float_4 attack, rack::simd::float_4 decay,
+                                float baseLevel, float accentLevel, float steps, float shape,
+                                rack::simd::float_4& accentOutput) {
+        using rack::simd::float_4;
+
+        // Process the decay stage
+        float_4 decaying = isDecaying[g] > 0.f;
+        float_4 decayForCrossfade = rack::simd::ifelse(decaying, decay, 0.f);
+        if (rack::simd::movemask(decaying)) {
+            phase[g] = rack::simd::ifelse(decaying, phase[g] - deltaTime * getLambda(decayLambdaCache[g], decay), phase[g]);
+            float_4 decayEnded = decaying & (phase[g] <= 0.f);
+            phase[g] = rack::simd::ifelse(decayEnded, 0.f, phase[g]);
+            isDecaying[g] = rack::simd::ifelse(decayEnded, 0.f, isDecaying[g]);
+        }
+
+        // Process the attack stage
+        float_4 attacking = isAttacking[g] > 0.f;
+        if (rack::simd::movemask(attacking)) {
+            phase[g] = rack::simd::ifelse(attacking, phase[g] + deltaTime * getLambda(attackLambdaCache[g], attack), phase[g]);
+            float_4 attackEnded = attacking & (phase[g] >= 1.f);
+            phase[g] = rack::simd::ifelse(attackEnded, 1.f, phase[g]);
+            isAttacking[g] = rack::simd::ifelse(attackEnded, 0.f, isAttacking[g]);
+            isDecaying[g] = rack::simd::ifelse(attackEnded, 1.f, isDecaying[g]);
+            attacking = isAttacking[g] > 0.f;
+        }
+
+        //----------- Merging envelopes ---------------
+
+        float_4 expEnvelope;
+        switch (exponentType) {
+            case 0: expEnvelope = shapeEnvelope<2>(phase[g], attacking); break;
+            case 1: expEnvelope = shapeEnvelope<3>(phase[g], attacking); break;
+            default: expEnvelope = shapeEnvelope<4>(phase[g], attacking); break;
+        }
+
+        float_4 envelopeMix = (1.f - shape) * phase[g] + shape * expEnvelope;
+
+        // -------------
+
+        // Retrigger strategy II
+
+        float_4 preserving = preserveAccent[g] > 0.f;
+        float_4 usedAccent = rack::simd::ifelse(preserving, preserveAccentValue[g], accent[g]);
+        float_4 usedAccentScale = rack::simd::ifelse(preserving, preserveAccentScaleValue[g], accentScale[g]);
+
+        // Envelope update
+
+        float_4 envelope;
+        if (steps >= 0.f) {
+            envelope = envelopeMix * 10.f * (baseLevel + usedAccent * usedAccentScale * accentLevel * (1 - baseLevel));
+        } else {
+            envelope = envelopeMix * 10.f * baseLevel * (1.f - usedAccent * usedAccentScale * accentLevel);
+        }
+
+        // Retrigger Strategy I
+        float_4 crossfading = crossfadeValue[g] != -1.f;
+        if (rack::simd::movemask(crossfading)) {
+            float_4 crossfadeLambda = getLambda(crossfadeLambdaCache[g], decayForCrossfade * 0.55f);
+            crossfadePhase[g] = rack::simd::ifelse(crossfading, crossfadePhase[g] + deltaTime * crossfadeLambda, crossfadePhase[g]);
+            float_4 crossfadeEnded = crossfading & (crossfadePhase[g] > 1.f);
+            crossfadeValue[g] = rack::simd::ifelse(crossfadeEnded, -1.f, crossfadeValue[g]);
+            crossfadePhase[g] = rack::simd::ifelse(crossfadeEnded, 0.f, crossfadePhase[g]);
+            float_4 crossfaded = crossfadeValue[g] + (envelope - crossfadeValue[g]) * crossfadePhase[g];
+            envelope = rack::simd::ifelse(crossfadeValue[g] != -1.f, crossfaded, envelope);
+        }
+        envelopeValue[g] = envelope;
+
+        accentOutput = usedAccent * usedAccentScale;
+        return envelope;
+    }
+};
@@ -0,0 +1,29 @@
+#pragma once
+
+// Puts a voice to sleep once its input and state have stayed below a threshold
+// for a hold time, and wakes it as soon as they no longer are. Modules skip the
+// processing of sleeping voices and output silence.
+struct SilenceDetector {
+    // Levels below this are treated as silence, about -100 dB relative to 10V
+    static constexpr float THRESHOLD = 1e-4f;
+
+    int quietFrames = 0;
+    bool asleep = false;
+
+    // Returns whether the voice sleeps this frame. holdFrames is how long
+    // quiet has to last before it does.
+    bool process(bool quiet, int holdFrames) {
+        if (!quiet) {
+            quietFrames = 0;
+            asleep = false;
+        } else if (!asleep && ++quietFrames >= holdFrames) {
+            asleep = true;
+        }
+        return asleep;
+    }
+
+    void reset() {
+        quietFrames = 0;
+        asleep = false;
+    }
+};
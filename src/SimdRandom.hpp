@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+
+#include <rack.hpp>
+
+// Four independent xoshiro128+ generators, one per simd::float_4 lane. Each
+// call advances all four and returns one value per lane.
+struct SimdRandom {
+    // Word k of the state of lane i is s[k][i]
+    rack::simd::int32_4 s[4];
+
+    SimdRandom() {
+        seed(0);
+    }
+
+    // Fills the state from a 64-bit seed with splitmix64, which never leaves a
+    // lane all zero
+    void seed(uint64_t x) {
+        for (int k = 0; k < 4; k++) {
+            for (int i = 0; i < 4; i += 2) {
+                x += 0x9e3779b97f4a7c15ull;
+                uint64_t z = x;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                z ^= z >> 31;
+                s[k][i] = (int32_t)(uint32_t)z;
+                s[k][i + 1] = (int32_t)(uint32_t)(z >> 32);
+            }
+        }
+    }
+
+    // Logical right shift, whatever the shift of int32_4 does with the sign
+    static rack::simd::int32_4 shiftRight(rack::simd::int32_4 x, int k) {
+        return (x >> k) & (int32_t)(0xffffffffu >> k);
+    }
+
+    static rack::simd::int32_4 rotateLeft(rack::simd::int32_4 x, int k) {
+        return (x << k) | shiftRight(x, 32 - k);
+    }
+
+    rack::simd::int32_4 next() {
+        rack::simd::int32_4 result = s[0] + s[3];
+        rack::simd::int32_4 t = s[1] << 9;
+        s[2] = s[2] ^ s[0];
+        s[3] = s[3] ^ s[1];
+        s[1] = s[1] ^ s[2];
+        s[0] = s[0] ^ s[3];
+        s[2] = s[2] ^ t;
+        s[3] = rotateLeft(s[3], 11);
+        return result;
+    }
+
+    // Uniform in [0, 1), from the top 23 bits, which are the best ones of
+    // xoshiro128+
+    rack::simd::float_4 uniform() {
+        rack::simd::int32_4 bits = shiftRight(next(), 9) | 0x3f800000;
+        return rack::simd::float_4::cast(bits) - 1.f;
+    }
+
+    // Standard normal by Box-Muller, using the cosine half only
+    rack::simd::float_4 normal() {
+        rack::simd::float_4 u1 = 1.f - uniform();  // (0, 1]
+        rack::simd::float_4 u2 = uniform();
+        rack::simd::float_4 r = rack::simd::sqrt(-2.f * rack::simd::log(u1));
+        return r * rack::simd::cos(2.f * (float)M_PI * u2);
+    }
+};
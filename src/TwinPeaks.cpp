@@ -1,7 +1,98 @@
+#include <atomic>
+
+#include "BlockBuffer.hpp"
+#include "Profiler.hpp"
+#include "SilenceDetector.hpp"
 #include "components.hpp"
 #include "filter/ripples.hpp"
 #include "plugin.hpp"
 
+// The engines of all voices, four voices per engine, for one type of
+// anti-aliasing filter
+struct TwinPeaksEngines {
+    virtual ~TwinPeaksEngines() {}
+    virtual void setSampleRate(float sampleRate, ripples::Quality quality) = 0;
+    virtual void setProfiler(Profiler* profiler, int antiAliasingStage, int coreStage) = 0;
+    virtual void resetAntiAliasing() = 0;
+    // Runs one sample of voices 4 * g ... 4 * g + 3 through filter B, then
+    // through filter A with the output of B for cross FM. Returns the output of
+    // the pair.
+    virtual simd::float_4 process(int g, ripples::RipplesPolyFrame& frameA, ripples::RipplesPolyFrame& frameB, float curve) = 0;
+    virtual simd::float_4 getStateLevel(int g) = 0;
+    virtual simd::float_4 canSelfOscillate(int g, const ripples::RipplesPolyFrame& frameB) = 0;
+    virtual void clearState(int g) = 0;
+    virtual void getCoreState(int g, ripples::RipplesCoreState& stateA, ripples::RipplesCoreState& stateB) = 0;
+    virtual void setCoreState(int g, const ripples::RipplesCoreState& stateA, const ripples::RipplesCoreState& stateB) = 0;
+
+    // Continues the filters of other through the anti-aliasing filters of these
+    // engines
+    void copyState(TwinPeaksEngines& other) {
+        for (int g = 0; g < 4; g++) {
+            ripples::RipplesCoreState stateA, stateB;
+            other.getCoreState(g, stateA, stateB);
+            setCoreState(g, stateA, stateB);
+        }
+    }
+};
+
+// Final, so that processing through the concrete type is inlined
+template <template <typename> class AntiAliasingFilter>
+struct TwinPeaksEnginesWith final : TwinPeaksEngines {
+    ripples::RipplesPolyEngine<AntiAliasingFilter> enginesA[4];
+    ripples::RipplesPolyEngine<AntiAliasingFilter> enginesB[4];
+
+    void setSampleRate(float sampleRate, ripples::Quality quality) override {
+        for (int g = 0; g < 4; g++) {
+            enginesA[g].setSampleRate(sampleRate, quality);
+            enginesB[g].setSampleRate(sampleRate, quality);
+        }
+    }
+
+    void setProfiler(Profiler* profiler, int antiAliasingStage, int coreStage) override {
+        for (int g = 0; g < 4; g++) {
+            enginesA[g].setProfiler(profiler, antiAliasingStage, coreStage);
+            enginesB[g].setProfiler(profiler, antiAliasingStage, coreStage);
+        }
+    }
+
+    void resetAntiAliasing() override {
+        for (int g = 0; g < 4; g++) {
+            enginesA[g].resetAntiAliasing();
+            enginesB[g].resetAntiAliasing();
+        }
+    }
+
+    simd::float_4 process(int g, ripples::RipplesPolyFrame& frameA, ripples::RipplesPolyFrame& frameB, float curve) override {
+        enginesB[g].process(frameB);
+        frameA.b_output = frameB.output;
+        enginesA[g].process(frameA);
+        return frameA.output - curve * frameB.output;
+    }
+
+    simd::float_4 getStateLevel(int g) override {
+        return simd::fmax(enginesA[g].getStateLevel(), enginesB[g].getStateLevel());
+    }
+
+    simd::float_4 canSelfOscillate(int g, const ripples::RipplesPolyFrame& frameB) override {
+        return enginesB[g].canSelfOscillate(frameB);
+    }
+
+    void clearState(int g) override {
+        enginesA[g].clearState();
+        enginesB[g].clearState();
+    }
+
+    void getCoreState(int g, ripples::RipplesCoreState& stateA, ripples::RipplesCoreState& stateB) override {
+        stateA = enginesA[g].getCoreState();
+        stateB = enginesB[g].getCoreState();
+    }
+
+    void setCoreState(int g, const ripples::RipplesCoreState& stateA, const ripples::RipplesCoreState& stateB) override {
+        enginesA[g].setCoreState(stateA);
+        enginesB[g].setCoreState(stateB);
+    }
+};
+
 struct TwinPeaks : Module {
     enum ParamIds {
         FREQ_A_PARAM,
@@ -39,8 +130,49 @@ struct TwinPeaks : Module {
         NUM_LIGHTS
     };
 
-    ripples::RipplesEngine enginesA[16];
-    ripples::RipplesEngine enginesB[16];
+    // Anti-aliasing quality, a ripples::Quality or LINEAR_PHASE for the
+    // polyphase FIR filters at High quality. Applied by process() so the
+    // engines are only reconfigured on the audio thread.
+    //
+    // A change moves the voices to another engine set, which continues the
+    // filter state with the new anti-aliasing filters, and fades over to it in
+    // FADE_TIME while both run. Reinitializing the filters in place would click.
+    // There are two sets with the elliptic filters, so that one can fade into the
+    // other. The FIR set is much larger, so it is allocated on the UI thread the
+    // first time LINEAR_PHASE is selected and kept from then on.
+    typedef TwinPeaksEnginesWith<ripples::AAFilter> EllipticEngines;
+    typedef TwinPeaksEnginesWith<ripples::PolyphaseAAFilter> LinearPhaseEngines;
+    static constexpr int LINEAR_PHASE = ripples::kQualityHigh + 1;
+    static constexpr float FADE_TIME = 0.01f;
+    int quality = ripples::kQualityHigh;
+    int engineQuality = ripples::kQualityHigh;
+    EllipticEngines ellipticEngines[2];
+    std::atomic<TwinPeaksEngines*> linearPhaseEngines{nullptr};
+    TwinPeaksEngines* engines = &ellipticEngines[0];
+    // The set being faded out, null when no change is in progress
+    TwinPeaksEngines* fadingEngines = nullptr;
+    int fadePosition = 0;
+    int fadeFrames = 1;
+
+    // Each group of four voices sleeps while its input and filters are silent.
+    // With keepSelfOscillation it stays awake while any of its voices has
+    // enough resonance to start oscillating on its own.
+    SilenceDetector silenceDetectors[4];
+    bool sleepWhenSilent = true;
+    bool keepSelfOscillation = true;
+
+    // The input is filtered in blocks of blockSizes[blockSize] frames, see
+    // BlockBuffer. Knobs and CV are read once per block.
+    const int blockSizes[4] = {1, 8, 16, 32};
+    int blockSize = 0;
+    BlockBuffer<1, 1> block;
+
+    // Resampling filters and filter cores of all engines, see Profiler.hpp
+    enum ProfilerStages {
+        ANTI_ALIASING_STAGE,
+        CORE_STAGE
+    };
+    Profiler profiler;
 
     TwinPeaks() {
         config(NUM_PARAMS, NUM_INPUTS, NUM_OUTPUTS, NUM_LIGHTS);
@@ -73,6 +205,26 @@ struct TwinPeaks : Module {
 
         configOutput(OUT_OUTPUT, "Audio");
         configBypass(IN_INPUT, OUT_OUTPUT);
+
+        profiler.addStage("Anti-aliasing");
+        profiler.addStage("Filter core");
+        for (TwinPeaksEngines& set : ellipticEngines) {
+            set.setProfiler(&profiler, ANTI_ALIASING_STAGE, CORE_STAGE);
+        }
+    }
+
+    ~TwinPeaks() {
+        delete linearPhaseEngines.load();
+    }
+
+    // UI thread, before quality is set to LINEAR_PHASE
+    void allocateLinearPhaseEngines() {
+        if (linearPhaseEngines.load())
+            return;
+        TwinPeaksEngines* set = new LinearPhaseEngines;
+        set->setProfiler(&profiler, ANTI_ALIASING_STAGE, CORE_STAGE);
+        set->setSampleRate(APP->engine->getSampleRate(), ripples::kQualityHigh);
+        linearPhaseEngines.store(set, std::memory_order_release);
     }
 
     void onReset() override {
@@ -81,17 +233,62 @@ struct TwinPeaks : Module {
 
     void onSampleRateChange() override {
         // TODO In Rack v2, replace with args.sampleRate
-        for (int c = 0; c < 16; c++) {
-            enginesA[c].setSampleRate(APP->engine->getSampleRate());
-            enginesB[c].setSampleRate(APP->engine->getSampleRate());
+        float sampleRate = APP->engine->getSampleRate();
+        // The FIR kernels are designed here rather than on a quality change
+        TwinPeaksEngines* linearPhase = linearPhaseEngines.load(std::memory_order_acquire);
+        if (linearPhase)
+            linearPhase->setSampleRate(sampleRate, ripples::kQualityHigh);
+        if (quality == LINEAR_PHASE && linearPhase) {
+            engines = linearPhase;
+            engineQuality = LINEAR_PHASE;
+        } else {
+            if (engines == linearPhase)
+                engines = &ellipticEngines[0];
+            engineQuality = std::min(quality, (int)ripples::kQualityHigh);
+            engines->setSampleRate(sampleRate, (ripples::Quality)engineQuality);
+        }
+        fadingEngines = nullptr;
+    }
+
+    // Engine thread
+    void changeQuality(float sampleRate) {
+        TwinPeaksEngines* next;
+        if (quality == LINEAR_PHASE) {
+            next = linearPhaseEngines.load(std::memory_order_acquire);
+            if (!next)
+                return;
+            next->resetAntiAliasing();
+        } else {
+            next = (engines == &ellipticEngines[0]) ? &ellipticEngines[1] : &ellipticEngines[0];
+            next->setSampleRate(sampleRate, (ripples::Quality)quality);
         }
+        next->copyState(*engines);
+        fadingEngines = engines;
+        engines = next;
+        engineQuality = quality;
+        fadePosition = 0;
+        fadeFrames = std::max((int)(FADE_TIME * sampleRate), 1);
     }
 
     void process(const ProcessArgs& args) override {
-        int channels = std::max(inputs[IN_INPUT].getChannels(), 1);
+        if (quality != engineQuality && !fadingEngines)
+            changeQuality(args.sampleRate);
+
+        block.setFrames(blockSizes[blockSize]);
+        block.push(0, inputs[IN_INPUT]);
+        if (block.ready())
+            processBlock(args.sampleRate);
+        block.pull(0, outputs[OUT_OUTPUT]);
+        block.advance();
+    }
+
+    // Filters the buffered block of input, with the controls read once
+    void processBlock(float sampleRate) {
+        profiler.addSamples(block.frames);
+        int channels = std::max(block.inputChannels[0], 1);
 
         // Filter A Frame
-        ripples::RipplesEngine::Frame frameA;
+        ripples::RipplesPolyFrame frameA;
         frameA.res_knob = params[RES_PARAM].getValue();
         frameA.freq_knob = rescale(params[FREQ_A_PARAM].getValue(), std::log2(ripples::kFreqKnobMin), std::log2(ripples::kFreqKnobMax), 0.f, 1.f);
         frameA.fm_knob = params[FM_CV_A_PARAM].getValue();
@@ -101,7 +298,7 @@ struct TwinPeaks : Module {
         frameA.mode = (int)params[TYPE_SWITCH].getValue() + 2.f;
 
         // Filter B Frame
-        ripples::RipplesEngine::Frame frameB;
+        ripples::RipplesPolyFrame frameB;
         frameB.res_knob = params[RES_PARAM].getValue();
         frameB.freq_knob = rescale(params[FREQ_B_PARAM].getValue(), std::log2(ripples::kFreqKnobMin), std::log2(ripples::kFreqKnobMax), 0.f, 1.f);
         frameB.fm_knob = params[FM_CV_B_PARAM].getValue();
@@ -114,27 +311,108 @@ struct TwinPeaks : Module {
             params[CURVE_B_PARAM].getValue() + params[CURVE_B_CV_PARAM].getValue() * inputs[CURVE_B_INPUT].getVoltage() * 0.1f,
             0.f, 1.f);
 
-        for (int c = 0; c < channels; c++) {
-            float res_cv = inputs[RES_INPUT].getPolyVoltage(c) * params[RES_CV_PARAM].getValue();
-            float input = inputs[IN_INPUT].getVoltage(c);
-            frameB.res_cv = res_cv;
-            frameB.freq_cv = inputs[FREQ_B_INPUT].getPolyVoltage(c);
-            frameB.fm_cv = (inputs[FM_CV_B_INPUT].isConnected()) ? inputs[FM_CV_B_INPUT].getPolyVoltage(c) : inputs[FM_CV_A_INPUT].getPolyVoltage(c);
-            frameB.input = input;
+        int holdFrames = (int)(0.1f * sampleRate);
 
-            enginesB[c].process(frameB);
+        // Dispatched once per block rather than per sample
+        if (engineQuality == LINEAR_PHASE)
+            processVoices(*static_cast<LinearPhaseEngines*>(engines), frameA, frameB, curve, holdFrames, channels);
+        else
+            processVoices(*static_cast<EllipticEngines*>(engines), frameA, frameB, curve, holdFrames, channels);
+
+        if (fadingEngines) {
+            fadePosition += block.frames;
+            if (fadePosition >= fadeFrames)
+                fadingEngines = nullptr;
+        }
+
+        block.setOutputChannels(0, channels);
+    }
 
+    template <class Engines>
+    void processVoices(Engines& active, ripples::RipplesPolyFrame& frameA, ripples::RipplesPolyFrame& frameB,
+                       float curve, int holdFrames, int channels) {
+        for (int c = 0; c < channels; c += 4) {
+            int g = c / 4;
+            SilenceDetector& detector = silenceDetectors[g];
+            if (!sleepWhenSilent)
+                detector.reset();
+
+            simd::float_4 res_cv = inputs[RES_INPUT].getPolyVoltageSimd<simd::float_4>(c) * params[RES_CV_PARAM].getValue();
+            frameB.res_cv = res_cv;
+            frameB.freq_cv = inputs[FREQ_B_INPUT].getPolyVoltageSimd<simd::float_4>(c);
+            frameB.fm_cv = (inputs[FM_CV_B_INPUT].isConnected()) ? inputs[FM_CV_B_INPUT].getPolyVoltageSimd<simd::float_4>(c) : inputs[FM_CV_A_INPUT].getPolyVoltageSimd<simd::float_4>(c);
             frameA.res_cv = res_cv;
-            frameA.freq_cv = inputs[FREQ_A_INPUT].getPolyVoltage(c);
-            frameA.fm_cv = inputs[FM_CV_A_INPUT].getPolyVoltage(c);
-            frameA.input = input;
-            frameA.b_output = frameB.output;
-            enginesA[c].process(frameA);
+            frameA.freq_cv = inputs[FREQ_A_INPUT].getPolyVoltageSimd<simd::float_4>(c);
+            frameA.fm_cv = inputs[FM_CV_A_INPUT].getPolyVoltageSimd<simd::float_4>(c);
+            bool canSelfOscillate = sleepWhenSilent && keepSelfOscillation &&
+                                    simd::movemask(active.canSelfOscillate(g, frameB)) != 0;
+
+            for (int i = 0; i < block.frames; i++) {
+                simd::float_4 input = simd::float_4::load(&block.in[0][i][c]);
+
+                if (sleepWhenSilent) {
+                    simd::float_4 level = simd::fmax(simd::abs(input), active.getStateLevel(g));
+                    if (fadingEngines)
+                        level = simd::fmax(level, fadingEngines->getStateLevel(g));
+                    bool quiet = !canSelfOscillate && simd::movemask(level >= SilenceDetector::THRESHOLD) == 0;
+                    bool wasAsleep = detector.asleep;
+                    if (detector.process(quiet, holdFrames)) {
+                        if (!wasAsleep) {
+                            active.clearState(g);
+                            if (fadingEngines)
+                                fadingEngines->clearState(g);
+                        }
+                        simd::float_4(0.f).store(&block.out[0][i][c]);
+                        continue;
+                    }
+                }
+
+                frameA.input = input;
+                frameB.input = input;
+                simd::float_4 output = active.process(g, frameA, frameB, curve);
+
+                if (fadingEngines) {
+                    ripples::RipplesPolyFrame fadingFrameA = frameA;
+                    ripples::RipplesPolyFrame fadingFrameB = frameB;
+                    simd::float_4 fadingOutput = fadingEngines->process(g, fadingFrameA, fadingFrameB, curve);
+                    float fade = std::min((float)(fadePosition + i + 1) / fadeFrames, 1.f);
+                    output = fadingOutput + (output - fadingOutput) * fade;
+                }
+
+                simd::clamp(output, -12.f, 12.f).store(&block.out[0][i][c]);
+            }
+        }
+    }
+
+    json_t* dataToJson() override {
+        json_t* rootJ = json_object();
+        json_object_set_new(rootJ, "quality", json_integer(quality));
+        json_object_set_new(rootJ, "sleepWhenSilent", json_boolean(sleepWhenSilent));
+        json_object_set_new(rootJ, "keepSelfOscillation", json_boolean(keepSelfOscillation));
+        json_object_set_new(rootJ, "blockSize", json_integer(blockSize));
+        return rootJ;
+    }
 
-            outputs[OUT_OUTPUT].setVoltage(clamp(frameA.output - curve * frameB.output, -12.f, 12.f), c);
+    void dataFromJson(json_t* rootJ) override {
+        json_t* qualityJ = json_object_get(rootJ, "quality");
+        if (qualityJ) {
+            int newQuality = clamp((int)json_integer_value(qualityJ), (int)ripples::kQualityEco, LINEAR_PHASE);
+            if (newQuality == LINEAR_PHASE)
+                allocateLinearPhaseEngines();
+            quality = newQuality;
         }
 
-        outputs[OUT_OUTPUT].setChannels(channels);
+        json_t* sleepJ = json_object_get(rootJ, "sleepWhenSilent");
+        if (sleepJ)
+            sleepWhenSilent = json_boolean_value(sleepJ);
+
+        json_t* keepSelfOscillationJ = json_object_get(rootJ, "keepSelfOscillation");
+        if (keepSelfOscillationJ)
+            keepSelfOscillation = json_boolean_value(keepSelfOscillationJ);
+
+        json_t* blockSizeJ = json_object_get(rootJ, "blockSize");
+        if (blockSizeJ)
+            blockSize = clamp((int)json_integer_value(blockSizeJ), 0, 3);
     }
 };
 
@@ -174,6 +452,27 @@ struct TwinPeaksWidget : ModuleWidget {
         addInput(createInputCentered<ThemedPJ301MPort>(Vec(112.5, 329.25), module, TwinPeaks::FREQ_B_INPUT));
         addOutput(createOutputCentered<ThemedPJ301MPort>(Vec(157.5, 329.25), module, TwinPeaks::OUT_OUTPUT));
     }
+
+    void appendContextMenu(Menu* menu) override {
+        TwinPeaks* module = dynamic_cast<TwinPeaks*>(this->module);
+        assert(module);
+        menu->addChild(new MenuSeparator);
+        menu->addChild(createIndexSubmenuItem(
+            "Quality", {"Eco", "Standard", "High", "Linear phase"},
+            [=]() { return module->quality; },
+            [=](size_t index) {
+                if ((int)index == TwinPeaks::LINEAR_PHASE)
+                    module->allocateLinearPhaseEngines();
+                module->quality = index;
+            }));
+        menu->addChild(createBoolPtrMenuItem("Sleep When Silent", "", &module->sleepWhenSilent));
+        menu->addChild(createBoolPtrMenuItem("Keep Self-Oscillation", "", &module->keepSelfOscillation));
+        menu->addChild(createIndexPtrSubmenuItem("Block Processing",
+                                                 {"Off", "8 samples", "16 samples", "32 samples"},
+                                                 &module->blockSize));
+
+        appendProfilerMenu(menu, &module->profiler);
+    }
 };
 
 Model* modelTwinPeaks = createModel<TwinPeaks, TwinPeaksWidget>("TwinPeaks");
@@ -21,13 +21,29 @@
 namespace ripples
 {
 
+// Anti-aliasing quality, trading rejection of aliases for CPU
+enum Quality
+{
+    kQualityEco,
+    kQualityStandard,
+    kQualityHigh,
+};
+
 template <typename T>
 class AAFilter
 {
 public:
-    void Init(float sample_rate)
+    // Selects the coefficient table for sample_rate and quality. The tables
+    // are static and shared by every filter, only the history is per filter.
+    void Init(float sample_rate, Quality quality = kQualityHigh)
     {
-        InitFilter(sample_rate);
+        InitFilter(sample_rate, quality);
+    }
+
+    void Reset()
+    {
+        up_filter_.Reset();
+        down_filter_.Reset();
     }
 
     T ProcessUp(T in)
@@ -58,8 +74,6 @@ protected:
     from scipy import signal
     import math
 
-    min_oversampled_rate = 20000 * 6
-
     common_rates = [
         8000,
         11025, 12000,
@@ -71,39 +85,51 @@ protected:
         705600, 768000
     ]
 
-    fp = 20000 # passband corner in Hz
     rp = 0.1 # passband ripple in dB
-    rs = 100 # stopband attenuation in dB
 
-    array_name = 'kFilter'
-    cascades = []
+    # High is the original design. Standard relaxes the stopband, which
+    # lowers the filter orders. Eco also lowers the oversampled rate, e.g.
+    # 2x instead of 3x at 44.1 kHz, and narrows the passband to keep the
+    # transition band wide enough for a low order.
+    qualities = [
+        # (name, array name, min oversampled rate, passband corner in Hz,
+        #  stopband attenuation in dB)
+        ('Eco', 'kFilterEco', 20000 * 4, 16000, 60),
+        ('Standard', 'kFilterStandard', 20000 * 6, 20000, 60),
+        ('High', 'kFilter', 20000 * 6, 20000, 100),
+    ]
+
+    cascades = {}
     max_num_sections = 0
 
-    for fs in common_rates:
-        factor = math.ceil(min_oversampled_rate / fs)
-        wp = fp / fs
-        ws = 0.5
+    for (quality, array_name, min_oversampled_rate, fp, rs) in qualities:
+        cascades[quality] = []
+
+        for fs in common_rates:
+            factor = math.ceil(min_oversampled_rate / fs)
+            wp = fp / fs
+            ws = 0.5
 
-        n, wc = signal.ellipord(wp*2/factor, ws*2/factor, rp, rs)
+            n, wc = signal.ellipord(wp*2/factor, ws*2/factor, rp, rs)
 
-        # We are using second-order sections, so if the filter order would have
-        # been odd, we can bump it up by 1 for 'free'
-        n = 2 * int(math.ceil(n / 2))
+            # We are using second-order sections, so if the filter order would
+            # have been odd, we can bump it up by 1 for 'free'
+            n = 2 * int(math.ceil(n / 2))
 
-        # Non-oversampled sampling rates result in 0-order filters, since there
-        # is no spectral content above fs/2. Bump these up to order 2 so we
-        # get some rolloff.
-        n = max(2, n)
-        z, p, k = signal.ellip(n, rp, rs, wc, output='zpk')
+            # Non-oversampled sampling rates result in 0-order filters, since
+            # there is no spectral content above fs/2. Bump these up to order 2
+            # so we get some rolloff.
+            n = max(2, n)
+            z, p, k = signal.ellip(n, rp, rs, wc, output='zpk')
 
-        if n % 2 == 0:
-            # DC gain is -rp for even-order filters, so amplify by rp
-            k *= math.pow(10, rp / 20)
-        sos = signal.zpk2sos(z, p, k)
-        max_num_sections = max(max_num_sections, len(sos))
+            if n % 2 == 0:
+                # DC gain is -rp for even-order filters, so amplify by rp
+                k *= math.pow(10, rp / 20)
+            sos = signal.zpk2sos(z, p, k)
+            max_num_sections = max(max_num_sections, len(sos))
 
-        cascade = (fs, factor, n, wc, sos)
-        cascades.append(cascade)
+            cascade = (fs, factor, n, wc, sos)
+            cascades[quality].append(cascade)
 
     cog.outl('static constexpr int kMaxNumSections = {};'
         .format(max_num_sections))
@@ -115,36 +141,401 @@ protected:
     SOSFilter<T, kMaxNumSections> down_filter_;
     int oversampling_factor_;
 
-    void InitFilter(float sample_rate)
+    void InitFilter(float sample_rate, Quality quality)
     {
-        if (false) {}
-        /*[[[cog
-        for cascade in reversed(cascades):
+        switch (quality)
+        {
+            case kQualityEco: InitFilterEco(sample_rate); break;
+            case kQualityStandard: InitFilterStandard(sample_rate); break;
+            default: InitFilterHigh(sample_rate); break;
+        }
+    }
+
+    /*[[[cog
+    for (quality, array_name, _, _, _) in qualities:
+        cog.outl('void InitFilter{}(float sample_rate)'.format(quality))
+        cog.outl('{')
+        cog.outl('    if (false) {}')
+        for cascade in reversed(cascades[quality]):
             (fs, factor, order, wc, sos) = cascade
             num_sections = len(sos)
             name = '{:s}{:d}x{:d}'.format(array_name, fs, factor)
             cost = fs * factor * num_sections
 
-            cog.outl('else if ({} <= sample_rate)'.format(fs))
-            cog.outl('{')
-            cog.outl('    const SOSCoefficients {:s}[{:d}] ='
+            cog.outl('    else if ({} <= sample_rate)'.format(fs))
+            cog.outl('    {')
+            cog.outl('        static const SOSCoefficients {:s}[{:d}] ='
                 ' // n = {:d}, wc = {:f}, cost = {:d}'
                 .format(name, num_sections, order, wc, cost))
-            cog.outl('    {')
+            cog.outl('        {')
             for sec in sos:
                 b = ''.join(['{:.8e},'.format(c).ljust(17) for c in sec[:3]])
                 a = ''.join(['{:.8e},'.format(c).ljust(17) for c in sec[4:]])
-                cog.outl('        { {' + b + '}, {' + a + '} },')
-            cog.outl('    };')
-            cog.outl('    up_filter_.Init({}, {});'.format(num_sections, name))
-            cog.outl('    down_filter_.Init({}, {});'.format(num_sections, name))
-            cog.outl('    oversampling_factor_ = {};'.format(factor))
-            cog.outl('}')
-        cog.outl('else {{ InitFilter({}); }}'.format(*cascades[0]))
-        ]]]*/
+                cog.outl('            { {' + b + '}, {' + a + '} },')
+            cog.outl('        };')
+            cog.outl('        up_filter_.Init({}, {});'
+                .format(num_sections, name))
+            cog.outl('        down_filter_.Init({}, {});'
+                .format(num_sections, name))
+            cog.outl('        oversampling_factor_ = {};'.format(factor))
+            cog.outl('    }')
+        cog.outl('    else {{ InitFilter{}({}); }}'
+            .format(quality, cascades[quality][0][0]))
+        cog.outl('}')
+        if quality != qualities[-1][0]:
+            cog.outl('')
+    ]]]*/
+    void InitFilterEco(float sample_rate)
+    {
+        if (false) {}
+        else if (768000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco768000x1[1] = // n = 2, wc = 0.041667, cost = 768000
+            {
+                { {1.30734578e-02,  2.25487290e-02,  1.30734578e-02,  }, {-1.68556533e+00, 7.34260973e-01,  } },
+            };
+            up_filter_.Init(1, kFilterEco768000x1);
+            down_filter_.Init(1, kFilterEco768000x1);
+            oversampling_factor_ = 1;
+        }
+        else if (705600 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco705600x1[1] = // n = 2, wc = 0.045351, cost = 705600
+            {
+                { {1.51171867e-02,  2.66860220e-02,  1.51171867e-02,  }, {-1.65777046e+00, 7.14690850e-01,  } },
+            };
+            up_filter_.Init(1, kFilterEco705600x1);
+            down_filter_.Init(1, kFilterEco705600x1);
+            oversampling_factor_ = 1;
+        }
+        else if (384000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco384000x1[1] = // n = 2, wc = 0.083333, cost = 384000
+            {
+                { {4.27139601e-02,  8.23550653e-02,  4.27139601e-02,  }, {-1.37637598e+00, 5.44158963e-01,  } },
+            };
+            up_filter_.Init(1, kFilterEco384000x1);
+            down_filter_.Init(1, kFilterEco384000x1);
+            oversampling_factor_ = 1;
+        }
+        else if (352800 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco352800x1[1] = // n = 2, wc = 0.090703, cost = 352800
+            {
+                { {4.91764810e-02,  9.53645980e-02,  4.91764810e-02,  }, {-1.32325736e+00, 5.16974919e-01,  } },
+            };
+            up_filter_.Init(1, kFilterEco352800x1);
+            down_filter_.Init(1, kFilterEco352800x1);
+            oversampling_factor_ = 1;
+        }
+        else if (192000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco192000x1[1] = // n = 2, wc = 0.166667, cost = 192000
+            {
+                { {1.27596222e-01,  2.52945826e-01,  1.27596222e-01,  }, {-8.13558232e-01, 3.21696502e-01,  } },
+            };
+            up_filter_.Init(1, kFilterEco192000x1);
+            down_filter_.Init(1, kFilterEco192000x1);
+            oversampling_factor_ = 1;
+        }
+        else if (176400 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco176400x1[1] = // n = 2, wc = 0.181406, cost = 176400
+            {
+                { {1.44245467e-01,  2.86364247e-01,  1.44245467e-01,  }, {-7.23205900e-01, 2.98061080e-01,  } },
+            };
+            up_filter_.Init(1, kFilterEco176400x1);
+            down_filter_.Init(1, kFilterEco176400x1);
+            oversampling_factor_ = 1;
+        }
+        else if (96000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco96000x1[1] = // n = 2, wc = 0.333333, cost = 96000
+            {
+                { {3.18355457e-01,  6.35499388e-01,  3.18355457e-01,  }, {6.03698477e-02,  2.11840454e-01,  } },
+            };
+            up_filter_.Init(1, kFilterEco96000x1);
+            down_filter_.Init(1, kFilterEco96000x1);
+            oversampling_factor_ = 1;
+        }
+        else if (88200 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco88200x1[1] = // n = 2, wc = 0.362812, cost = 88200
+            {
+                { {3.51030922e-01,  7.00977334e-01,  3.51030922e-01,  }, {1.86144183e-01,  2.16894995e-01,  } },
+            };
+            up_filter_.Init(1, kFilterEco88200x1);
+            down_filter_.Init(1, kFilterEco88200x1);
+            oversampling_factor_ = 1;
+        }
+        else if (48000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco48000x2[3] = // n = 6, wc = 0.333333, cost = 288000
+            {
+                { {1.19899770e-02,  1.93553589e-02,  1.19899770e-02,  }, {-1.05432028e+00, 3.34091434e-01,  } },
+                { {1.00000000e+00,  3.40331315e-01,  1.00000000e+00,  }, {-9.30399296e-01, 5.91442638e-01,  } },
+                { {1.00000000e+00,  -1.70308920e-01, 1.00000000e+00,  }, {-8.65799036e-01, 8.69176125e-01,  } },
+            };
+            up_filter_.Init(3, kFilterEco48000x2);
+            down_filter_.Init(3, kFilterEco48000x2);
+            oversampling_factor_ = 2;
+        }
+        else if (44100 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco44100x2[3] = // n = 6, wc = 0.362812, cost = 264600
+            {
+                { {1.53125764e-02,  2.57425431e-02,  1.53125764e-02,  }, {-9.70584967e-01, 2.97964970e-01,  } },
+                { {1.00000000e+00,  5.38687200e-01,  1.00000000e+00,  }, {-8.04786644e-01, 5.72511981e-01,  } },
+                { {1.00000000e+00,  3.79104606e-02,  1.00000000e+00,  }, {-7.03413600e-01, 8.63703611e-01,  } },
+            };
+            up_filter_.Init(3, kFilterEco44100x2);
+            down_filter_.Init(3, kFilterEco44100x2);
+            oversampling_factor_ = 2;
+        }
+        else if (24000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco24000x4[4] = // n = 8, wc = 0.333333, cost = 384000
+            {
+                { {8.01289576e-03,  1.20074287e-02,  8.01289576e-03,  }, {-1.14924262e+00, 3.78398551e-01,  } },
+                { {1.00000000e+00,  2.53825539e-02,  1.00000000e+00,  }, {-1.05399783e+00, 6.01581406e-01,  } },
+                { {1.00000000e+00,  -5.45016335e-01, 1.00000000e+00,  }, {-9.71432362e-01, 8.16367722e-01,  } },
+                { {1.00000000e+00,  -7.15188232e-01, 1.00000000e+00,  }, {-9.48176326e-01, 9.49265274e-01,  } },
+            };
+            up_filter_.Init(4, kFilterEco24000x4);
+            down_filter_.Init(4, kFilterEco24000x4);
+            oversampling_factor_ = 4;
+        }
+        else if (22050 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco22050x4[4] = // n = 8, wc = 0.362812, cost = 352800
+            {
+                { {1.01210329e-02,  1.60226670e-02,  1.01210329e-02,  }, {-1.07178855e+00, 3.41315222e-01,  } },
+                { {1.00000000e+00,  2.32959076e-01,  1.00000000e+00,  }, {-9.40033184e-01, 5.80296394e-01,  } },
+                { {1.00000000e+00,  -3.46960157e-01, 1.00000000e+00,  }, {-8.24680822e-01, 8.07550628e-01,  } },
+                { {1.00000000e+00,  -5.26888322e-01, 1.00000000e+00,  }, {-7.84323326e-01, 9.46916986e-01,  } },
+            };
+            up_filter_.Init(4, kFilterEco22050x4);
+            down_filter_.Init(4, kFilterEco22050x4);
+            oversampling_factor_ = 4;
+        }
+        else if (12000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco12000x7[3] = // n = 6, wc = 0.380952, cost = 252000
+            {
+                { {1.77435462e-02,  3.04417927e-02,  1.77435462e-02,  }, {-9.18472651e-01, 2.77118448e-01,  } },
+                { {1.00000000e+00,  6.51573695e-01,  1.00000000e+00,  }, {-7.25860497e-01, 5.62253141e-01,  } },
+                { {1.00000000e+00,  1.61466032e-01,  1.00000000e+00,  }, {-6.01264252e-01, 8.60920073e-01,  } },
+            };
+            up_filter_.Init(3, kFilterEco12000x7);
+            down_filter_.Init(3, kFilterEco12000x7);
+            oversampling_factor_ = 7;
+        }
+        else if (11025 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco11025x8[3] = // n = 6, wc = 0.362812, cost = 264600
+            {
+                { {1.53125764e-02,  2.57425431e-02,  1.53125764e-02,  }, {-9.70584967e-01, 2.97964970e-01,  } },
+                { {1.00000000e+00,  5.38687200e-01,  1.00000000e+00,  }, {-8.04786644e-01, 5.72511981e-01,  } },
+                { {1.00000000e+00,  3.79104606e-02,  1.00000000e+00,  }, {-7.03413600e-01, 8.63703611e-01,  } },
+            };
+            up_filter_.Init(3, kFilterEco11025x8);
+            down_filter_.Init(3, kFilterEco11025x8);
+            oversampling_factor_ = 8;
+        }
+        else if (8000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterEco8000x10[2] = // n = 4, wc = 0.400000, cost = 160000
+            {
+                { {6.09952430e-02,  1.15522044e-01,  6.09952430e-02,  }, {-5.68349756e-01, 1.76627721e-01,  } },
+                { {1.00000000e+00,  1.46827088e+00,  1.00000000e+00,  }, {-2.96482644e-01, 6.50728295e-01,  } },
+            };
+            up_filter_.Init(2, kFilterEco8000x10);
+            down_filter_.Init(2, kFilterEco8000x10);
+            oversampling_factor_ = 10;
+        }
+        else { InitFilterEco(8000); }
+    }
+
+    void InitFilterStandard(float sample_rate)
+    {
+        if (false) {}
         else if (768000 <= sample_rate)
         {
-            const SOSCoefficients kFilter768000x1[1] = // n = 2, wc = 0.052083, cost = 768000
+            static const SOSCoefficients kFilterStandard768000x1[1] = // n = 2, wc = 0.052083, cost = 768000
+            {
+                { {1.91803242e-02,  3.49016174e-02,  1.91803242e-02,  }, {-1.60715314e+00, 6.80415403e-01,  } },
+            };
+            up_filter_.Init(1, kFilterStandard768000x1);
+            down_filter_.Init(1, kFilterStandard768000x1);
+            oversampling_factor_ = 1;
+        }
+        else if (705600 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard705600x1[1] = // n = 2, wc = 0.056689, cost = 705600
+            {
+                { {2.21903686e-02,  4.09815451e-02,  2.21903686e-02,  }, {-1.57266671e+00, 6.58028989e-01,  } },
+            };
+            up_filter_.Init(1, kFilterStandard705600x1);
+            down_filter_.Init(1, kFilterStandard705600x1);
+            oversampling_factor_ = 1;
+        }
+        else if (384000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard384000x1[1] = // n = 2, wc = 0.104167, cost = 384000
+            {
+                { {6.16818556e-02,  1.20523545e-01,  6.16818556e-02,  }, {-1.22774672e+00, 4.71633979e-01,  } },
+            };
+            up_filter_.Init(1, kFilterStandard384000x1);
+            down_filter_.Init(1, kFilterStandard384000x1);
+            oversampling_factor_ = 1;
+        }
+        else if (352800 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard352800x1[1] = // n = 2, wc = 0.113379, cost = 352800
+            {
+                { {7.06861161e-02,  1.38629029e-01,  7.06861161e-02,  }, {-1.16361120e+00, 4.43612460e-01,  } },
+            };
+            up_filter_.Init(1, kFilterStandard352800x1);
+            down_filter_.Init(1, kFilterStandard352800x1);
+            oversampling_factor_ = 1;
+        }
+        else if (192000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard192000x1[1] = // n = 2, wc = 0.208333, cost = 192000
+            {
+                { {1.75134506e-01,  3.48344473e-01,  1.75134506e-01,  }, {-5.65263652e-01, 2.63877137e-01,  } },
+            };
+            up_filter_.Init(1, kFilterStandard192000x1);
+            down_filter_.Init(1, kFilterStandard192000x1);
+            oversampling_factor_ = 1;
+        }
+        else if (176400 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard176400x1[1] = // n = 2, wc = 0.226757, cost = 176400
+            {
+                { {1.96444526e-01,  3.91091281e-01,  1.96444526e-01,  }, {-4.62337700e-01, 2.46318032e-01,  } },
+            };
+            up_filter_.Init(1, kFilterStandard176400x1);
+            down_filter_.Init(1, kFilterStandard176400x1);
+            oversampling_factor_ = 1;
+        }
+        else if (96000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard96000x2[3] = // n = 6, wc = 0.208333, cost = 576000
+            {
+                { {3.97057437e-03,  4.19471077e-03,  3.97057437e-03,  }, {-1.40243531e+00, 5.20805437e-01,  } },
+                { {1.00000000e+00,  -6.89146445e-01, 1.00000000e+00,  }, {-1.41967388e+00, 7.02595561e-01,  } },
+                { {1.00000000e+00,  -1.09733247e+00, 1.00000000e+00,  }, {-1.47612257e+00, 9.04912126e-01,  } },
+            };
+            up_filter_.Init(3, kFilterStandard96000x2);
+            down_filter_.Init(3, kFilterStandard96000x2);
+            oversampling_factor_ = 2;
+        }
+        else if (88200 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard88200x2[3] = // n = 6, wc = 0.226757, cost = 529200
+            {
+                { {4.70125693e-03,  5.55805412e-03,  4.70125693e-03,  }, {-1.35136923e+00, 4.89566578e-01,  } },
+                { {1.00000000e+00,  -5.22705574e-01, 1.00000000e+00,  }, {-1.35261396e+00, 6.83069565e-01,  } },
+                { {1.00000000e+00,  -9.62728194e-01, 1.00000000e+00,  }, {-1.39644489e+00, 8.98434680e-01,  } },
+            };
+            up_filter_.Init(3, kFilterStandard88200x2);
+            down_filter_.Init(3, kFilterStandard88200x2);
+            oversampling_factor_ = 2;
+        }
+        else if (48000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard48000x3[4] = // n = 8, wc = 0.277778, cost = 576000
+            {
+                { {5.13487274e-03,  6.56948671e-03,  5.13487274e-03,  }, {-1.29204716e+00, 4.54476862e-01,  } },
+                { {1.00000000e+00,  -3.96502401e-01, 1.00000000e+00,  }, {-1.25719151e+00, 6.47967024e-01,  } },
+                { {1.00000000e+00,  -9.13465039e-01, 1.00000000e+00,  }, {-1.23040076e+00, 8.36820472e-01,  } },
+                { {1.00000000e+00,  -1.05651924e+00, 1.00000000e+00,  }, {-1.23575689e+00, 9.54876712e-01,  } },
+            };
+            up_filter_.Init(4, kFilterStandard48000x3);
+            down_filter_.Init(4, kFilterStandard48000x3);
+            oversampling_factor_ = 3;
+        }
+        else if (44100 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard44100x3[5] = // n = 10, wc = 0.302343, cost = 661500
+            {
+                { {5.45917714e-03,  7.26454119e-03,  5.45917714e-03,  }, {-1.26192386e+00, 4.37502892e-01,  } },
+                { {1.00000000e+00,  -3.13131255e-01, 1.00000000e+00,  }, {-1.21305943e+00, 6.35425309e-01,  } },
+                { {1.00000000e+00,  -8.52222119e-01, 1.00000000e+00,  }, {-1.16756470e+00, 8.24173396e-01,  } },
+                { {1.00000000e+00,  -1.02064412e+00, 1.00000000e+00,  }, {-1.14558585e+00, 9.29623004e-01,  } },
+                { {1.00000000e+00,  -1.07245768e+00, 1.00000000e+00,  }, {-1.14407579e+00, 9.81743373e-01,  } },
+            };
+            up_filter_.Init(5, kFilterStandard44100x3);
+            down_filter_.Init(5, kFilterStandard44100x3);
+            oversampling_factor_ = 3;
+        }
+        else if (24000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard24000x5[3] = // n = 6, wc = 0.333333, cost = 360000
+            {
+                { {1.19899770e-02,  1.93553589e-02,  1.19899770e-02,  }, {-1.05432028e+00, 3.34091434e-01,  } },
+                { {1.00000000e+00,  3.40331315e-01,  1.00000000e+00,  }, {-9.30399296e-01, 5.91442638e-01,  } },
+                { {1.00000000e+00,  -1.70308920e-01, 1.00000000e+00,  }, {-8.65799036e-01, 8.69176125e-01,  } },
+            };
+            up_filter_.Init(3, kFilterStandard24000x5);
+            down_filter_.Init(3, kFilterStandard24000x5);
+            oversampling_factor_ = 5;
+        }
+        else if (22050 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard22050x6[3] = // n = 6, wc = 0.302343, cost = 396900
+            {
+                { {9.20740654e-03,  1.40469540e-02,  9.20740654e-03,  }, {-1.14136256e+00, 3.75154149e-01,  } },
+                { {1.00000000e+00,  1.11768962e-01,  1.00000000e+00,  }, {-1.05864019e+00, 6.14344668e-01,  } },
+                { {1.00000000e+00,  -3.97163557e-01, 1.00000000e+00,  }, {-1.03044386e+00, 8.76180186e-01,  } },
+            };
+            up_filter_.Init(3, kFilterStandard22050x6);
+            down_filter_.Init(3, kFilterStandard22050x6);
+            oversampling_factor_ = 6;
+        }
+        else if (12000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard12000x10[2] = // n = 4, wc = 0.333333, cost = 240000
+            {
+                { {3.68948910e-02,  6.76881607e-02,  3.68948910e-02,  }, {-7.91733639e-01, 2.38677412e-01,  } },
+                { {1.00000000e+00,  1.21857919e+00,  1.00000000e+00,  }, {-6.50509371e-01, 6.69335428e-01,  } },
+            };
+            up_filter_.Init(2, kFilterStandard12000x10);
+            down_filter_.Init(2, kFilterStandard12000x10);
+            oversampling_factor_ = 10;
+        }
+        else if (11025 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard11025x11[2] = // n = 4, wc = 0.329829, cost = 242550
+            {
+                { {3.58511077e-02,  6.56265267e-02,  3.58511077e-02,  }, {-8.03498740e-01, 2.42539850e-01,  } },
+                { {1.00000000e+00,  1.20241652e+00,  1.00000000e+00,  }, {-6.69032006e-01, 6.70723700e-01,  } },
+            };
+            up_filter_.Init(2, kFilterStandard11025x11);
+            down_filter_.Init(2, kFilterStandard11025x11);
+            oversampling_factor_ = 11;
+        }
+        else if (8000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilterStandard8000x15[2] = // n = 4, wc = 0.333333, cost = 240000
+            {
+                { {3.68948910e-02,  6.76881607e-02,  3.68948910e-02,  }, {-7.91733639e-01, 2.38677412e-01,  } },
+                { {1.00000000e+00,  1.21857919e+00,  1.00000000e+00,  }, {-6.50509371e-01, 6.69335428e-01,  } },
+            };
+            up_filter_.Init(2, kFilterStandard8000x15);
+            down_filter_.Init(2, kFilterStandard8000x15);
+            oversampling_factor_ = 15;
+        }
+        else { InitFilterStandard(8000); }
+    }
+
+    void InitFilterHigh(float sample_rate)
+    {
+        if (false) {}
+        else if (768000 <= sample_rate)
+        {
+            static const SOSCoefficients kFilter768000x1[1] = // n = 2, wc = 0.052083, cost = 768000
             {
                 { {1.83197956e-02,  3.66063440e-02,  1.83197956e-02,  }, {-1.60702602e+00, 6.80271956e-01,  } },
             };
@@ -154,7 +545,7 @@ protected:
         }
         else if (705600 <= sample_rate)
         {
-            const SOSCoefficients kFilter705600x1[1] = // n = 2, wc = 0.056689, cost = 705600
+            static const SOSCoefficients kFilter705600x1[1] = // n = 2, wc = 0.056689, cost = 705600
             {
                 { {2.13438638e-02,  4.26550556e-02,  2.13438638e-02,  }, {-1.57253460e+00, 6.57877382e-01,  } },
             };
@@ -164,7 +555,7 @@ protected:
         }
         else if (384000 <= sample_rate)
         {
-            const SOSCoefficients kFilter384000x1[1] = // n = 2, wc = 0.104167, cost = 384000
+            static const SOSCoefficients kFilter384000x1[1] = // n = 2, wc = 0.104167, cost = 384000
             {
                 { {6.09620331e-02,  1.21896769e-01,  6.09620331e-02,  }, {-1.22760212e+00, 4.71422957e-01,  } },
             };
@@ -174,7 +565,7 @@ protected:
         }
         else if (352800 <= sample_rate)
         {
-            const SOSCoefficients kFilter352800x1[1] = // n = 2, wc = 0.113379, cost = 352800
+            static const SOSCoefficients kFilter352800x1[1] = // n = 2, wc = 0.113379, cost = 352800
             {
                 { {6.99874107e-02,  1.39948456e-01,  6.99874107e-02,  }, {-1.16347041e+00, 4.43393682e-01,  } },
             };
@@ -184,7 +575,7 @@ protected:
         }
         else if (192000 <= sample_rate)
         {
-            const SOSCoefficients kFilter192000x1[1] = // n = 2, wc = 0.208333, cost = 192000
+            static const SOSCoefficients kFilter192000x1[1] = // n = 2, wc = 0.208333, cost = 192000
             {
                 { {1.74603587e-01,  3.49188678e-01,  1.74603587e-01,  }, {-5.65216145e-01, 2.63611998e-01,  } },
             };
@@ -194,7 +585,7 @@ protected:
         }
         else if (176400 <= sample_rate)
         {
-            const SOSCoefficients kFilter176400x1[1] = // n = 2, wc = 0.226757, cost = 176400
+            static const SOSCoefficients kFilter176400x1[1] = // n = 2, wc = 0.226757, cost = 176400
             {
                 { {1.95938020e-01,  3.91858763e-01,  1.95938020e-01,  }, {-4.62313019e-01, 2.46047822e-01,  } },
             };
@@ -204,7 +595,7 @@ protected:
         }
         else if (96000 <= sample_rate)
         {
-            const SOSCoefficients kFilter96000x2[4] = // n = 8, wc = 0.208333, cost = 768000
+            static const SOSCoefficients kFilter96000x2[4] = // n = 8, wc = 0.208333, cost = 768000
             {
                 { {1.61637850e-04,  2.48564833e-04,  1.61637850e-04,  }, {-1.55379599e+00, 6.19242969e-01,  } },
                 { {1.00000000e+00,  -3.56106191e-03, 1.00000000e+00,  }, {-1.52397985e+00, 7.01779035e-01,  } },
@@ -217,7 +608,7 @@ protected:
         }
         else if (88200 <= sample_rate)
         {
-            const SOSCoefficients kFilter88200x2[4] = // n = 8, wc = 0.226757, cost = 705600
+            static const SOSCoefficients kFilter88200x2[4] = // n = 8, wc = 0.226757, cost = 705600
             {
                 { {2.14361684e-04,  3.44618768e-04,  2.14361684e-04,  }, {-1.51452462e+00, 5.91486912e-01,  } },
                 { {1.00000000e+00,  1.79381294e-01,  1.00000000e+00,  }, {-1.47183116e+00, 6.80568376e-01,  } },
@@ -230,7 +621,7 @@ protected:
         }
         else if (48000 <= sample_rate)
         {
-            const SOSCoefficients kFilter48000x3[6] = // n = 12, wc = 0.277778, cost = 864000
+            static const SOSCoefficients kFilter48000x3[6] = // n = 12, wc = 0.277778, cost = 864000
             {
                 { {1.96007199e-04,  3.15285921e-04,  1.96007199e-04,  }, {-1.49750952e+00, 5.79487424e-01,  } },
                 { {1.00000000e+00,  1.64502383e-01,  1.00000000e+00,  }, {-1.43900370e+00, 6.63196513e-01,  } },
@@ -245,7 +636,7 @@ protected:
         }
         else if (44100 <= sample_rate)
         {
-            const SOSCoefficients kFilter44100x3[7] = // n = 14, wc = 0.302343, cost = 926100
+            static const SOSCoefficients kFilter44100x3[7] = // n = 14, wc = 0.302343, cost = 926100
             {
                 { {2.33467524e-04,  3.85146244e-04,  2.33467524e-04,  }, {-1.46779940e+00, 5.59300587e-01,  } },
                 { {1.00000000e+00,  2.84344987e-01,  1.00000000e+00,  }, {-1.39743012e+00, 6.47280334e-01,  } },
@@ -261,7 +652,7 @@ protected:
         }
         else if (24000 <= sample_rate)
         {
-            const SOSCoefficients kFilter24000x5[4] = // n = 8, wc = 0.333333, cost = 480000
+            static const SOSCoefficients kFilter24000x5[4] = // n = 8, wc = 0.333333, cost = 480000
             {
                 { {9.93374792e-04,  1.81504524e-03,  9.93374792e-04,  }, {-1.28123502e+00, 4.43830055e-01,  } },
                 { {1.00000000e+00,  9.69736619e-01,  1.00000000e+00,  }, {-1.14056361e+00, 5.73274737e-01,  } },
@@ -274,7 +665,7 @@ protected:
         }
         else if (22050 <= sample_rate)
         {
-            const SOSCoefficients kFilter22050x6[4] = // n = 8, wc = 0.302343, cost = 529200
+            static const SOSCoefficients kFilter22050x6[4] = // n = 8, wc = 0.302343, cost = 529200
             {
                 { {6.47358611e-04,  1.15520581e-03,  6.47358611e-04,  }, {-1.35050917e+00, 4.84676642e-01,  } },
                 { {1.00000000e+00,  7.82770646e-01,  1.00000000e+00,  }, {-1.24212580e+00, 6.01760550e-01,  } },
@@ -287,7 +678,7 @@ protected:
         }
         else if (12000 <= sample_rate)
         {
-            const SOSCoefficients kFilter12000x10[3] = // n = 6, wc = 0.333333, cost = 360000
+            static const SOSCoefficients kFilter12000x10[3] = // n = 6, wc = 0.333333, cost = 360000
             {
                 { {3.42306291e-03,  6.53522273e-03,  3.42306291e-03,  }, {-1.13209947e+00, 3.65774415e-01,  } },
                 { {1.00000000e+00,  1.42136933e+00,  1.00000000e+00,  }, {-9.55595652e-01, 5.55195466e-01,  } },
@@ -299,7 +690,7 @@ protected:
         }
         else if (11025 <= sample_rate)
         {
-            const SOSCoefficients kFilter11025x11[3] = // n = 6, wc = 0.329829, cost = 363825
+            static const SOSCoefficients kFilter11025x11[3] = // n = 6, wc = 0.329829, cost = 363825
             {
                 { {3.26702718e-03,  6.22983576e-03,  3.26702718e-03,  }, {-1.14130758e+00, 3.70354990e-01,  } },
                 { {1.00000000e+00,  1.40863044e+00,  1.00000000e+00,  }, {-9.69538649e-01, 5.57917370e-01,  } },
@@ -311,7 +702,7 @@ protected:
         }
         else if (8000 <= sample_rate)
         {
-            const SOSCoefficients kFilter8000x15[3] = // n = 6, wc = 0.333333, cost = 360000
+            static const SOSCoefficients kFilter8000x15[3] = // n = 6, wc = 0.333333, cost = 360000
             {
                 { {3.42306291e-03,  6.53522273e-03,  3.42306291e-03,  }, {-1.13209947e+00, 3.65774415e-01,  } },
                 { {1.00000000e+00,  1.42136933e+00,  1.00000000e+00,  }, {-9.55595652e-01, 5.55195466e-01,  } },
@@ -321,9 +712,9 @@ protected:
             down_filter_.Init(3, kFilter8000x15);
             oversampling_factor_ = 15;
         }
-        else { InitFilter(8000); }
-        //[[[end]]]
+        else { InitFilterHigh(8000); }
     }
+    //[[[end]]]
 };
 
 }
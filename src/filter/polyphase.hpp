@@ -0,0 +1,232 @@
+// Polyphase FIR anti-aliasing filters
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "aafilter.hpp"
+
+namespace ripples
+{
+
+// Drop-in replacement for AAFilter using a linear-phase FIR lowpass split
+// into polyphase branches.
+//
+// As in RipplesPolyEngine, ProcessUp is called oversampling_factor times per
+// input sample, with the input on the first call and zeros on the others.
+// Only the first call's argument is read: each call computes one phase of
+// the interpolator from the input history, so no work is spent on the
+// zero-stuffed samples. ProcessDown is called as often, but only the call
+// for the last substep computes an output, the others just store their
+// input and return the previous output.
+//
+// The kernel is a Kaiser-windowed sinc designed in Init for the same
+// oversampling factor, passband and stopband attenuation as the AAFilter
+// cascade of the selected quality. Its stopband starts at fs - passband,
+// where aliases would fold back into the passband. Below 44.1 kHz the
+// passband is narrowed as far as needed for the kernel to fit in kMaxTaps.
+// bench/AAFilterBench.cpp compares the cost and passband of both filters.
+template <typename T>
+class PolyphaseAAFilter
+{
+public:
+    static constexpr int kMaxTaps = 512;
+
+    PolyphaseAAFilter()
+    {
+        Init(1.f);
+    }
+
+    void Init(float sample_rate, Quality quality = kQualityHigh)
+    {
+        float min_oversampled_rate = 20000 * 6;
+        float fp = 20000;
+        float rs = 100;
+        if (quality == kQualityEco)
+        {
+            min_oversampled_rate = 20000 * 4;
+            fp = 16000;
+            rs = 60;
+        }
+        else if (quality == kQualityStandard)
+        {
+            rs = 60;
+        }
+
+        oversampling_factor_ = std::max(1, (int)std::ceil(min_oversampled_rate / sample_rate));
+        // Nothing to reject without oversampling
+        if (oversampling_factor_ == 1)
+        {
+            num_taps_ = 1;
+            taps_[0] = 1.f;
+        }
+        else
+        {
+            DesignKernel(sample_rate, fp, rs);
+        }
+
+        // Reorder taps into branches, phase p holds taps p, p + factor, ...
+        num_branch_taps_ = num_taps_ / oversampling_factor_;
+        for (int p = 0; p < oversampling_factor_; p++)
+        {
+            for (int j = 0; j < num_branch_taps_; j++)
+            {
+                branch_taps_[p * num_branch_taps_ + j] = taps_[p + j * oversampling_factor_];
+            }
+        }
+
+        Reset();
+    }
+
+    void Reset()
+    {
+        std::fill(up_history_, up_history_ + 2 * kMaxTaps, T(0.f));
+        std::fill(down_history_, down_history_ + 2 * kMaxTaps, T(0.f));
+        up_index_ = 0;
+        down_index_ = 0;
+        up_phase_ = 0;
+        down_phase_ = 0;
+        down_output_ = 0.f;
+    }
+
+    T ProcessUp(T in)
+    {
+        if (up_phase_ == 0)
+        {
+            up_index_ = (up_index_ == 0) ? num_branch_taps_ - 1 : up_index_ - 1;
+            up_history_[up_index_] = in;
+            up_history_[up_index_ + num_branch_taps_] = in;
+        }
+
+        // Newest input first
+        const T* x = &up_history_[up_index_];
+        const float* h = &branch_taps_[up_phase_ * num_branch_taps_];
+        T out = 0.f;
+        for (int j = 0; j < num_branch_taps_; j++)
+        {
+            out += h[j] * x[j];
+        }
+
+        up_phase_ = (up_phase_ + 1 == oversampling_factor_) ? 0 : up_phase_ + 1;
+        return out;
+    }
+
+    T ProcessDown(T in)
+    {
+        down_index_ = (down_index_ == 0) ? num_taps_ - 1 : down_index_ - 1;
+        down_history_[down_index_] = in;
+        down_history_[down_index_ + num_taps_] = in;
+
+        if (down_phase_ + 1 == oversampling_factor_)
+        {
+            const T* x = &down_history_[down_index_];
+            T out = 0.f;
+            for (int k = 0; k < num_taps_; k++)
+            {
+                out += taps_[k] * x[k];
+            }
+            down_output_ = out;
+            down_phase_ = 0;
+        }
+        else
+        {
+            down_phase_++;
+        }
+        return down_output_;
+    }
+
+    int GetOversamplingFactor(void)
+    {
+        return oversampling_factor_;
+    }
+
+protected:
+    int oversampling_factor_;
+    int num_taps_;
+    int num_branch_taps_;
+    float taps_[kMaxTaps];
+    float branch_taps_[kMaxTaps];
+
+    // Histories are stored twice so the newest num_taps_ values are always
+    // contiguous from the write index
+    T up_history_[2 * kMaxTaps];
+    T down_history_[2 * kMaxTaps];
+    int up_index_;
+    int down_index_;
+    int up_phase_;
+    int down_phase_;
+    T down_output_;
+
+    void DesignKernel(float sample_rate, float fp, float rs)
+    {
+        float oversampled_rate = sample_rate * oversampling_factor_;
+        int factor = oversampling_factor_;
+        int max_taps = kMaxTaps / factor * factor;
+
+        // Kaiser's estimate of the length for rs dB is
+        // (rs - 8) / (2.285 * transition) + 1, with the transition band in
+        // radians. Narrow the passband only as far as needed for the kernel
+        // to fit, which happens below 44.1 kHz.
+        float min_transition = (rs - 8.f) / (2.285f * (max_taps - 2)) * oversampled_rate / (2.f * M_PI);
+        fp = std::min(fp, 0.5f * (sample_rate - min_transition));
+        float fs = sample_rate - fp;
+        float transition = 2.f * M_PI * (fs - fp) / oversampled_rate;
+
+        int n = (int)std::ceil((rs - 8.f) / (2.285f * transition)) + 1;
+        float beta = (rs > 50.f) ? 0.1102f * (rs - 8.7f)
+            : 0.5842f * std::pow(rs - 21.f, 0.4f) + 0.07886f * (rs - 21.f);
+
+        // Whole branches only
+        num_taps_ = std::min((n + factor - 1) / factor * factor, max_taps);
+
+        float fc = 0.5f * (fp + fs) / oversampled_rate;
+        float center = 0.5f * (num_taps_ - 1);
+        float sum = 0.f;
+        for (int k = 0; k < num_taps_; k++)
+        {
+            float t = k - center;
+            float sinc = (t == 0.f) ? 2.f * fc
+                : std::sin(2.f * M_PI * fc * t) / (M_PI * t);
+            float r = t / center;
+            float window = BesselI0(beta * std::sqrt(std::max(0.f, 1.f - r * r))) / BesselI0(beta);
+            taps_[k] = sinc * window;
+            sum += taps_[k];
+        }
+
+        // Unity DC gain, RipplesPolyEngine scales the upsampler input by the factor
+        for (int k = 0; k < num_taps_; k++)
+        {
+            taps_[k] /= sum;
+        }
+    }
+
+    static float BesselI0(float x)
+    {
+        float sum = 1.f;
+        float term = 1.f;
+        for (int k = 1; k < 32; k++)
+        {
+            term *= (0.5f * x / k) * (0.5f * x / k);
+            sum += term;
+            if (term < 1e-9f * sum)
+                break;
+        }
+        return sum;
+    }
+};
+
+}
@@ -18,7 +18,11 @@
 #include <cmath>
 #include <random>
 
+#include "../FastMath.hpp"
+#include "../Profiler.hpp"
+#include "../SimdRandom.hpp"
 #include "aafilter.hpp"
+#include "polyphase.hpp"
 #include "rack.hpp"
 
 using namespace rack;
@@ -104,180 +108,304 @@ static const float kVtoICollectorVSat = -10.f;
 // Opamp saturation voltage
 static const float kOpampSatV = 10.6f;
 
-class RipplesEngine {
+// Controls and signals of four voices for one sample of RipplesPolyEngine
+struct RipplesPolyFrame {
+    // Parameters, shared by all voices
+    float res_knob;        //  0 to 1 linear
+    float freq_knob;       //  0 to 1 linear
+    float fm_knob;         // -1 to 1 linear
+    float fm_global_knob;  // -1 to 1 linear
+    float track_knob;      // -1 to 1 linear
+    float xfm_knob;        // -1 to 1 linear
+    int mode;              //  0 to 3, see CoreProcess
+
+    // Inputs, one voice per lane
+    simd::float_4 res_cv;
+    simd::float_4 freq_cv;
+    simd::float_4 fm_cv;
+    simd::float_4 input;
+    simd::float_4 b_output;
+
+    // Outputs
+    simd::float_4 output;
+};
+
+// State of the filter core and RC filters of four voices, which carries over
+// to an engine with other anti-aliasing filters
+struct RipplesCoreState {
+    simd::float_4 cell_voltage[4];
+    // Input and output state of the feedforward, frequency and resonance filters
+    simd::float_4 rc_state[3][2];
+};
+
+// Ripples filter engine running four voices at once, one voice per lane. The
+// four filter cells are unrolled across separate vectors, so there are no
+// shuffles or lane-to-lane dependencies, and 16 voices take 4 passes per
+// sample.
+//
+// Each input gets its own anti-aliasing and RC filters, and only the output
+// selected by mode is computed and downsampled. AntiAliasingFilter is
+// AAFilter or PolyphaseAAFilter.
+template <template <typename> class AntiAliasingFilter = AAFilter>
+class RipplesPolyEngine {
    public:
-    struct Frame {
-        // Parameters
-        float res_knob;   //  0 to 1 linear
-        float freq_knob;  //  0 to 1 linear
-        float fm_knob;    // -1 to 1 linear
-
-        // new
-        float fm_global_knob;  // -1 to 1 linear
-        float track_knob;      //  -1 to 1 linear
-        float xfm_knob;        //  -1 to 1 linear
-        int mode;              //  0.f or 1.f or 2.f
-
-        // Inputs
-        float res_cv;
-        float freq_cv;
-        float fm_cv;
-        float input;
-        float b_output;
-
-        // Outputs
-        float output;
-    };
-
-    RipplesEngine() {
+    // The same for every AntiAliasingFilter, so engines with different
+    // filters can share frames
+    typedef RipplesPolyFrame Frame;
+
+    RipplesPolyEngine() {
+        noise_.seed(random::u64());
         setSampleRate(1.f);
     }
 
-    void setSampleRate(float sample_rate) {
+    // Makes the noise that bootstraps self-oscillation repeat, so the same
+    // input always gives the same output
+    void seedNoise(uint64_t seed) {
+        noise_.seed(seed);
+    }
+
+    void setSampleRate(float sample_rate, Quality quality = kQualityHigh) {
         sample_time_ = 1.f / sample_rate;
-        cell_voltage_ = 0.f;
+        for (int i = 0; i < 4; i++) {
+            cell_voltage_[i] = 0.f;
+        }
 
-        aa_filter_.Init(sample_rate);
+        for (int i = 0; i < 3; i++) {
+            aa_filters_[i].Init(sample_rate, quality);
+        }
 
         float oversample_rate =
-            sample_rate * aa_filter_.GetOversamplingFactor();
+            sample_rate * aa_filters_[0].GetOversamplingFactor();
 
         float freq_cut = 1.f / (2.f * M_PI * kFreqAmpR * kFreqAmpC);
         float res_cut = 1.f / (2.f * M_PI * kResAmpR * kResAmpC);
-        float gain_cut = 1.f / (2.f * M_PI * kGainAmpR * kGainAmpC);
         float ff_cut = 1.f / (2.f * M_PI * kFeedforwardR * kFeedforwardC);
 
-        auto cutoffs = simd::float_4(ff_cut, freq_cut, res_cut, gain_cut);
-        rc_filters_.setCutoffFreq(cutoffs / oversample_rate);
+        ff_filter_.setCutoffFreq(ff_cut / oversample_rate);
+        freq_filter_.setCutoffFreq(freq_cut / oversample_rate);
+        res_filter_.setCutoffFreq(res_cut / oversample_rate);
     }
 
     void process(Frame& frame) {
         // Calculate equivalent frequency CV
-        float v_oct = 0.f;
-        v_oct += (frame.freq_knob - 1.f) * kFreqKnobVoltage;
+        simd::float_4 v_oct = (frame.freq_knob - 1.f) * kFreqKnobVoltage;
         v_oct += frame.freq_cv;
         v_oct += frame.fm_global_knob * (frame.fm_cv * frame.fm_knob +
                                          frame.track_knob * frame.input +
                                          frame.xfm_knob * frame.b_output);
-        v_oct = std::min(v_oct, 0.f);
+        v_oct = simd::fmin(v_oct, 0.f);
 
         // Calculate resonance control current
-        float i_reso = VtoIConverter(kResAmpR, frame.res_cv, kResInputR,
-                                     frame.res_knob * kResKnobV, kResKnobR);
+        simd::float_4 i_reso = VtoIConverter(kResAmpR, frame.res_cv, kResInputR,
+                                             frame.res_knob * kResKnobV, kResKnobR);
 
-        // Pack and upsample inputs
-        int oversampling_factor = aa_filter_.GetOversamplingFactor();
+        // Upsample inputs
+        int oversampling_factor = aa_filters_[0].GetOversamplingFactor();
         float timestep = sample_time_ / oversampling_factor;
         // Add noise to input to bootstrap self-oscillation
-        float input = frame.input + 1e-6 * (random::uniform() - 0.5f);
-        auto inputs = simd::float_4(input, v_oct, i_reso, 0.f);
-        inputs *= oversampling_factor;
-        simd::float_4 outputs;
-
-        for (int i = 0; i < oversampling_factor; i++) {
-            inputs = aa_filter_.ProcessUp((i == 0) ? inputs : 0.f);
-            outputs = CoreProcess(inputs, timestep);
-            outputs = aa_filter_.ProcessDown(outputs);
+        simd::float_4 noise = noise_.uniform();
+        simd::float_4 inputs[3] = {
+            frame.input + 1e-6f * (noise - 0.5f),
+            v_oct,
+            i_reso,
+        };
+        simd::float_4 output;
+
+        // Each stage runs over a chunk of oversampled steps before the next,
+        // which gives the same result as one step at a time and lets a
+        // profiling build time the stages with few clock reads
+        for (int start = 0; start < oversampling_factor; start += kChunkSteps) {
+            int steps = std::min(kChunkSteps, oversampling_factor - start);
+            simd::float_4 up[3][kChunkSteps];
+            simd::float_4 core[kChunkSteps];
+            {
+                CELLA_PROFILE_SCOPE(profiler_, profiler_anti_aliasing_stage_);
+                for (int i = 0; i < steps; i++) {
+                    for (int j = 0; j < 3; j++) {
+                        up[j][i] = aa_filters_[j].ProcessUp((start + i == 0) ? inputs[j] * oversampling_factor : 0.f);
+                    }
+                }
+            }
+            {
+                CELLA_PROFILE_SCOPE(profiler_, profiler_core_stage_);
+                for (int i = 0; i < steps; i++) {
+                    core[i] = CoreProcess(up[0][i], up[1][i], up[2][i], timestep, frame.mode);
+                }
+            }
+            {
+                CELLA_PROFILE_SCOPE(profiler_, profiler_anti_aliasing_stage_);
+                for (int i = 0; i < steps; i++) {
+                    output = aa_filters_[0].ProcessDown(core[i]);
+                }
+            }
         }
 
-        frame.output = outputs[frame.mode];
+        frame.output = output;
+    }
+
+    // Times the filters and the core into two stages of profiler, see
+    // Profiler.hpp
+    void setProfiler(Profiler* profiler, int anti_aliasing_stage, int core_stage) {
+        profiler_ = profiler;
+        profiler_anti_aliasing_stage_ = anti_aliasing_stage;
+        profiler_core_stage_ = core_stage;
+    }
+
+    // Largest magnitude of the filter cells of each voice
+    simd::float_4 getStateLevel() {
+        simd::float_4 level = simd::abs(cell_voltage_[0]);
+        for (int i = 1; i < 4; i++) {
+            level = simd::fmax(level, simd::abs(cell_voltage_[i]));
+        }
+        return level;
+    }
+
+    // Mask of the voices whose resonance is high enough to self-oscillate
+    // without input
+    simd::float_4 canSelfOscillate(const Frame& frame) {
+        simd::float_4 i_reso = VtoIConverter(kResAmpR, frame.res_cv, kResInputR,
+                                             frame.res_knob * kResKnobV, kResKnobR);
+        float i_threshold = VtoIConverter(kResAmpR, 0.f, kResInputR,
+                                          kSelfOscillationResKnob * kResKnobV, kResKnobR)[0];
+        return i_reso >= i_threshold;
+    }
+
+    RipplesCoreState getCoreState() {
+        RipplesCoreState state;
+        for (int i = 0; i < 4; i++) {
+            state.cell_voltage[i] = cell_voltage_[i];
+        }
+        dsp::TRCFilter<simd::float_4>* filters[3] = {&ff_filter_, &freq_filter_, &res_filter_};
+        for (int i = 0; i < 3; i++) {
+            state.rc_state[i][0] = filters[i]->xstate[0];
+            state.rc_state[i][1] = filters[i]->ystate[0];
+        }
+        return state;
+    }
+
+    // Continues from state, keeping the anti-aliasing filters and the RC
+    // filter cutoffs of this engine
+    void setCoreState(const RipplesCoreState& state) {
+        for (int i = 0; i < 4; i++) {
+            cell_voltage_[i] = state.cell_voltage[i];
+        }
+        dsp::TRCFilter<simd::float_4>* filters[3] = {&ff_filter_, &freq_filter_, &res_filter_};
+        for (int i = 0; i < 3; i++) {
+            filters[i]->xstate[0] = state.rc_state[i][0];
+            filters[i]->ystate[0] = state.rc_state[i][1];
+        }
+    }
+
+    // Clears the history of the anti-aliasing filters, e.g. before taking over
+    // the state of another engine with setCoreState()
+    void resetAntiAliasing() {
+        for (int i = 0; i < 3; i++) {
+            aa_filters_[i].Reset();
+        }
+    }
+
+    // Clears the audio path, keeping the control signal filters. Used when the
+    // voices stop being processed, so they resume from silence.
+    void clearState() {
+        for (int i = 0; i < 4; i++) {
+            cell_voltage_[i] = 0.f;
+        }
+        aa_filters_[0].Reset();
+        ff_filter_.reset();
     }
 
    protected:
+    // Lowest resonance knob setting at which a voice without input and
+    // resonance CV starts oscillating, with some margin. It is highest at low
+    // cutoffs, around 0.87, and lowest, around 0.63, at the top of the range.
+    static constexpr float kSelfOscillationResKnob = 0.6f;
+
+    static constexpr int kChunkSteps = 8;
+
     float sample_time_;
-    simd::float_4 cell_voltage_;
-    ripples::AAFilter<simd::float_4> aa_filter_;
-    dsp::TRCFilter<simd::float_4> rc_filters_;
+    SimdRandom noise_;
+    Profiler* profiler_ = nullptr;
+    int profiler_anti_aliasing_stage_ = 0;
+    int profiler_core_stage_ = 0;
+    // Cells (v0, v1, v2, v3) of four voices
+    simd::float_4 cell_voltage_[4];
+    // Filter 0 also downsamples the output
+    AntiAliasingFilter<simd::float_4> aa_filters_[3];
+    dsp::TRCFilter<simd::float_4> ff_filter_;
+    dsp::TRCFilter<simd::float_4> freq_filter_;
+    dsp::TRCFilter<simd::float_4> res_filter_;
 
     // High-rate processing core
-    // inputs: vector containing (input, v_oct, i_reso, i_vca)
-    // returns: vector containing (bp2, lp2, lp3, lp4)
-    simd::float_4 CoreProcess(simd::float_4 inputs, float timestep) {
-        rc_filters_.process(inputs);
-
+    // returns bp2, lp2, lp3 or lp4 for mode 0 to 3
+    simd::float_4 CoreProcess(simd::float_4 input, simd::float_4 v_oct, simd::float_4 i_reso, float timestep, int mode) {
         // Lowpass the control signals
-        simd::float_4 control = rc_filters_.lowpass();
-        float v_oct = control[1];
-        float i_reso = control[2];
+        freq_filter_.process(v_oct);
+        res_filter_.process(i_reso);
+        v_oct = freq_filter_.lowpass();
+        i_reso = res_filter_.lowpass();
 
         // Highpass the input signal to generate the resonance feedforward
-        float feedforward = rc_filters_.highpass()[0];
+        ff_filter_.process(input);
+        simd::float_4 vp = ff_filter_.highpass() * kFeedforwardGain;
 
         // Calculate -A / RC
-        simd::float_4 rad_per_s = -std::exp2f(v_oct) / kFilterCellRC;
-
-        // Emulate the filter core
-        cell_voltage_ = StepRK2(timestep, cell_voltage_, [&](simd::float_4 vout) {
-            // vout contains the initial cell voltages (v0, v1 v2, v3)
-
-            // Rotate cell voltages. vin will contain (v3, v0, v1, v2)
-            simd::float_4 vin =
-                _mm_shuffle_ps(vout.v, vout.v, _MM_SHUFFLE(2, 1, 0, 3));
-
-            // The core input is the filter input plus the resonance signal
-            float vp = feedforward * kFeedforwardGain;
-            float vn = vout[3] * kFeedbackGain;
-            float res = kFilterCellR * OTAVCA(vp, vn, i_reso);
-            simd::float_4 in = inputs[0] * kFilterInputGain + res;
-
-            // Replace lowest element of vin with lowest element from in
-            vin = _mm_move_ss(vin.v, in.v);
-
-            // Now, vin contains (in, v0, v1, v2)
-            // and vout contains (v0, v1, v2, v3)
-            // Their sum gives us vin + vout for each cell
-            simd::float_4 vsum = vin + vout;
-            simd::float_4 dvout = rad_per_s * vsum;
-
-            // Generate some even-order harmonics via self-modulation
-            dvout *= (1.f + vsum * kFilterCellSelfModulation);
-
-            return dvout;
-        });
-
-        cell_voltage_ = simd::clamp(cell_voltage_, -kOpampSatV, kOpampSatV);
-
-        float lp1 = cell_voltage_[0];
-        float lp2 = cell_voltage_[1];
-        float lp3 = cell_voltage_[2];
-        float lp4 = cell_voltage_[3];
-        float bp2 = (lp1 + lp2) * kBP2Gain;
-        lp2 *= kLP2Gain;
-        lp3 *= kLP3Gain;
-        lp4 *= kLP4Gain;
-        return simd::float_4(bp2, lp2, lp3, lp4);
-    }
+        simd::float_4 rad_per_s = -fastmath::exp2(v_oct) / kFilterCellRC;
+        simd::float_4 in = input * kFilterInputGain;
+
+        // Emulate the filter core, each cell is driven by the previous one
+        // and the first by the input plus the resonance signal
+        auto derivatives = [&](const simd::float_4* vout, simd::float_4* dvout) {
+            simd::float_4 res = kFilterCellR * OTAVCA(vp, vout[3] * kFeedbackGain, i_reso);
+            simd::float_4 vin = in + res;
+            for (int k = 0; k < 4; k++) {
+                simd::float_4 vsum = vin + vout[k];
+                // Generate some even-order harmonics via self-modulation
+                dvout[k] = rad_per_s * vsum * (1.f + vsum * kFilterCellSelfModulation);
+                vin = vout[k];
+            }
+        };
+
+        // 2nd order Runge-Kutta step
+        simd::float_4 k1[4], mid[4], k2[4];
+        derivatives(cell_voltage_, k1);
+        for (int k = 0; k < 4; k++) {
+            mid[k] = cell_voltage_[k] + k1[k] * timestep / 2.f;
+        }
+        derivatives(mid, k2);
+        for (int k = 0; k < 4; k++) {
+            cell_voltage_[k] = simd::clamp(cell_voltage_[k] + timestep * k2[k], -kOpampSatV, kOpampSatV);
+        }
 
-    // Solves an ODE system using the 2nd order Runge-Kutta method
-    template <typename T, typename F>
-    T StepRK2(float dt, T y, F f) {
-        T k1 = f(y);
-        T k2 = f(y + k1 * dt / 2.f);
-        return y + dt * k2;
+        switch (mode) {
+            case 0: return (cell_voltage_[0] + cell_voltage_[1]) * kBP2Gain;
+            case 1: return cell_voltage_[1] * kLP2Gain;
+            case 2: return cell_voltage_[2] * kLP3Gain;
+            default: return cell_voltage_[3] * kLP4Gain;
+        }
     }
 
     // Model of Ripples nonlinear CV voltage-to-current converters
-    float VtoIConverter(
-        float rfb,                         // Amplifier feedback resistor
-        float vc, float rc,                // CV voltage and input resistor
-        float vp = 0.f, float rp = 1e12f)  // Knob voltage and resistor
+    simd::float_4 VtoIConverter(
+        float rfb,                 // Amplifier feedback resistor
+        simd::float_4 vc,          // CV voltage
+        float rc,                  // CV input resistor
+        float vp, float rp)        // Knob voltage and resistor
     {
         // Find nominal voltage at the BJT collector, ignoring nonlinearity
-        float vnom = -(vc * rfb / rc + vp * rfb / rp);
+        simd::float_4 vnom = -(vc * rfb / rc + vp * rfb / rp);
 
         // Apply clipping - naive for now
-        float vout = std::max(vnom, kVtoICollectorVSat);
+        simd::float_4 vout = simd::fmax(vnom, kVtoICollectorVSat);
 
         // Find voltage at the opamp's negative terminal
         float nrc = rp * rfb;
         float nrp = rc * rfb;
         float nrfb = rc * rp;
-        float vneg = (vc * nrc + vp * nrp + vout * nrfb) / (nrc + nrp + nrfb);
+        simd::float_4 vneg = (vc * nrc + vp * nrp + vout * nrfb) / (nrc + nrp + nrfb);
 
         // Find output current
-        float iout = (vneg - vout) / rfb;
-
-        return std::max(iout, 0.f);
+        simd::float_4 iout = (vneg - vout) / rfb;
+        return simd::fmax(iout, 0.f);
     }
 
     // Model of LM13700 OTA VCA, neglecting linearizing diodes
@@ -285,8 +413,7 @@ class RipplesEngine {
     // vn: voltage at negative input terminal
     // i_abc: amplifier bias current
     // returns: OTA output current
-    template <typename T>
-    T OTAVCA(T vp, T vn, T i_abc) {
+    simd::float_4 OTAVCA(simd::float_4 vp, simd::float_4 vn, simd::float_4 i_abc) {
         // For the derivation of this equation, see this fantastic paper:
         //   http://www.openmusiclabs.com/files/otadist.pdf
         // Thanks guest!
@@ -299,18 +426,8 @@ class RipplesEngine {
         const float kKoverQ = 8.617333262145e-5;
         const float kKelvin = 273.15f;  // 0C in K
         const float kVt = kKoverQ * (kTemperature + kKelvin);
-        const float kZlim = 2.f * std::sqrt(3.f);
-
-        T vi = vp - vn;
-        T zlim = kZlim;
-        T z = math::clamp(vi / (2 * kVt), -zlim, zlim);
-
-        // Pade approximant of tanh(z)
-        T z2 = z * z;
-        T q = 12.f + z2;
-        T p = 12.f * z * q / (36.f * z2 + q * q);
 
-        return i_abc * p;
+        return i_abc * fastmath::tanhPade((vp - vn) / (2 * kVt));
     }
 };
 
@@ -66,17 +66,12 @@ public:
         x_[num_sections_][2] = 0.f;
     }
 
+    // The filter keeps a pointer to sections rather than a copy, so filters
+    // with the same response share one table. sections must outlive the
+    // filter, e.g. be static like the AAFilter tables.
     void SetCoefficients(const SOSCoefficients* sections)
     {
-        for (int n = 0; n < num_sections_; n++)
-        {
-            sections_[n].b[0] = sections[n].b[0];
-            sections_[n].b[1] = sections[n].b[1];
-            sections_[n].b[2] = sections[n].b[2];
-
-            sections_[n].a[0] = sections[n].a[0];
-            sections_[n].a[1] = sections[n].a[1];
-        }
+        sections_ = sections;
     }
 
     T Process(T in)
@@ -111,7 +106,7 @@ public:
 
 protected:
     int num_sections_;
-    SOSCoefficients sections_[max_num_sections];
+    const SOSCoefficients* sections_ = nullptr;
     T x_[max_num_sections + 1][3];
 };
 